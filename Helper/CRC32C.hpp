@@ -0,0 +1,103 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_CRC32C_HPP
+#define OPENHDTESTING_CRC32C_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <array>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+// CRC32C (Castagnoli polynomial, same as iSCSI / ext4). Uses the crc32 instructions of SSE4.2 (x86) or
+// ARMv8 (needs -march=armv8-a+crc) when available, else a table based software implementation.
+// On x86 the SSE4.2 check is done at runtime, such that the binary still runs on old CPUs.
+namespace CRC32C{
+    static constexpr uint32_t POLYNOMIAL_REVERSED=0x82F63B78;
+    static std::array<uint32_t,256> createTable(){
+        std::array<uint32_t,256> table{};
+        for(uint32_t i=0;i<256;i++){
+            uint32_t crc=i;
+            for(int j=0;j<8;j++){
+                crc=(crc>>1) ^ ((crc & 1) ? POLYNOMIAL_REVERSED : 0);
+            }
+            table[i]=crc;
+        }
+        return table;
+    }
+    static uint32_t calculateSoftware(const uint8_t* data,size_t size){
+        static const auto table=createTable();
+        uint32_t crc=0xFFFFFFFF;
+        for(size_t i=0;i<size;i++){
+            crc=table[(crc ^ data[i]) & 0xFF] ^ (crc>>8);
+        }
+        return ~crc;
+    }
+#if defined(__x86_64__)
+    __attribute__((target("sse4.2")))
+    static uint32_t calculateHardware(const uint8_t* data,size_t size){
+        uint64_t crc=0xFFFFFFFF;
+        for(;size>=8;size-=8,data+=8){
+            uint64_t word;
+            memcpy(&word,data,8);
+            crc=_mm_crc32_u64(crc,word);
+        }
+        uint32_t crc32=(uint32_t)crc;
+        for(;size>0;size--,data++){
+            crc32=_mm_crc32_u8(crc32,*data);
+        }
+        return ~crc32;
+    }
+    static bool hasHardwareSupport(){
+        static const bool supported=__builtin_cpu_supports("sse4.2");
+        return supported;
+    }
+#elif defined(__ARM_FEATURE_CRC32)
+    static uint32_t calculateHardware(const uint8_t* data,size_t size){
+        uint32_t crc=0xFFFFFFFF;
+#if defined(__aarch64__)
+        for(;size>=8;size-=8,data+=8){
+            uint64_t word;
+            memcpy(&word,data,8);
+            crc=__crc32cd(crc,word);
+        }
+#endif
+        for(;size>=4;size-=4,data+=4){
+            uint32_t word;
+            memcpy(&word,data,4);
+            crc=__crc32cw(crc,word);
+        }
+        for(;size>0;size--,data++){
+            crc=__crc32cb(crc,*data);
+        }
+        return ~crc;
+    }
+    static bool hasHardwareSupport(){
+        return true;
+    }
+#else
+    static uint32_t calculateHardware(const uint8_t* data,size_t size){
+        return calculateSoftware(data,size);
+    }
+    static bool hasHardwareSupport(){
+        return false;
+    }
+#endif
+    // Use this one, picks the fastest implementation available
+    static uint32_t calculate(const uint8_t* data,size_t size){
+        if(hasHardwareSupport()){
+            return calculateHardware(data,size);
+        }
+        return calculateSoftware(data,size);
+    }
+}
+
+#endif //OPENHDTESTING_CRC32C_HPP
@@ -0,0 +1,265 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#include "ClockSync.h"
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+
+static int64_t toNs(const std::chrono::steady_clock::time_point timePoint){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(timePoint.time_since_epoch()).count();
+}
+
+ClockSyncServer::ClockSyncServer(int port,std::chrono::nanoseconds artificialClockOffset):
+mPort(port),mArtificialClockOffset(artificialClockOffset){}
+
+ClockSyncServer::~ClockSyncServer() {
+    stop();
+}
+
+std::chrono::steady_clock::time_point ClockSyncServer::now() const {
+    return std::chrono::steady_clock::now()+mArtificialClockOffset;
+}
+
+void ClockSyncServer::start() {
+    mSocket=socket(AF_INET,SOCK_DGRAM,IPPROTO_UDP);
+    if(mSocket<0){
+        MLOGE<<"Cannot create socket";
+        return;
+    }
+    int enable=1;
+    setsockopt(mSocket,SOL_SOCKET,SO_REUSEADDR,&enable,sizeof(int));
+    sockaddr_in myaddr{};
+    myaddr.sin_family=AF_INET;
+    myaddr.sin_addr.s_addr=htonl(INADDR_ANY);
+    myaddr.sin_port=htons(mPort);
+    if(bind(mSocket,(sockaddr*)&myaddr,sizeof(myaddr))==-1){
+        MLOGE<<"Error binding Port; "<<mPort;
+        close(mSocket);
+        mSocket=-1;
+        return;
+    }
+    running=true;
+    mThread=std::make_unique<std::thread>([this]{loop();});
+}
+
+void ClockSyncServer::stop() {
+    if(mThread==nullptr)return;
+    running=false;
+    //this stops the recvfrom even if in blocking mode
+    shutdown(mSocket,SHUT_RD);
+    mThread->join();
+    mThread.reset();
+    close(mSocket);
+    mSocket=-1;
+}
+
+void ClockSyncServer::loop() {
+    ClockSyncPacket packet{};
+    sockaddr_in source{};
+    while(running){
+        socklen_t sourceLen=sizeof(source);
+        const auto len=recvfrom(mSocket,&packet,sizeof(packet),0,(sockaddr*)&source,&sourceLen);
+        const auto t2=now();
+        if(len!=sizeof(ClockSyncPacket) || packet.magic!=ClockSyncPacket::MAGIC){
+            continue;
+        }
+        packet.t2=toNs(t2);
+        packet.t3=toNs(now());
+        sendto(mSocket,&packet,sizeof(packet),0,(sockaddr*)&source,sourceLen);
+    }
+}
+
+ClockSyncClient::ClockSyncClient(const std::string& serverIp,int port,std::chrono::milliseconds interval,std::chrono::nanoseconds artificialClockOffset):
+mServerIp(serverIp),mPort(port),mInterval(interval),mArtificialClockOffset(artificialClockOffset){}
+
+ClockSyncClient::~ClockSyncClient() {
+    stop();
+}
+
+std::chrono::steady_clock::time_point ClockSyncClient::now() const {
+    return std::chrono::steady_clock::now()+mArtificialClockOffset;
+}
+
+void ClockSyncClient::start() {
+    mSocket=socket(AF_INET,SOCK_DGRAM,IPPROTO_UDP);
+    if(mSocket<0){
+        MLOGE<<"Cannot create socket";
+        return;
+    }
+    sockaddr_in address{};
+    address.sin_family=AF_INET;
+    address.sin_port=htons(mPort);
+    inet_pton(AF_INET,mServerIp.c_str(),&address.sin_addr);
+    if(connect(mSocket,(sockaddr*)&address,sizeof(address))<0){
+        MLOGE<<"Cannot connect to clock sync server "<<mServerIp<<":"<<mPort<<" "<<strerror(errno);
+    }
+    // A lost ping must not block the loop for longer than one interval
+    const auto intervalUs=std::chrono::duration_cast<std::chrono::microseconds>(mInterval).count();
+    timeval timeout{};
+    timeout.tv_sec=intervalUs/1000000;
+    timeout.tv_usec=intervalUs%1000000;
+    setsockopt(mSocket,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+    running=true;
+    mThread=std::make_unique<std::thread>([this]{loop();});
+}
+
+void ClockSyncClient::stop() {
+    if(mThread==nullptr)return;
+    running=false;
+    shutdown(mSocket,SHUT_RDWR);
+    mThread->join();
+    mThread.reset();
+    close(mSocket);
+    mSocket=-1;
+}
+
+void ClockSyncClient::loop() {
+    uint32_t seqNr=0;
+    auto nextPing=std::chrono::steady_clock::now();
+    while(running){
+        ClockSyncPacket request{};
+        request.magic=ClockSyncPacket::MAGIC;
+        request.seqNr=seqNr++;
+        const auto t1=now();
+        request.t1=toNs(t1);
+        send(mSocket,&request,sizeof(request),0);
+        // read until we get the answer to this request (or time out), older answers are discarded
+        while(running){
+            ClockSyncPacket response{};
+            const auto len=recv(mSocket,&response,sizeof(response),0);
+            const auto t4=now();
+            if(len<0){
+                // timeout or socket shut down
+                break;
+            }
+            if(len!=sizeof(ClockSyncPacket) || response.magic!=ClockSyncPacket::MAGIC || response.seqNr!=request.seqNr){
+                continue;
+            }
+            // Standard NTP math, offset=((t2-t1)+(t3-t4))/2 delay=(t4-t1)-(t3-t2)
+            const int64_t t1ns=response.t1,t2ns=response.t2,t3ns=response.t3,t4ns=toNs(t4);
+            Sample sample{};
+            sample.offset=std::chrono::nanoseconds(((t2ns-t1ns)+(t3ns-t4ns))/2);
+            sample.roundTripTime=std::chrono::nanoseconds((t4ns-t1ns)-(t3ns-t2ns));
+            // The offset is estimated for the (local) middle of the ping, without the artificial offset
+            sample.localTime=t1+(t4-t1)/2-mArtificialClockOffset;
+            addSample(sample);
+            break;
+        }
+        nextPing+=mInterval;
+        std::this_thread::sleep_until(nextPing);
+    }
+}
+
+void ClockSyncClient::addSample(const Sample& sample) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    nAnsweredPings++;
+    samples.push_back(sample);
+    if(samples.size()>MAX_SAMPLES){
+        samples.pop_front();
+    }
+    minRoundTripTime=samples.front().roundTripTime;
+    for(const auto& s:samples){
+        minRoundTripTime=std::min(minRoundTripTime,s.roundTripTime);
+    }
+    // Only use pings whose round trip time is close to the best one
+    const auto maxRoundTripTime=minRoundTripTime+std::max(minRoundTripTime/2,std::chrono::nanoseconds(std::chrono::microseconds(50)));
+    // Least squares fit offset=a+drift*x with x relative to the newest sample (keeps the numbers small)
+    const auto reference=samples.back().localTime;
+    double n=0,sumX=0,sumY=0,sumXX=0,sumXY=0;
+    for(const auto& s:samples){
+        if(s.roundTripTime>maxRoundTripTime)continue;
+        const double x=(double)std::chrono::duration_cast<std::chrono::nanoseconds>(s.localTime-reference).count();
+        const double y=(double)s.offset.count();
+        n++;
+        sumX+=x;sumY+=y;sumXX+=x*x;sumXY+=x*y;
+    }
+    if(n<MIN_SAMPLES_FOR_ESTIMATE){
+        return;
+    }
+    const double denominator=n*sumXX-sumX*sumX;
+    Estimate estimate{};
+    estimate.valid=true;
+    // All samples at the same time would make the drift undefined, only use the average then
+    estimate.drift=std::abs(denominator)<1e-9 ? 0 : (n*sumXY-sumX*sumY)/denominator;
+    estimate.referenceOffsetNs=(sumY-estimate.drift*sumX)/n;
+    estimate.referenceTime=reference;
+    publishEstimate(estimate);
+}
+
+void ClockSyncClient::publishEstimate(const Estimate& estimate) {
+    const uint32_t version=estimateVersion.load(std::memory_order_relaxed);
+    estimateVersion.store(version+1,std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    estimateValid.store(estimate.valid,std::memory_order_relaxed);
+    estimateReferenceTimeNs.store(toNs(estimate.referenceTime),std::memory_order_relaxed);
+    estimateReferenceOffsetNs.store(estimate.referenceOffsetNs,std::memory_order_relaxed);
+    estimateDrift.store(estimate.drift,std::memory_order_relaxed);
+    estimateVersion.store(version+2,std::memory_order_release);
+}
+
+ClockSyncClient::Estimate ClockSyncClient::readEstimate() const {
+    Estimate estimate{};
+    while(true){
+        const uint32_t version=estimateVersion.load(std::memory_order_acquire);
+        if(version & 1){
+            continue;
+        }
+        estimate.valid=estimateValid.load(std::memory_order_relaxed);
+        estimate.referenceTime=std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::nanoseconds(estimateReferenceTimeNs.load(std::memory_order_relaxed))));
+        estimate.referenceOffsetNs=estimateReferenceOffsetNs.load(std::memory_order_relaxed);
+        estimate.drift=estimateDrift.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(estimateVersion.load(std::memory_order_relaxed)==version){
+            return estimate;
+        }
+    }
+}
+
+std::chrono::nanoseconds ClockSyncClient::Estimate::getOffset(const std::chrono::steady_clock::time_point localTimePoint) const {
+    if(!valid)return std::chrono::nanoseconds(0);
+    const double x=(double)std::chrono::duration_cast<std::chrono::nanoseconds>(localTimePoint-referenceTime).count();
+    return std::chrono::nanoseconds((int64_t)std::llround(referenceOffsetNs+drift*x));
+}
+
+bool ClockSyncClient::hasEstimate() const {
+    return estimateValid.load(std::memory_order_acquire);
+}
+
+bool ClockSyncClient::waitForEstimate(const std::chrono::milliseconds timeout) const {
+    const auto deadline=std::chrono::steady_clock::now()+timeout;
+    while(!hasEstimate() && std::chrono::steady_clock::now()<deadline){
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return hasEstimate();
+}
+
+std::chrono::nanoseconds ClockSyncClient::getOffset(const std::chrono::steady_clock::time_point localTimePoint) const {
+    return readEstimate().getOffset(localTimePoint);
+}
+
+std::chrono::steady_clock::time_point ClockSyncClient::remoteToLocal(const std::chrono::steady_clock::time_point remoteTimePoint) const {
+    // One snapshot for both terms. The offset changes so slowly that using the remote time point for the drift term does not matter
+    const auto estimate=readEstimate();
+    const auto offset=estimate.getOffset(remoteTimePoint-estimate.getOffset(remoteTimePoint));
+    return remoteTimePoint-std::chrono::duration_cast<std::chrono::steady_clock::duration>(offset);
+}
+
+std::string ClockSyncClient::getEstimateReadable() const {
+    const auto estimate=readEstimate();
+    const auto offset=estimate.getOffset(std::chrono::steady_clock::now());
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::stringstream ss;
+    if(!estimate.valid){
+        ss<<"no estimate yet ("<<nAnsweredPings<<" pings answered)";
+        return ss.str();
+    }
+    ss<<"offset="<<MyTimeHelper::R(offset)<<" drift="<<estimate.drift*1e6<<"ppm min rtt="<<MyTimeHelper::R(minRoundTripTime)
+    <<" (+-"<<MyTimeHelper::R(minRoundTripTime/2)<<") pings="<<nAnsweredPings;
+    return ss.str();
+}
@@ -0,0 +1,123 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_CLOCKSYNC_H
+#define OPENHDTESTING_CLOCKSYNC_H
+
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <memory>
+#include <chrono>
+#include <netinet/in.h>
+#include "TimeHelper.hpp"
+
+// NTP like clock offset estimation between two hosts over a side UDP port.
+// The side whose clock is used as reference (e.g. the tx side that writes the timestamps into the packets) runs
+// the ClockSyncServer, the other side (e.g. the rx side) runs the ClockSyncClient and can then convert timestamps
+// of the server into its own clock, which gives one way latency without synchronized system clocks.
+// Both sides use steady_clock. For testing on one machine an artificial offset can be added to each clock.
+
+// Ping message, the same struct is used for request and response
+struct ClockSyncPacket{
+    static constexpr uint32_t MAGIC=0x434C4B53;
+    uint32_t magic;
+    uint32_t seqNr;
+    // client send time (client clock)
+    int64_t t1;
+    // server receive time (server clock)
+    int64_t t2;
+    // server send time (server clock)
+    int64_t t3;
+} __attribute__ ((packed));
+
+/**
+ * Answers ping requests on @param port with its own receive and send time. Runs on its own thread.
+ */
+class ClockSyncServer{
+public:
+    explicit ClockSyncServer(int port,std::chrono::nanoseconds artificialClockOffset=std::chrono::nanoseconds(0));
+    ~ClockSyncServer();
+    void start();
+    void stop();
+    // steady_clock::now() plus the artificial offset
+    std::chrono::steady_clock::time_point now()const;
+private:
+    void loop();
+    const int mPort;
+    const std::chrono::nanoseconds mArtificialClockOffset;
+    int mSocket=-1;
+    std::atomic<bool> running=false;
+    std::unique_ptr<std::thread> mThread;
+};
+
+/**
+ * Pings the ClockSyncServer every @param interval and continuously estimates the offset and drift of the server clock
+ * relative to the local clock. Only pings with a round trip time close to the lowest seen are used (the others were
+ * delayed in one direction, which biases the offset), the offset at any time point is a least squares fit over them.
+ */
+class ClockSyncClient{
+public:
+    ClockSyncClient(const std::string& serverIp,int port,std::chrono::milliseconds interval=std::chrono::milliseconds(100),
+                    std::chrono::nanoseconds artificialClockOffset=std::chrono::nanoseconds(0));
+    ~ClockSyncClient();
+    void start();
+    void stop();
+    std::chrono::steady_clock::time_point now()const;
+    // True once enough pings were answered for a usable estimate
+    bool hasEstimate()const;
+    // Wait up to @param timeout for the first estimate, returns hasEstimate()
+    bool waitForEstimate(std::chrono::milliseconds timeout)const;
+    // Estimated (server clock - local clock) at @param localTimePoint, including drift
+    std::chrono::nanoseconds getOffset(std::chrono::steady_clock::time_point localTimePoint)const;
+    // Convert a time point of the server clock into the local clock. Lock free, meant to be called per packet
+    std::chrono::steady_clock::time_point remoteToLocal(std::chrono::steady_clock::time_point remoteTimePoint)const;
+    // offset, drift in ppm, lowest round trip time and n of answered pings
+    std::string getEstimateReadable()const;
+private:
+    struct Sample{
+        // local time in the middle of the ping
+        std::chrono::steady_clock::time_point localTime;
+        std::chrono::nanoseconds offset;
+        std::chrono::nanoseconds roundTripTime;
+    };
+    // Result of a fit: offset=referenceOffset+drift*(t-referenceTime)
+    struct Estimate{
+        bool valid=false;
+        std::chrono::steady_clock::time_point referenceTime{};
+        double referenceOffsetNs=0;
+        double drift=0;
+        std::chrono::nanoseconds getOffset(std::chrono::steady_clock::time_point localTimePoint)const;
+    };
+    void loop();
+    void addSample(const Sample& sample);
+    // Only called by the ping thread (single writer)
+    void publishEstimate(const Estimate& estimate);
+    // Consistent snapshot of the last published estimate without taking the mutex
+    Estimate readEstimate()const;
+    const std::string mServerIp;
+    const int mPort;
+    const std::chrono::milliseconds mInterval;
+    const std::chrono::nanoseconds mArtificialClockOffset;
+    int mSocket=-1;
+    std::atomic<bool> running=false;
+    std::unique_ptr<std::thread> mThread;
+    // The last estimate as a seqlock: odd while the ping thread writes it, readers retry if it changed meanwhile
+    std::atomic<uint32_t> estimateVersion{0};
+    std::atomic<bool> estimateValid{false};
+    std::atomic<int64_t> estimateReferenceTimeNs{0};
+    std::atomic<double> estimateReferenceOffsetNs{0};
+    std::atomic<double> estimateDrift{0};
+    // guards everything below, only used by the ping thread and for the readable stats
+    mutable std::mutex mMutex;
+    std::deque<Sample> samples;
+    std::chrono::nanoseconds minRoundTripTime{0};
+    std::size_t nAnsweredPings=0;
+    static constexpr std::size_t MAX_SAMPLES=128;
+    static constexpr std::size_t MIN_SAMPLES_FOR_ESTIMATE=4;
+};
+
+#endif //OPENHDTESTING_CLOCKSYNC_H
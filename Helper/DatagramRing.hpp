@@ -0,0 +1,177 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_DATAGRAMRING_HPP
+#define OPENHDTESTING_DATAGRAMRING_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <sstream>
+#include <string>
+#include <algorithm>
+
+// Lock-free single producer / single consumer ring of preallocated datagram slots. Decouples the receive thread
+// (producer, push()) from a slow consumer (pop()), such that the consumer never stalls recvfrom().
+// head and tail only grow, entry i lives in slot i%nSlots. There is one slot more than the capacity: the consumer
+// processes a popped datagram in place, and that slot must not be overwritten while it does so.
+class DatagramRing{
+public:
+    // What push() does when the ring is full
+    enum class Policy{DROP_NEWEST,DROP_OLDEST,BLOCK};
+    static std::string policyName(const Policy policy){
+        switch(policy){
+            case Policy::DROP_NEWEST:return "drop newest";
+            case Policy::DROP_OLDEST:return "drop oldest";
+            case Policy::BLOCK:return "block";
+        }
+        return "";
+    }
+    DatagramRing(const size_t capacity,const size_t maxDatagramSize,const Policy policy):
+    capacity(capacity),maxDatagramSize(maxDatagramSize),nSlots(capacity+1),policy(policy),
+    slots(nSlots),arena(nSlots*maxDatagramSize){}
+    /**
+     * Producer only. Copies @param data into the next slot (truncated to maxDatagramSize).
+     * @return false if the datagram was dropped (ring full with DROP_NEWEST, or stop() while blocking)
+     */
+    bool push(const uint8_t* data,size_t size,const std::chrono::steady_clock::time_point timestamp={}){
+        const uint64_t t=tail.load(std::memory_order_relaxed);
+        while(true){
+            const uint64_t h=head.load();
+            if(t-h<capacity){
+                break;
+            }
+            if(policy==Policy::DROP_NEWEST){
+                nDroppedNewest.fetch_add(1,std::memory_order_relaxed);
+                return false;
+            }else if(policy==Policy::DROP_OLDEST){
+                // Fails if the consumer took this one in the meantime, then there is room anyways
+                uint64_t expected=h;
+                if(head.compare_exchange_strong(expected,h+1)){
+                    nDroppedOldest.fetch_add(1,std::memory_order_relaxed);
+                }
+            }else{
+                if(stopped.load(std::memory_order_relaxed)){
+                    return false;
+                }
+                // Rare, only when the consumer cannot keep up. The kernel socket buffer takes over in the meantime
+                std::this_thread::yield();
+            }
+        }
+        // After dropping the oldest ones, the consumer might still process the datagram in the slot we would write
+        const uint64_t busy=processing.load();
+        if(busy!=NONE && busy%nSlots==t%nSlots){
+            nDroppedNewest.fetch_add(1,std::memory_order_relaxed);
+            return false;
+        }
+        size=std::min(size,maxDatagramSize);
+        Slot& slot=slots[t%nSlots];
+        slot.size=size;
+        slot.timestamp=timestamp;
+        memcpy(&arena[(t%nSlots)*maxDatagramSize],data,size);
+        // seq_cst (not only release), such that either the consumer sees the new tail or we see consumerWaiting
+        tail.store(t+1);
+        const uint64_t depth=t+1-head.load(std::memory_order_relaxed);
+        if(depth>maxDepth.load(std::memory_order_relaxed)){
+            maxDepth.store(depth,std::memory_order_relaxed);
+        }
+        // Only take the lock if the consumer is (about to go) asleep
+        if(consumerWaiting.load()){
+            std::lock_guard<std::mutex> lock(mMutex);
+            mCondition.notify_one();
+        }
+        return true;
+    }
+    /**
+     * Consumer only. Calls @param f(data,size,timestamp) with the oldest datagram, the data stays valid until f returns.
+     * @return false if the ring was empty
+     */
+    template<class F>
+    bool pop(F&& f){
+        while(true){
+            uint64_t h=head.load();
+            if(h==tail.load(std::memory_order_acquire)){
+                return false;
+            }
+            // Announce the slot before taking it, such that a producer that drops the oldest ones never writes into it
+            processing.store(h);
+            if(head.compare_exchange_strong(h,h+1)){
+                const Slot& slot=slots[h%nSlots];
+                f((const uint8_t*)&arena[(h%nSlots)*maxDatagramSize],slot.size,slot.timestamp);
+                processing.store(NONE);
+                nPopped.fetch_add(1,std::memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+    // Consumer only. Blocks until there is data, stop() was called or @param timeout elapsed
+    void waitForData(const std::chrono::milliseconds timeout){
+        std::unique_lock<std::mutex> lock(mMutex);
+        consumerWaiting.store(true);
+        // Re-check after announcing, a push() in between would not have notified
+        mCondition.wait_for(lock,timeout,[this]{
+            return stopped.load() || head.load()!=tail.load();
+        });
+        consumerWaiting.store(false);
+    }
+    // Wakes up a blocked producer and consumer
+    void stop(){
+        std::lock_guard<std::mutex> lock(mMutex);
+        stopped.store(true);
+        mCondition.notify_all();
+    }
+    bool isStopped()const{
+        return stopped.load();
+    }
+    size_t getDepth()const{
+        return (size_t)(tail.load()-head.load());
+    }
+    struct Stats{
+        uint64_t nPopped;
+        uint64_t nDroppedNewest;
+        uint64_t nDroppedOldest;
+        uint64_t maxDepth;
+    };
+    Stats getStats()const{
+        return {nPopped.load(),nDroppedNewest.load(),nDroppedOldest.load(),maxDepth.load()};
+    }
+    std::string getStatsReadable()const{
+        const auto stats=getStats();
+        std::stringstream ss;
+        ss<<"policy "<<policyName(policy)<<" capacity "<<capacity<<" depth "<<getDepth()<<" max depth "<<stats.maxDepth
+        <<" delivered "<<stats.nPopped<<" dropped (newest | oldest) ["<<stats.nDroppedNewest<<" | "<<stats.nDroppedOldest<<"]";
+        return ss.str();
+    }
+private:
+    static constexpr uint64_t NONE=UINT64_MAX;
+    struct Slot{
+        size_t size=0;
+        std::chrono::steady_clock::time_point timestamp{};
+    };
+    const size_t capacity;
+    const size_t maxDatagramSize;
+    const size_t nSlots;
+    const Policy policy;
+    std::vector<Slot> slots;
+    std::vector<uint8_t> arena;
+    // producer and consumer indices on their own cache lines
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+    alignas(64) std::atomic<uint64_t> processing{NONE};
+    std::atomic<uint64_t> nPopped{0};
+    std::atomic<uint64_t> nDroppedNewest{0};
+    std::atomic<uint64_t> nDroppedOldest{0};
+    std::atomic<uint64_t> maxDepth{0};
+    std::atomic<bool> consumerWaiting{false};
+    std::atomic<bool> stopped{false};
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+};
+
+#endif //OPENHDTESTING_DATAGRAMRING_HPP
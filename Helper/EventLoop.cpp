@@ -0,0 +1,184 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#include "EventLoop.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cstring>
+#include <sstream>
+#include <array>
+#include <cassert>
+
+EventLoop::EventLoop(std::string name,LinuxThreadHelper::Config threadConfig):mName(std::move(name)),mThreadConfig(std::move(threadConfig)){
+    mEpollFd=epoll_create1(EPOLL_CLOEXEC);
+    mWakeupFd=eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+    if(mEpollFd==-1 || mWakeupFd==-1){
+        MLOGE<<"Cannot create epoll / eventfd "<<strerror(errno);
+        return;
+    }
+    epoll_event event{};
+    event.events=EPOLLIN;
+    event.data.fd=mWakeupFd;
+    epoll_ctl(mEpollFd,EPOLL_CTL_ADD,mWakeupFd,&event);
+}
+
+EventLoop::~EventLoop() {
+    stop();
+    for(const auto& handler:handlers){
+        if(handler.second->timer){
+            close(handler.first);
+        }
+    }
+    close(mWakeupFd);
+    close(mEpollFd);
+}
+
+void EventLoop::add(const std::shared_ptr<Handler>& handler) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    handlers[handler->fd]=handler;
+    epoll_event event{};
+    event.events=EPOLLIN;
+    event.data.fd=handler->fd;
+    if(epoll_ctl(mEpollFd,EPOLL_CTL_ADD,handler->fd,&event)!=0){
+        MLOGE<<mName<<" cannot add fd "<<handler->fd<<" "<<strerror(errno);
+        handlers.erase(handler->fd);
+    }
+}
+
+void EventLoop::addReadable(int fd,READABLE_CALLBACK callback) {
+    add(std::make_shared<Handler>(Handler{fd,false,std::move(callback),nullptr}));
+}
+
+int EventLoop::addTimer(std::chrono::nanoseconds interval,TIMER_CALLBACK callback,std::chrono::steady_clock::time_point firstExpiration) {
+    const int timerFd=timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK | TFD_CLOEXEC);
+    if(timerFd==-1){
+        MLOGE<<mName<<" cannot create timerfd "<<strerror(errno);
+        return -1;
+    }
+    const auto first=std::chrono::duration_cast<std::chrono::nanoseconds>(firstExpiration.time_since_epoch()).count();
+    itimerspec spec{};
+    spec.it_value.tv_sec=first/1000000000;
+    spec.it_value.tv_nsec=first%1000000000;
+    spec.it_interval.tv_sec=interval.count()/1000000000;
+    spec.it_interval.tv_nsec=interval.count()%1000000000;
+    // An it_value of 0 would disarm the timer
+    if(first==0){
+        spec.it_value.tv_nsec=1;
+    }
+    if(timerfd_settime(timerFd,TFD_TIMER_ABSTIME,&spec,nullptr)!=0){
+        MLOGE<<mName<<" cannot arm timerfd "<<strerror(errno);
+        close(timerFd);
+        return -1;
+    }
+    add(std::make_shared<Handler>(Handler{timerFd,true,nullptr,std::move(callback)}));
+    return timerFd;
+}
+
+void EventLoop::remove(const int fd) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    const auto it=handlers.find(fd);
+    if(it==handlers.end()){
+        return;
+    }
+    const bool timer=it->second->timer;
+    epoll_ctl(mEpollFd,EPOLL_CTL_DEL,fd,nullptr);
+    handlers.erase(it);
+    // From inside a callback the loop is not dispatching anything else, no need (and no way) to wait
+    if(std::this_thread::get_id()!=mThreadId){
+        mDispatchDone.wait(lock,[this,fd]{return mDispatchingFd!=fd;});
+    }
+    if(timer){
+        close(fd);
+    }
+}
+
+void EventLoop::start() {
+    running=true;
+    mThread=std::make_unique<std::thread>([this]{loop();});
+}
+
+void EventLoop::stop() {
+    if(mThread==nullptr)return;
+    running=false;
+    const uint64_t one=1;
+    write(mWakeupFd,&one,sizeof(one));
+    mThread->join();
+    mThread.reset();
+    std::lock_guard<std::mutex> lock(mMutex);
+    mThreadId={};
+}
+
+std::thread::native_handle_type EventLoop::getThreadHandle() const {
+    assert(mThread!=nullptr);
+    return mThread->native_handle();
+}
+
+std::string EventLoop::getName() const {
+    return mName;
+}
+
+std::string EventLoop::getStatsReadable() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::stringstream ss;
+    ss<<mName<<" fds "<<handlers.size()<<" wakeups "<<avgEventsPerWakeup.getNSamples()<<" callbacks per wakeup "<<avgEventsPerWakeup.getAvgReadable();
+    return ss.str();
+}
+
+void EventLoop::dispatch(const int fd) {
+    std::shared_ptr<Handler> handler;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const auto it=handlers.find(fd);
+        // Removed after epoll_wait() returned
+        if(it==handlers.end()){
+            return;
+        }
+        handler=it->second;
+        mDispatchingFd=fd;
+    }
+    if(handler->timer){
+        uint64_t nExpirations=0;
+        if(read(fd,&nExpirations,sizeof(nExpirations))==sizeof(nExpirations) && nExpirations>0){
+            handler->onTimer(nExpirations);
+        }
+    }else{
+        handler->onReadable();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mDispatchingFd=-1;
+    }
+    mDispatchDone.notify_all();
+}
+
+void EventLoop::loop() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mThreadId=std::this_thread::get_id();
+    }
+    const auto readable=LinuxThreadHelper::apply(mThreadConfig);
+    MLOGD<<mName<<" runs with "<<readable;
+    std::array<epoll_event,64> events{};
+    while(running){
+        const int nEvents=epoll_wait(mEpollFd,events.data(),events.size(),-1);
+        if(nEvents<=0){
+            continue;
+        }
+        int nCallbacks=0;
+        for(int i=0;i<nEvents;i++){
+            const int fd=events[i].data.fd;
+            if(fd==mWakeupFd){
+                uint64_t value;
+                read(mWakeupFd,&value,sizeof(value));
+                continue;
+            }
+            dispatch(fd);
+            nCallbacks++;
+        }
+        std::lock_guard<std::mutex> lock(mMutex);
+        avgEventsPerWakeup.add(nCallbacks);
+    }
+}
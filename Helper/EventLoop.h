@@ -0,0 +1,77 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_EVENTLOOP_H
+#define OPENHDTESTING_EVENTLOOP_H
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <string>
+#include <chrono>
+#include "LinuxThreadHelper.h"
+#include "TimeHelper.hpp"
+
+/**
+ * One thread that waits on epoll for any number of sockets (and other fds) and timerfd timers and calls their callbacks.
+ * Instead of one thread (and one context switch per packet) per UDPReceiver, all receivers and paced senders of e.g.
+ * the ground station (video, telemetry, RC, OSD ports) share one thread. Use a few EventLoops for a few cores.
+ * Callbacks run on the loop thread, one at a time, and must not block.
+ */
+class EventLoop{
+public:
+    // Called while @param fd is readable (level triggered), read until EAGAIN or a bit and return to be fair to others
+    typedef std::function<void()> READABLE_CALLBACK;
+    // @param nExpirations is >1 if the loop was too late for one or more intervals (e.g. send that many packets)
+    typedef std::function<void(uint64_t nExpirations)> TIMER_CALLBACK;
+    explicit EventLoop(std::string name,LinuxThreadHelper::Config threadConfig={});
+    ~EventLoop();
+    // All add / remove methods can be called from any thread, also before start() and from inside a callback
+    void addReadable(int fd,READABLE_CALLBACK callback);
+    /**
+     * Periodic timer (timerfd, CLOCK_MONOTONIC = steady_clock) with absolute expirations firstExpiration + n*interval
+     * @return the timerfd, use it for remove()
+     */
+    int addTimer(std::chrono::nanoseconds interval,TIMER_CALLBACK callback,
+                 std::chrono::steady_clock::time_point firstExpiration=std::chrono::steady_clock::now());
+    // Once this returns, the callback of @param fd is not running and will not be called again. Timer fds are closed
+    void remove(int fd);
+    void start();
+    void stop();
+    std::thread::native_handle_type getThreadHandle()const;
+    std::string getName()const;
+    // Wakeups of epoll_wait() and callbacks called per wakeup
+    std::string getStatsReadable()const;
+private:
+    struct Handler{
+        int fd;
+        bool timer;
+        READABLE_CALLBACK onReadable;
+        TIMER_CALLBACK onTimer;
+    };
+    void add(const std::shared_ptr<Handler>& handler);
+    void loop();
+    void dispatch(int fd);
+    const std::string mName;
+    const LinuxThreadHelper::Config mThreadConfig;
+    int mEpollFd=-1;
+    // written by stop() to wake up epoll_wait()
+    int mWakeupFd=-1;
+    mutable std::mutex mMutex;
+    std::condition_variable mDispatchDone;
+    std::unordered_map<int,std::shared_ptr<Handler>> handlers;
+    // fd whose callback is running right now, -1 if none
+    int mDispatchingFd=-1;
+    std::atomic<bool> running=false;
+    std::unique_ptr<std::thread> mThread;
+    // Set by the loop thread itself, remove() from inside a callback must not wait for its own callback
+    std::thread::id mThreadId;
+    BaseAvgCalculator<float> avgEventsPerWakeup;
+};
+
+#endif //OPENHDTESTING_EVENTLOOP_H
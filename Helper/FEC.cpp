@@ -0,0 +1,357 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#include "FEC.h"
+#include "GF256.hpp"
+#include <cstring>
+#include <cassert>
+
+// Each fragment payload starts with the size of the packet, such that the decoder knows the size of recovered packets
+static constexpr size_t SIZE_PREFIX=sizeof(uint16_t);
+
+uint8_t FEC::coefficient(const int row,const int column,const int k) {
+    // Cauchy matrix 1/(x_row + y_column) with x_row=k+row and y_column=column, all x and y are distinct
+    return GF256::inv((uint8_t)((k+row) ^ column));
+}
+
+// Invert the k x k @param matrix in place (Gauss-Jordan), returns false if it is singular
+static bool invertMatrix(std::vector<uint8_t>& matrix,const int k){
+    std::vector<uint8_t> inverse(k*k,0);
+    for(int i=0;i<k;i++){
+        inverse[i*k+i]=1;
+    }
+    for(int column=0;column<k;column++){
+        int pivot=column;
+        while(pivot<k && matrix[pivot*k+column]==0){
+            pivot++;
+        }
+        if(pivot==k){
+            return false;
+        }
+        if(pivot!=column){
+            for(int j=0;j<k;j++){
+                std::swap(matrix[pivot*k+j],matrix[column*k+j]);
+                std::swap(inverse[pivot*k+j],inverse[column*k+j]);
+            }
+        }
+        const uint8_t scale=GF256::inv(matrix[column*k+column]);
+        for(int j=0;j<k;j++){
+            matrix[column*k+j]=GF256::mul(matrix[column*k+j],scale);
+            inverse[column*k+j]=GF256::mul(inverse[column*k+j],scale);
+        }
+        for(int row=0;row<k;row++){
+            const uint8_t factor=matrix[row*k+column];
+            if(row==column || factor==0)continue;
+            for(int j=0;j<k;j++){
+                matrix[row*k+j]^=GF256::mul(factor,matrix[column*k+j]);
+                inverse[row*k+j]^=GF256::mul(factor,inverse[column*k+j]);
+            }
+        }
+    }
+    matrix=inverse;
+    return true;
+}
+
+FECEncoder::FECEncoder(int k,int n,size_t maxPacketSize,OUTPUT_CALLBACK outputCallback,std::chrono::milliseconds blockTimeout):
+k(k),n(n),maxPacketSize(maxPacketSize),outputCallback(std::move(outputCallback)),blockTimeout(blockTimeout),
+fragmentSize(sizeof(FECFragmentHeader)+SIZE_PREFIX+maxPacketSize){
+    assert(k>0 && k<=n && n<=FEC::MAX_FRAGMENTS);
+    fragments.resize(n*fragmentSize);
+    fragmentLengths.resize(n);
+    if(blockTimeout.count()>0){
+        mTimeoutThread=std::make_unique<std::thread>([this]{timeoutLoop();});
+    }
+}
+
+FECEncoder::~FECEncoder() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        running=false;
+    }
+    mCondition.notify_one();
+    if(mTimeoutThread){
+        mTimeoutThread->join();
+    }
+}
+
+uint8_t* FECEncoder::fragment(const int fragmentIdx) {
+    return &fragments[fragmentIdx*fragmentSize];
+}
+
+void FECEncoder::encodePacket(const uint8_t* data,const size_t size) {
+    if(size>maxPacketSize){
+        MLOGE<<"Packet too big for FEC "<<size;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    uint8_t* f=fragment(nFragmentsInBlock);
+    const FECFragmentHeader header{currentBlockIdx,(uint8_t)nFragmentsInBlock,(uint8_t)k,(uint8_t)n,0};
+    memcpy(f,&header,sizeof(header));
+    const uint16_t size16=size;
+    memcpy(f+sizeof(header),&size16,SIZE_PREFIX);
+    memcpy(f+sizeof(header)+SIZE_PREFIX,data,size);
+    fragmentLengths[nFragmentsInBlock]=sizeof(header)+SIZE_PREFIX+size;
+    if(nFragmentsInBlock==0){
+        blockBegin=std::chrono::steady_clock::now();
+        mCondition.notify_one();
+    }
+    outputCallback(f,fragmentLengths[nFragmentsInBlock]);
+    nFragmentsInBlock++;
+    if(nFragmentsInBlock==k){
+        closeBlock();
+    }
+}
+
+void FECEncoder::finishBlock() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(nFragmentsInBlock>0){
+        closeBlock();
+    }
+}
+
+void FECEncoder::closeBlock() {
+    // Fill up the block with empty packets, the decoder does not forward them
+    const auto nDataFragments=(uint8_t)nFragmentsInBlock;
+    for(;nFragmentsInBlock<k;nFragmentsInBlock++){
+        uint8_t* f=fragment(nFragmentsInBlock);
+        const FECFragmentHeader header{currentBlockIdx,(uint8_t)nFragmentsInBlock,(uint8_t)k,(uint8_t)n,nDataFragments};
+        memcpy(f,&header,sizeof(header));
+        memset(f+sizeof(header),0,SIZE_PREFIX);
+        fragmentLengths[nFragmentsInBlock]=sizeof(header)+SIZE_PREFIX;
+        outputCallback(f,fragmentLengths[nFragmentsInBlock]);
+    }
+    const auto begin=std::chrono::steady_clock::now();
+    size_t parityLength=0;
+    for(int j=0;j<k;j++){
+        parityLength=std::max(parityLength,fragmentLengths[j]-sizeof(FECFragmentHeader));
+    }
+    for(int i=0;i<n-k;i++){
+        uint8_t* parity=fragment(k+i);
+        const FECFragmentHeader header{currentBlockIdx,(uint8_t)(k+i),(uint8_t)k,(uint8_t)n,nDataFragments};
+        memcpy(parity,&header,sizeof(header));
+        uint8_t* parityPayload=parity+sizeof(header);
+        memset(parityPayload,0,parityLength);
+        // Shorter data fragments are zero padded, which does not change the parity
+        for(int j=0;j<k;j++){
+            GF256::mulAdd(parityPayload,fragment(j)+sizeof(header),FEC::coefficient(i,j,k),fragmentLengths[j]-sizeof(header));
+        }
+    }
+    encodeTime.add(std::chrono::steady_clock::now()-begin);
+    for(int i=0;i<n-k;i++){
+        outputCallback(fragment(k+i),sizeof(FECFragmentHeader)+parityLength);
+    }
+    nBlocks++;
+    currentBlockIdx++;
+    nFragmentsInBlock=0;
+}
+
+void FECEncoder::timeoutLoop() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(running){
+        if(nFragmentsInBlock==0){
+            mCondition.wait(lock);
+            continue;
+        }
+        const auto deadline=blockBegin+blockTimeout;
+        if(std::chrono::steady_clock::now()>=deadline){
+            nTimeouts++;
+            closeBlock();
+        }else{
+            mCondition.wait_until(lock,deadline);
+        }
+    }
+}
+
+uint64_t FECEncoder::getNBlocks() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return nBlocks;
+}
+
+uint64_t FECEncoder::getNTimeouts() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return nTimeouts;
+}
+
+AvgCalculator FECEncoder::getEncodeTime() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return encodeTime;
+}
+
+FECDecoder::FECDecoder(int k,int n,size_t maxPacketSize,OUTPUT_CALLBACK outputCallback):
+k(k),n(n),maxPacketSize(maxPacketSize),outputCallback(std::move(outputCallback)),payloadSize(SIZE_PREFIX+maxPacketSize),
+blocks(RX_RING_SIZE){
+    assert(k>0 && k<=n && n<=FEC::MAX_FRAGMENTS);
+    // All buffers are allocated once
+    for(auto& block:blocks){
+        block.received.resize(n);
+        block.lengths.resize(n);
+        block.arrival.resize(n);
+        block.payloads.resize(n*payloadSize);
+    }
+}
+
+uint8_t* FECDecoder::payload(Block& block,const int fragmentIdx) {
+    return &block.payloads[fragmentIdx*payloadSize];
+}
+
+void FECDecoder::processFragment(const uint8_t* data,const size_t size) {
+    stats.nFragments++;
+    FECFragmentHeader header{};
+    if(size<sizeof(header)+SIZE_PREFIX || size-sizeof(header)>payloadSize){
+        stats.nInvalidFragments++;
+        return;
+    }
+    memcpy(&header,data,sizeof(header));
+    if(header.k!=k || header.n!=n || header.fragmentIdx>=n){
+        stats.nInvalidFragments++;
+        return;
+    }
+    const auto now=std::chrono::steady_clock::now();
+    Block& block=blocks[header.blockIdx%RX_RING_SIZE];
+    if(block.used && block.blockIdx!=header.blockIdx){
+        if((int32_t)(header.blockIdx-block.blockIdx)<0){
+            // The block was given up already
+            return;
+        }
+        giveUp(block);
+    }
+    if(!block.used){
+        block.used=true;
+        block.blockIdx=header.blockIdx;
+        block.nReceived=0;
+        block.nextToForward=0;
+        block.nDataFragments=0;
+        block.parityLength=0;
+        block.firstArrival=now;
+        std::fill(block.received.begin(),block.received.end(),false);
+    }
+    if(header.nDataFragments>0){
+        block.nDataFragments=header.nDataFragments;
+    }
+    const int idx=header.fragmentIdx;
+    if(block.received[idx] || block.nextToForward>=k){
+        // duplicate or the block is complete already
+        return;
+    }
+    const size_t payloadLength=size-sizeof(header);
+    memcpy(payload(block,idx),data+sizeof(header),payloadLength);
+    block.received[idx]=true;
+    block.lengths[idx]=payloadLength;
+    block.arrival[idx]=now;
+    block.nReceived++;
+    if(idx>=k){
+        block.parityLength=payloadLength;
+    }
+    forwardAvailable(block);
+    if(block.nextToForward<k && block.nReceived>=k){
+        recover(block);
+        forwardAvailable(block);
+    }
+}
+
+void FECDecoder::forward(Block& block,const int fragmentIdx,const std::chrono::steady_clock::time_point since) {
+    const uint8_t* p=payload(block,fragmentIdx);
+    uint16_t size;
+    memcpy(&size,p,SIZE_PREFIX);
+    // empty fragments only fill up blocks
+    if(size==0){
+        stats.nPadding++;
+        return;
+    }
+    if(size>maxPacketSize)return;
+    holdTime.add(std::chrono::steady_clock::now()-since);
+    outputCallback(p+SIZE_PREFIX,size);
+}
+
+void FECDecoder::forwardAvailable(Block& block) {
+    while(block.nextToForward<k && block.received[block.nextToForward]){
+        forward(block,block.nextToForward,block.arrival[block.nextToForward]);
+        block.nextToForward++;
+    }
+}
+
+void FECDecoder::recover(Block& block) {
+    const auto begin=std::chrono::steady_clock::now();
+    // k of the received fragments, data first
+    std::vector<int> used;
+    for(int i=0;i<n && (int)used.size()<k;i++){
+        if(block.received[i]){
+            used.push_back(i);
+        }
+    }
+    // Row r of the matrix is the encoding of fragment used[r]
+    std::vector<uint8_t> matrix(k*k,0);
+    for(int r=0;r<k;r++){
+        if(used[r]<k){
+            matrix[r*k+used[r]]=1;
+        }else{
+            for(int j=0;j<k;j++){
+                matrix[r*k+j]=FEC::coefficient(used[r]-k,j,k);
+            }
+        }
+    }
+    if(!invertMatrix(matrix,k)){
+        MLOGE<<"FEC matrix not invertible";
+        return;
+    }
+    for(const int idx:used){
+        // Data fragments are shorter than the parity, the encoder padded them with zeroes
+        if(idx<k && block.lengths[idx]<block.parityLength){
+            memset(payload(block,idx)+block.lengths[idx],0,block.parityLength-block.lengths[idx]);
+        }
+    }
+    for(int j=0;j<k;j++){
+        if(block.received[j])continue;
+        uint8_t* out=payload(block,j);
+        memset(out,0,block.parityLength);
+        for(int r=0;r<k;r++){
+            GF256::mulAdd(out,payload(block,used[r]),matrix[j*k+r],block.parityLength);
+        }
+        block.received[j]=true;
+        block.lengths[j]=block.parityLength;
+        // For the hold time a recovered packet waited since the block started
+        block.arrival[j]=block.firstArrival;
+        // Recovered padding is counted when it is forwarded
+        uint16_t size;
+        memcpy(&size,out,SIZE_PREFIX);
+        if(size!=0){
+            stats.nRecovered++;
+        }
+    }
+    decodeTime.add(std::chrono::steady_clock::now()-begin);
+}
+
+void FECDecoder::giveUp(Block& block) {
+    // Missing empty fragments are only known as such if a padding or parity fragment of the block arrived, else lost
+    for(;block.nextToForward<k;block.nextToForward++){
+        if(block.received[block.nextToForward]){
+            forward(block,block.nextToForward,block.arrival[block.nextToForward]);
+        }else if(block.nDataFragments>0 && block.nextToForward>=block.nDataFragments){
+            stats.nPadding++;
+        }else{
+            stats.nLost++;
+        }
+    }
+    block.used=false;
+}
+
+void FECDecoder::flush() {
+    for(auto& block:blocks){
+        if(block.used){
+            giveUp(block);
+        }
+    }
+}
+
+FECDecoder::Stats FECDecoder::getStats() const {
+    return stats;
+}
+
+const AvgCalculator& FECDecoder::getDecodeTime() const {
+    return decodeTime;
+}
+
+const LatencyHistogram& FECDecoder::getHoldTime() const {
+    return holdTime;
+}
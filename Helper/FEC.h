@@ -0,0 +1,141 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_FEC_H
+#define OPENHDTESTING_FEC_H
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include "TimeHelper.hpp"
+
+// Systematic Reed-Solomon block FEC like wfb (-k data fragments, -n fragments in total per block).
+// The first k fragments of a block are the packets themselves, the n-k parity fragments are computed with a Cauchy
+// matrix over GF(2^8) such that any k of the n fragments are enough to recover all data fragments.
+
+// Prepended to each fragment
+struct FECFragmentHeader{
+    uint32_t blockIdx;
+    uint8_t fragmentIdx;
+    uint8_t k;
+    uint8_t n;
+    // n of data fragments that carry a packet, the rest of the k are empty padding (block closed early).
+    // Only known once the block is closed, 0 in the data fragments sent before
+    uint8_t nDataFragments;
+} __attribute__ ((packed));
+
+namespace FEC{
+    // Max n
+    static constexpr int MAX_FRAGMENTS=128;
+    // Element (row,column) of the parity part of the encoding matrix, parity fragment row is the sum of
+    // coefficient(row,j)*data fragment j
+    uint8_t coefficient(int row,int column,int k);
+}
+
+class FECEncoder{
+public:
+    typedef std::function<void(const uint8_t[],size_t)> OUTPUT_CALLBACK;
+    /**
+     * @param maxPacketSize largest packet passed to encodePacket()
+     * @param blockTimeout 0 to wait for k packets, else a block is closed (filled with empty fragments) if the
+     * first packet of the block is older than blockTimeout, such that the parity does not wait forever for sparse traffic
+     */
+    FECEncoder(int k,int n,size_t maxPacketSize,OUTPUT_CALLBACK outputCallback,std::chrono::milliseconds blockTimeout=std::chrono::milliseconds(0));
+    ~FECEncoder();
+    // Sends the packet as data fragment right away, after k packets the parity fragments are sent, too.
+    // The output callback is always called with the lock held, one call at a time
+    void encodePacket(const uint8_t* data,size_t size);
+    // Close the current block (if any) with empty fragments
+    void finishBlock();
+    uint64_t getNBlocks()const;
+    uint64_t getNTimeouts()const;
+    // Time for calculating the parity of one block
+    AvgCalculator getEncodeTime()const;
+private:
+    void closeBlock();
+    void timeoutLoop();
+    uint8_t* fragment(int fragmentIdx);
+    const int k,n;
+    const size_t maxPacketSize;
+    const OUTPUT_CALLBACK outputCallback;
+    const std::chrono::milliseconds blockTimeout;
+    // header + 2 bytes size + packet, for all n fragments
+    const size_t fragmentSize;
+    std::vector<uint8_t> fragments;
+    std::vector<size_t> fragmentLengths;
+    uint32_t currentBlockIdx=0;
+    int nFragmentsInBlock=0;
+    std::chrono::steady_clock::time_point blockBegin{};
+    uint64_t nBlocks=0,nTimeouts=0;
+    AvgCalculator encodeTime;
+    mutable std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool running=true;
+    std::unique_ptr<std::thread> mTimeoutThread;
+};
+
+class FECDecoder{
+public:
+    typedef std::function<void(const uint8_t[],size_t)> OUTPUT_CALLBACK;
+    FECDecoder(int k,int n,size_t maxPacketSize,OUTPUT_CALLBACK outputCallback);
+    // Data fragments are forwarded as soon as all previous data fragments of their block were forwarded,
+    // missing ones are recovered once k fragments of the block arrived. Only call from one thread
+    void processFragment(const uint8_t* data,size_t size);
+    // Forward what is left of all blocks, missing packets are lost
+    void flush();
+    struct Stats{
+        uint64_t nFragments;
+        uint64_t nInvalidFragments;
+        // data packets recovered from parity
+        uint64_t nRecovered;
+        // data packets that were neither received nor recovered
+        uint64_t nLost;
+        // empty fragments that only fill up a block closed early, neither counted as recovered nor as lost
+        uint64_t nPadding;
+    };
+    Stats getStats()const;
+    // CPU time for recovering the missing packets of one block
+    const AvgCalculator& getDecodeTime()const;
+    // How long data packets waited in the decoder, for received packets after a gap since arrival,
+    // for recovered packets since the first fragment of the block arrived
+    const LatencyHistogram& getHoldTime()const;
+    // Blocks that can be in progress at the same time
+    static constexpr int RX_RING_SIZE=8;
+private:
+    struct Block{
+        bool used=false;
+        uint32_t blockIdx=0;
+        int nReceived=0;
+        int nextToForward=0;
+        // from the header of the padding / parity fragments, 0 = not known yet
+        int nDataFragments=0;
+        // length of the parity fragments (data fragments are shorter or equal)
+        size_t parityLength=0;
+        std::chrono::steady_clock::time_point firstArrival{};
+        std::vector<bool> received;
+        std::vector<size_t> lengths;
+        std::vector<std::chrono::steady_clock::time_point> arrival;
+        // payload of each fragment (2 bytes size + packet), without header
+        std::vector<uint8_t> payloads;
+    };
+    uint8_t* payload(Block& block,int fragmentIdx);
+    void forwardAvailable(Block& block);
+    void recover(Block& block);
+    void giveUp(Block& block);
+    void forward(Block& block,int fragmentIdx,std::chrono::steady_clock::time_point since);
+    const int k,n;
+    const size_t maxPacketSize;
+    const OUTPUT_CALLBACK outputCallback;
+    const size_t payloadSize;
+    std::vector<Block> blocks;
+    Stats stats{};
+    AvgCalculator decodeTime;
+    LatencyHistogram holdTime;
+};
+
+#endif //OPENHDTESTING_FEC_H
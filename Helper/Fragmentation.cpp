@@ -0,0 +1,165 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#include "Fragmentation.h"
+#include <cstring>
+#include <cassert>
+
+FragmentingSender::FragmentingSender(UDPSender& udpSender,size_t maxDatagramSize):
+udpSender(udpSender),fragmentPayloadSize(std::min(maxDatagramSize-sizeof(FragmentHeader),(size_t)UINT16_MAX)){
+    assert(maxDatagramSize>sizeof(FragmentHeader));
+}
+
+void FragmentingSender::send(const uint8_t* data,const size_t size) {
+    const size_t nFragments=std::max((size_t)1,(size+fragmentPayloadSize-1)/fragmentPayloadSize);
+    if(nFragments>UINT16_MAX){
+        MLOGE<<"Payload too big for fragmentation "<<size;
+        return;
+    }
+    // Only grows, no allocations once the largest payload was sent
+    if(headers.size()<nFragments){
+        headers.resize(nFragments);
+        iovs.resize(nFragments*2);
+    }
+    for(size_t i=0;i<nFragments;i++){
+        const size_t offset=i*fragmentPayloadSize;
+        headers[i]={frameIdx,(uint32_t)size,(uint16_t)i,(uint16_t)nFragments,(uint16_t)fragmentPayloadSize,0};
+        iovs[i*2]={&headers[i],sizeof(FragmentHeader)};
+        iovs[i*2+1]={(void*)(data+offset),std::min(fragmentPayloadSize,size-offset)};
+    }
+    udpSender.mySendToBatchGather(iovs.data(),2,nFragments);
+    frameIdx++;
+}
+
+uint32_t FragmentingSender::getNSentFrames() const {
+    return frameIdx;
+}
+
+ReassemblingReceiver::ReassemblingReceiver(size_t maxFrameSize,FRAME_CALLBACK onFrame,std::chrono::milliseconds timeout,size_t nSlots):
+maxFrameSize(maxFrameSize),onFrame(std::move(onFrame)),timeout(timeout),arena(nSlots*maxFrameSize),slots(nSlots),
+finishedFrames(2*nSlots){
+    // Enough for the smallest sensible fragments, allocated once
+    const size_t maxFragments=std::min(maxFrameSize,(size_t)UINT16_MAX);
+    for(size_t i=0;i<nSlots;i++){
+        slots[i].received.resize(maxFragments);
+        slots[i].data=&arena[i*maxFrameSize];
+    }
+}
+
+void ReassemblingReceiver::drop(Slot& slot) {
+    stats.nIncompleteFrames++;
+    slot.used=false;
+    markFinished(slot.frameIdx,false);
+}
+
+void ReassemblingReceiver::markFinished(const uint32_t frameIdx,const bool completed) {
+    finishedFrames[nextFinishedFrame]={true,completed,frameIdx};
+    nextFinishedFrame=(nextFinishedFrame+1)%finishedFrames.size();
+}
+
+const ReassemblingReceiver::FinishedFrame* ReassemblingReceiver::findFinished(const uint32_t frameIdx) const {
+    for(const auto& finished:finishedFrames){
+        if(finished.valid && finished.frameIdx==frameIdx){
+            return &finished;
+        }
+    }
+    return nullptr;
+}
+
+void ReassemblingReceiver::dropTimedOut(const std::chrono::steady_clock::time_point now) {
+    for(auto& slot:slots){
+        if(slot.used && now-slot.firstArrival>timeout){
+            drop(slot);
+        }
+    }
+}
+
+void ReassemblingReceiver::processDatagram(const uint8_t* data,const size_t size) {
+    const auto now=std::chrono::steady_clock::now();
+    dropTimedOut(now);
+    FragmentHeader header{};
+    if(size<sizeof(header)){
+        stats.nInvalidFragments++;
+        return;
+    }
+    memcpy(&header,data,sizeof(header));
+    const size_t offset=(size_t)header.fragmentIdx*header.fragmentPayloadSize;
+    const size_t payloadSize=size-sizeof(header);
+    // The fragments have to cover the frame without gaps: nFragments has to match the frame and fragment size and
+    // each fragment carries fragmentPayloadSize bytes, only the last one the rest of the frame
+    const size_t expectedNFragments=header.fragmentPayloadSize==0 ? 0 :
+        std::max((size_t)1,((size_t)header.frameSize+header.fragmentPayloadSize-1)/header.fragmentPayloadSize);
+    if(header.frameSize>maxFrameSize || header.fragmentPayloadSize==0 || header.nFragments!=expectedNFragments ||
+       header.fragmentIdx>=header.nFragments || header.nFragments>slots[0].received.size() ||
+       offset+payloadSize>header.frameSize || payloadSize!=std::min((size_t)header.fragmentPayloadSize,header.frameSize-offset)){
+        stats.nInvalidFragments++;
+        return;
+    }
+    // Straggler or retransmission of a frame that is done already, must not open a new slot
+    if(const FinishedFrame* finished=findFinished(header.frameIdx)){
+        if(finished->completed){
+            stats.nDuplicateFragments++;
+        }else{
+            stats.nLateFragments++;
+        }
+        return;
+    }
+    // A frame older than all frames that can still be in progress was dropped already (or completed)
+    if(anyFrame && (int32_t)(newestFrameIdx-header.frameIdx)>=(int32_t)slots.size()){
+        stats.nLateFragments++;
+        return;
+    }
+    if(!anyFrame || (int32_t)(header.frameIdx-newestFrameIdx)>0){
+        anyFrame=true;
+        newestFrameIdx=header.frameIdx;
+    }
+    Slot& slot=slots[header.frameIdx%slots.size()];
+    if(slot.used && slot.frameIdx!=header.frameIdx){
+        // Needed for a newer frame
+        drop(slot);
+    }
+    if(!slot.used){
+        slot.used=true;
+        slot.frameIdx=header.frameIdx;
+        slot.frameSize=header.frameSize;
+        slot.nFragments=header.nFragments;
+        slot.fragmentPayloadSize=header.fragmentPayloadSize;
+        slot.nReceived=0;
+        slot.firstArrival=now;
+        std::fill(slot.received.begin(),slot.received.begin()+header.nFragments,false);
+    }else if(slot.frameSize!=header.frameSize || slot.nFragments!=header.nFragments || slot.fragmentPayloadSize!=header.fragmentPayloadSize){
+        stats.nInvalidFragments++;
+        return;
+    }
+    if(slot.received[header.fragmentIdx]){
+        stats.nDuplicateFragments++;
+        return;
+    }
+    memcpy(slot.data+offset,data+sizeof(header),payloadSize);
+    slot.received[header.fragmentIdx]=true;
+    slot.nReceived++;
+    if(slot.nReceived==slot.nFragments){
+        slot.used=false;
+        markFinished(slot.frameIdx,true);
+        stats.nCompleteFrames++;
+        reassemblyLatency.add(std::chrono::steady_clock::now()-slot.firstArrival);
+        onFrame(slot.data,slot.frameSize);
+    }
+}
+
+void ReassemblingReceiver::flush() {
+    for(auto& slot:slots){
+        if(slot.used){
+            drop(slot);
+        }
+    }
+}
+
+ReassemblingReceiver::Stats ReassemblingReceiver::getStats() const {
+    return stats;
+}
+
+const LatencyHistogram& ReassemblingReceiver::getReassemblyLatency() const {
+    return reassemblyLatency;
+}
@@ -0,0 +1,107 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_FRAGMENTATION_H
+#define OPENHDTESTING_FRAGMENTATION_H
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <sys/uio.h>
+#include "UDPSender.h"
+#include "TimeHelper.hpp"
+
+// Prepended to each datagram of a fragmented payload (e.g. a NALU or a whole video frame)
+struct FragmentHeader{
+    uint32_t frameIdx;
+    uint32_t frameSize;
+    uint16_t fragmentIdx;
+    uint16_t nFragments;
+    // payload bytes per fragment (all but the last one), the fragment starts at fragmentIdx*fragmentPayloadSize
+    uint16_t fragmentPayloadSize;
+    uint16_t reserved;
+} __attribute__ ((packed));
+
+/**
+ * Splits payloads of any size into datagrams of at most @param maxDatagramSize (header included) and sends all of them
+ * with one mySendToBatchGather(). Each datagram is gathered from its header and a slice of the payload (no copy).
+ */
+class FragmentingSender{
+public:
+    FragmentingSender(UDPSender& udpSender,size_t maxDatagramSize);
+    void send(const uint8_t* data,size_t size);
+    uint32_t getNSentFrames()const;
+private:
+    UDPSender& udpSender;
+    const size_t fragmentPayloadSize;
+    uint32_t frameIdx=0;
+    // reused for all payloads
+    std::vector<FragmentHeader> headers;
+    std::vector<iovec> iovs;
+};
+
+/**
+ * Puts the fragments of FragmentingSender back together. Frames are reassembled in a preallocated arena of
+ * @param nSlots frames of up to @param maxFrameSize each. A frame that is not complete @param timeout after its first
+ * fragment arrived, or whose slot is needed for a newer frame, is dropped and counted as incomplete.
+ * The ids of the last 2*nSlots completed / dropped frames are remembered, such that a retransmitted fragment of a
+ * completed frame counts as duplicate and a straggler of a dropped frame as late, instead of opening a new slot.
+ */
+class ReassemblingReceiver{
+public:
+    typedef std::function<void(const uint8_t[],size_t)> FRAME_CALLBACK;
+    ReassemblingReceiver(size_t maxFrameSize,FRAME_CALLBACK onFrame,std::chrono::milliseconds timeout=std::chrono::milliseconds(100),size_t nSlots=8);
+    // Pass each datagram received by the UDPReceiver. Only call from one thread
+    void processDatagram(const uint8_t* data,size_t size);
+    // Drop all frames in progress (counted as incomplete), e.g. after the receiver was stopped
+    void flush();
+    struct Stats{
+        uint64_t nCompleteFrames;
+        uint64_t nIncompleteFrames;
+        uint64_t nInvalidFragments;
+        uint64_t nDuplicateFragments;
+        // fragments of frames that were dropped already (or are too old to still be in progress)
+        uint64_t nLateFragments;
+    };
+    Stats getStats()const;
+    // first fragment arrived -> frame complete
+    const LatencyHistogram& getReassemblyLatency()const;
+private:
+    struct Slot{
+        bool used=false;
+        uint32_t frameIdx=0;
+        uint32_t frameSize=0;
+        uint16_t nFragments=0;
+        uint16_t fragmentPayloadSize=0;
+        uint16_t nReceived=0;
+        std::chrono::steady_clock::time_point firstArrival{};
+        std::vector<bool> received;
+        uint8_t* data=nullptr;
+    };
+    struct FinishedFrame{
+        bool valid=false;
+        bool completed=false;
+        uint32_t frameIdx=0;
+    };
+    void dropTimedOut(std::chrono::steady_clock::time_point now);
+    void drop(Slot& slot);
+    void markFinished(uint32_t frameIdx,bool completed);
+    // nullptr if @param frameIdx is not one of the recently finished frames
+    const FinishedFrame* findFinished(uint32_t frameIdx)const;
+    const size_t maxFrameSize;
+    const FRAME_CALLBACK onFrame;
+    const std::chrono::milliseconds timeout;
+    std::vector<uint8_t> arena;
+    std::vector<Slot> slots;
+    // ring of the recently completed / dropped frames, overwritten oldest first
+    std::vector<FinishedFrame> finishedFrames;
+    size_t nextFinishedFrame=0;
+    Stats stats{};
+    LatencyHistogram reassemblyLatency;
+    // newest frame seen, older frames than the ones in the slots are stale
+    bool anyFrame=false;
+    uint32_t newestFrameIdx=0;
+};
+
+#endif //OPENHDTESTING_FRAGMENTATION_H
@@ -0,0 +1,179 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_GF256_HPP
+#define OPENHDTESTING_GF256_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Arithmetic in GF(2^8) (polynomial 0x11D, same as most Reed-Solomon implementations) for the FEC.
+// The hot operation is mulAdd (dst ^= c*src over a whole packet). The SIMD versions split each byte into two nibbles
+// and look up the products of both nibbles in two 16 byte tables with one shuffle instruction per 16 / 32 bytes
+// (PSHUFB on x86 with SSSE3 or AVX2, TBL on aarch64, VTBL per 8 bytes on armv7 with NEON). On x86 the instruction set
+// is picked at runtime.
+namespace GF256{
+    static constexpr unsigned POLYNOMIAL=0x11D;
+    struct Tables{
+        // exp is twice as long such that mul() does not need a modulo
+        std::array<uint8_t,512> exp;
+        std::array<uint8_t,256> log;
+        // full multiplication table for the software mulAdd, 64kB
+        std::array<std::array<uint8_t,256>,256> mul;
+    };
+    inline Tables createTables(){
+        Tables t{};
+        unsigned x=1;
+        for(int i=0;i<255;i++){
+            t.exp[i]=(uint8_t)x;
+            t.exp[i+255]=(uint8_t)x;
+            t.log[x]=(uint8_t)i;
+            x<<=1;
+            if(x & 0x100){
+                x^=POLYNOMIAL;
+            }
+        }
+        for(int a=1;a<256;a++){
+            for(int b=1;b<256;b++){
+                t.mul[a][b]=t.exp[t.log[a]+t.log[b]];
+            }
+        }
+        return t;
+    }
+    inline const Tables& tables(){
+        static const Tables t=createTables();
+        return t;
+    }
+    inline uint8_t mul(const uint8_t a,const uint8_t b){
+        return tables().mul[a][b];
+    }
+    // a must not be 0
+    inline uint8_t inv(const uint8_t a){
+        const auto& t=tables();
+        return t.exp[255-t.log[a]];
+    }
+    inline void mulAddSoftware(uint8_t* dst,const uint8_t* src,const uint8_t c,size_t size){
+        const auto& row=tables().mul[c];
+        for(size_t i=0;i<size;i++){
+            dst[i]^=row[src[i]];
+        }
+    }
+    // Products of c with all values of the low and the high nibble
+    inline void createNibbleTables(const uint8_t c,uint8_t low[16],uint8_t high[16]){
+        for(int i=0;i<16;i++){
+            low[i]=mul(c,(uint8_t)i);
+            high[i]=mul(c,(uint8_t)(i<<4));
+        }
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    __attribute__((target("ssse3")))
+    inline void mulAddSSSE3(uint8_t* dst,const uint8_t* src,const uint8_t c,size_t size){
+        alignas(16) uint8_t low[16],high[16];
+        createNibbleTables(c,low,high);
+        const __m128i lowTable=_mm_load_si128((const __m128i*)low);
+        const __m128i highTable=_mm_load_si128((const __m128i*)high);
+        const __m128i mask=_mm_set1_epi8(0x0F);
+        size_t i=0;
+        for(;i+16<=size;i+=16){
+            const __m128i x=_mm_loadu_si128((const __m128i*)&src[i]);
+            const __m128i product=_mm_xor_si128(_mm_shuffle_epi8(lowTable,_mm_and_si128(x,mask)),
+                                                _mm_shuffle_epi8(highTable,_mm_and_si128(_mm_srli_epi64(x,4),mask)));
+            _mm_storeu_si128((__m128i*)&dst[i],_mm_xor_si128(_mm_loadu_si128((const __m128i*)&dst[i]),product));
+        }
+        mulAddSoftware(&dst[i],&src[i],c,size-i);
+    }
+    __attribute__((target("avx2")))
+    inline void mulAddAVX2(uint8_t* dst,const uint8_t* src,const uint8_t c,size_t size){
+        alignas(16) uint8_t low[16],high[16];
+        createNibbleTables(c,low,high);
+        // the shuffle works per 128 bit lane, both lanes get the same table
+        const __m256i lowTable=_mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)low));
+        const __m256i highTable=_mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)high));
+        const __m256i mask=_mm256_set1_epi8(0x0F);
+        size_t i=0;
+        for(;i+32<=size;i+=32){
+            const __m256i x=_mm256_loadu_si256((const __m256i*)&src[i]);
+            const __m256i product=_mm256_xor_si256(_mm256_shuffle_epi8(lowTable,_mm256_and_si256(x,mask)),
+                                                   _mm256_shuffle_epi8(highTable,_mm256_and_si256(_mm256_srli_epi64(x,4),mask)));
+            _mm256_storeu_si256((__m256i*)&dst[i],_mm256_xor_si256(_mm256_loadu_si256((const __m256i*)&dst[i]),product));
+        }
+        mulAddSSSE3(&dst[i],&src[i],c,size-i);
+    }
+    inline const char* simdName(){
+        if(__builtin_cpu_supports("avx2"))return "avx2";
+        if(__builtin_cpu_supports("ssse3"))return "ssse3";
+        return "none";
+    }
+    inline void mulAddSimd(uint8_t* dst,const uint8_t* src,const uint8_t c,size_t size){
+        static const bool avx2=__builtin_cpu_supports("avx2");
+        static const bool ssse3=__builtin_cpu_supports("ssse3");
+        if(avx2){
+            mulAddAVX2(dst,src,c,size);
+        }else if(ssse3){
+            mulAddSSSE3(dst,src,c,size);
+        }else{
+            mulAddSoftware(dst,src,c,size);
+        }
+    }
+#elif defined(__aarch64__)
+    inline void mulAddSimd(uint8_t* dst,const uint8_t* src,const uint8_t c,size_t size){
+        uint8_t low[16],high[16];
+        createNibbleTables(c,low,high);
+        const uint8x16_t lowTable=vld1q_u8(low);
+        const uint8x16_t highTable=vld1q_u8(high);
+        const uint8x16_t mask=vdupq_n_u8(0x0F);
+        size_t i=0;
+        for(;i+16<=size;i+=16){
+            const uint8x16_t x=vld1q_u8(&src[i]);
+            const uint8x16_t product=veorq_u8(vqtbl1q_u8(lowTable,vandq_u8(x,mask)),vqtbl1q_u8(highTable,vshrq_n_u8(x,4)));
+            vst1q_u8(&dst[i],veorq_u8(vld1q_u8(&dst[i]),product));
+        }
+        mulAddSoftware(&dst[i],&src[i],c,size-i);
+    }
+    inline const char* simdName(){
+        return "neon";
+    }
+#elif defined(__ARM_NEON)
+    // armv7 has no 16 byte table lookup, VTBL looks up 8 bytes at a time in a table of two 8 byte registers
+    inline void mulAddSimd(uint8_t* dst,const uint8_t* src,const uint8_t c,size_t size){
+        uint8_t low[16],high[16];
+        createNibbleTables(c,low,high);
+        const uint8x8x2_t lowTable={{vld1_u8(low),vld1_u8(low+8)}};
+        const uint8x8x2_t highTable={{vld1_u8(high),vld1_u8(high+8)}};
+        const uint8x8_t mask=vdup_n_u8(0x0F);
+        size_t i=0;
+        for(;i+8<=size;i+=8){
+            const uint8x8_t x=vld1_u8(&src[i]);
+            const uint8x8_t product=veor_u8(vtbl2_u8(lowTable,vand_u8(x,mask)),vtbl2_u8(highTable,vshr_n_u8(x,4)));
+            vst1_u8(&dst[i],veor_u8(vld1_u8(&dst[i]),product));
+        }
+        mulAddSoftware(&dst[i],&src[i],c,size-i);
+    }
+    inline const char* simdName(){
+        return "neon armv7";
+    }
+#else
+    inline void mulAddSimd(uint8_t* dst,const uint8_t* src,const uint8_t c,size_t size){
+        mulAddSoftware(dst,src,c,size);
+    }
+    inline const char* simdName(){
+        return "none";
+    }
+#endif
+    // Use this one, dst ^= c*src
+    inline void mulAdd(uint8_t* dst,const uint8_t* src,const uint8_t c,size_t size){
+        if(c==0)return;
+        mulAddSimd(dst,src,c,size);
+    }
+}
+
+#endif //OPENHDTESTING_GF256_HPP
@@ -0,0 +1,106 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_INLINEUDPRECEIVER_HPP
+#define OPENHDTESTING_INLINEUDPRECEIVER_HPP
+
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <arpa/inet.h>
+#include "SocketHelper.hpp"
+#include "AndroidLogger.hpp"
+
+/**
+ * Stripped down, templated variant of UDPReceiver for the hot path: the callback type is a template parameter
+ * (e.g. a lambda), such that the compiler can inline it into the receive loop instead of calling through std::function.
+ * Always uses recvmmsg() into preallocated slots, the callback gets a non-owning view (data,size) into the slot that
+ * is only valid during the call. Nothing is allocated per packet, the sender address is kept as raw sockaddr_in.
+ * Usage: InlineUDPReceiver receiver{6001,[](const uint8_t* data,size_t size){...}};
+ */
+template<class Callback>
+class InlineUDPReceiver{
+public:
+    InlineUDPReceiver(const int port,Callback callback,const size_t maxBatchSize=32,const size_t maxDatagramSize=65507,
+                      const size_t wantedRcvBufSize=0):
+    mPort(port),mCallback(std::move(callback)),mMaxBatchSize(maxBatchSize),mMaxDatagramSize(maxDatagramSize),
+    mWantedRcvBufSize(wantedRcvBufSize){}
+    ~InlineUDPReceiver(){
+        stopReceiving();
+    }
+    void startReceiving(){
+        mSocket=SocketHelper::openUdpReceiveSocket(mPort,mWantedRcvBufSize);
+        if(mSocket==-1){
+            return;
+        }
+        receiving=true;
+        mThread=std::make_unique<std::thread>([this]{loop();});
+    }
+    void stopReceiving(){
+        if(mThread==nullptr)return;
+        receiving=false;
+        // this stops the recvmmsg even if it is blocking
+        shutdown(mSocket,SHUT_RD);
+        mThread->join();
+        mThread.reset();
+        close(mSocket);
+    }
+    long getNReceivedBytes()const{
+        return nReceivedBytes;
+    }
+    // Sender of the last datagram, only converted to a string on request
+    std::string getSourceIPAddress()const{
+        in_addr addr{};
+        addr.s_addr=mSourceAddress;
+        char buff[INET_ADDRSTRLEN];
+        return inet_ntop(AF_INET,&addr,buff,sizeof(buff));
+    }
+private:
+    void loop(){
+        std::vector<uint8_t> slots(mMaxBatchSize*mMaxDatagramSize);
+        std::vector<mmsghdr> msgs(mMaxBatchSize);
+        std::vector<iovec> iovecs(mMaxBatchSize);
+        std::vector<sockaddr_in> sources(mMaxBatchSize);
+        for(size_t i=0;i<mMaxBatchSize;i++){
+            iovecs[i]={&slots[i*mMaxDatagramSize],mMaxDatagramSize};
+        }
+        while(receiving){
+            for(size_t i=0;i<mMaxBatchSize;i++){
+                msghdr& hdr=msgs[i].msg_hdr;
+                memset(&hdr,0,sizeof(msghdr));
+                hdr.msg_iov=&iovecs[i];
+                hdr.msg_iovlen=1;
+                hdr.msg_name=&sources[i];
+                hdr.msg_namelen=sizeof(sockaddr_in);
+            }
+            const int nMessages=recvmmsg(mSocket,msgs.data(),mMaxBatchSize,MSG_WAITFORONE,nullptr);
+            // After shutdown() recvmmsg returns a single empty message
+            if(nMessages<=0 || msgs[0].msg_len==0){
+                continue;
+            }
+            long nBytes=0;
+            for(int i=0;i<nMessages;i++){
+                mCallback((const uint8_t*)iovecs[i].iov_base,(size_t)msgs[i].msg_len);
+                nBytes+=msgs[i].msg_len;
+            }
+            nReceivedBytes+=nBytes;
+            mSourceAddress=sources[nMessages-1].sin_addr.s_addr;
+        }
+    }
+    const int mPort;
+    Callback mCallback;
+    const size_t mMaxBatchSize;
+    const size_t mMaxDatagramSize;
+    const size_t mWantedRcvBufSize;
+    int mSocket=-1;
+    std::atomic<bool> receiving=false;
+    std::atomic<long> nReceivedBytes=0;
+    std::atomic<in_addr_t> mSourceAddress{0};
+    std::unique_ptr<std::thread> mThread;
+};
+
+#endif //OPENHDTESTING_INLINEUDPRECEIVER_HPP
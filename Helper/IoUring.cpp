@@ -0,0 +1,240 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#include "IoUring.h"
+#include "AndroidLogger.hpp"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <csignal>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+bool IoUring::isSupported() {
+    static const bool supported=[]{
+        IoUring probe{1};
+        return probe.isValid();
+    }();
+    return supported;
+}
+
+#ifdef HAVE_IO_URING
+IoUring::IoUring(const unsigned entries,const bool sqPoll,const unsigned sqPollIdleMs) {
+    io_uring_params params{};
+    if(sqPoll){
+        params.flags|=IORING_SETUP_SQPOLL;
+        params.sq_thread_idle=sqPollIdleMs;
+    }
+    mFd=(int)syscall(__NR_io_uring_setup,entries,&params);
+    if(mFd<0){
+        MLOGE<<"io_uring_setup failed "<<strerror(errno);
+        mFd=-1;
+        return;
+    }
+    mSqPoll=sqPoll;
+    sqRingSize=params.sq_off.array+params.sq_entries*sizeof(unsigned);
+    cqRingSize=params.cq_off.cqes+params.cq_entries*sizeof(io_uring_cqe);
+    const bool singleMmap=(params.features & IORING_FEAT_SINGLE_MMAP)!=0;
+    if(singleMmap){
+        sqRingSize=cqRingSize=std::max(sqRingSize,cqRingSize);
+    }
+    sqRingPtr=mmap(nullptr,sqRingSize,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,mFd,IORING_OFF_SQ_RING);
+    if(sqRingPtr==MAP_FAILED){
+        sqRingPtr=nullptr;
+    }
+    if(singleMmap){
+        cqRingPtr=sqRingPtr;
+    }else{
+        cqRingPtr=mmap(nullptr,cqRingSize,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,mFd,IORING_OFF_CQ_RING);
+        if(cqRingPtr==MAP_FAILED){
+            cqRingPtr=nullptr;
+        }
+    }
+    sqesSize=params.sq_entries*sizeof(io_uring_sqe);
+    void* sqesPtr=mmap(nullptr,sqesSize,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,mFd,IORING_OFF_SQES);
+    if(sqRingPtr==nullptr || cqRingPtr==nullptr || sqesPtr==MAP_FAILED){
+        MLOGE<<"Cannot map io_uring "<<strerror(errno);
+        if(sqesPtr!=MAP_FAILED){
+            munmap(sqesPtr,sqesSize);
+        }
+        release();
+        return;
+    }
+    sqes=(io_uring_sqe*)sqesPtr;
+    auto* sq=(uint8_t*)sqRingPtr;
+    sqHead=(unsigned*)(sq+params.sq_off.head);
+    sqTail=(unsigned*)(sq+params.sq_off.tail);
+    sqFlags=(unsigned*)(sq+params.sq_off.flags);
+    sqArray=(unsigned*)(sq+params.sq_off.array);
+    sqMask=*(unsigned*)(sq+params.sq_off.ring_mask);
+    sqEntries=params.sq_entries;
+    sqeTail=*sqTail;
+    auto* cq=(uint8_t*)cqRingPtr;
+    cqHead=(unsigned*)(cq+params.cq_off.head);
+    cqTail=(unsigned*)(cq+params.cq_off.tail);
+    cqMask=*(unsigned*)(cq+params.cq_off.ring_mask);
+    cqes=(io_uring_cqe*)(cq+params.cq_off.cqes);
+}
+
+IoUring::~IoUring() {
+    release();
+}
+
+void IoUring::release() {
+    if(bufRing!=nullptr){
+        munmap(bufRing,bufRingSize);
+        munmap(bufMemory,bufSize*(bufMask+1));
+        bufRing=nullptr;
+    }
+    if(sqes!=nullptr){
+        munmap(sqes,sqesSize);
+        sqes=nullptr;
+    }
+    if(cqRingPtr!=nullptr && cqRingPtr!=sqRingPtr){
+        munmap(cqRingPtr,cqRingSize);
+    }
+    if(sqRingPtr!=nullptr){
+        munmap(sqRingPtr,sqRingSize);
+    }
+    sqRingPtr=cqRingPtr=nullptr;
+    if(mFd!=-1){
+        close(mFd);
+        mFd=-1;
+    }
+}
+
+int IoUring::enter(const unsigned toSubmit,const unsigned minComplete,const unsigned flags,const void* arg,const size_t argSize) {
+    nSyscalls++;
+    const int ret=(int)syscall(__NR_io_uring_enter,mFd,toSubmit,minComplete,flags,arg,argSize);
+    return ret<0 ? -errno : ret;
+}
+
+io_uring_sqe* IoUring::getSqe() {
+    const unsigned head=__atomic_load_n(sqHead,__ATOMIC_ACQUIRE);
+    if(sqeTail-head>=sqEntries){
+        return nullptr;
+    }
+    const unsigned index=sqeTail & sqMask;
+    io_uring_sqe* sqe=&sqes[index];
+    memset(sqe,0,sizeof(io_uring_sqe));
+    sqArray[index]=index;
+    sqeTail++;
+    return sqe;
+}
+
+int IoUring::submit(const unsigned waitNr) {
+    const unsigned toSubmit=sqeTail-*sqTail;
+    __atomic_store_n(sqTail,sqeTail,__ATOMIC_RELEASE);
+    unsigned flags=waitNr>0 ? IORING_ENTER_GETEVENTS : 0;
+    if(mSqPoll){
+        // The poll thread might go to sleep between our tail update and this check, hence the full barrier
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if(__atomic_load_n(sqFlags,__ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP){
+            flags|=IORING_ENTER_SQ_WAKEUP;
+        }
+        if(flags==0){
+            return (int)toSubmit;
+        }
+        return enter(0,waitNr,flags);
+    }
+    if(toSubmit==0 && waitNr==0){
+        return 0;
+    }
+    return enter(toSubmit,waitNr,flags);
+}
+
+bool IoUring::waitCqe(const std::chrono::nanoseconds timeout) {
+    if(*cqHead!=__atomic_load_n(cqTail,__ATOMIC_ACQUIRE)){
+        return true;
+    }
+    __kernel_timespec ts{};
+    ts.tv_sec=timeout.count()/1000000000;
+    ts.tv_nsec=timeout.count()%1000000000;
+    io_uring_getevents_arg arg{};
+    arg.sigmask_sz=_NSIG/8;
+    arg.ts=(uint64_t)&ts;
+    const int ret=enter(0,1,IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,&arg,sizeof(arg));
+    if(ret<0 && ret!=-ETIME && ret!=-EINTR){
+        MLOGE<<"io_uring_enter failed "<<strerror(-ret);
+    }
+    return *cqHead!=__atomic_load_n(cqTail,__ATOMIC_ACQUIRE);
+}
+
+bool IoUring::setupBufferRing(const uint16_t groupId,const unsigned nBuffers,const size_t bufferSize) {
+    if(nBuffers==0 || (nBuffers & (nBuffers-1))!=0 || nBuffers>32768){
+        MLOGE<<"N of provided buffers must be a power of 2 <= 32768, not "<<nBuffers;
+        return false;
+    }
+    bufRingSize=nBuffers*sizeof(io_uring_buf);
+    void* ring=mmap(nullptr,bufRingSize,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    void* memory=mmap(nullptr,nBuffers*bufferSize,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,-1,0);
+    if(ring==MAP_FAILED || memory==MAP_FAILED){
+        MLOGE<<"Cannot allocate provided buffers "<<strerror(errno);
+        if(ring!=MAP_FAILED)munmap(ring,bufRingSize);
+        if(memory!=MAP_FAILED)munmap(memory,nBuffers*bufferSize);
+        return false;
+    }
+    io_uring_buf_reg reg{};
+    reg.ring_addr=(uint64_t)ring;
+    reg.ring_entries=nBuffers;
+    reg.bgid=groupId;
+    nSyscalls++;
+    if(syscall(__NR_io_uring_register,mFd,IORING_REGISTER_PBUF_RING,&reg,1)<0){
+        MLOGE<<"Cannot register provided buffer ring "<<strerror(errno);
+        munmap(ring,bufRingSize);
+        munmap(memory,nBuffers*bufferSize);
+        return false;
+    }
+    bufRing=(io_uring_buf_ring*)ring;
+    bufMemory=(uint8_t*)memory;
+    bufSize=bufferSize;
+    bufMask=nBuffers-1;
+    bufTail=0;
+    for(unsigned i=0;i<nBuffers;i++){
+        recycleBuffer((uint16_t)i);
+    }
+    commitBuffers();
+    return true;
+}
+
+uint8_t* IoUring::getBuffer(const uint16_t bufferId) const {
+    return bufMemory+(size_t)bufferId*bufSize;
+}
+
+size_t IoUring::getBufferSize() const {
+    return bufSize;
+}
+
+void IoUring::recycleBuffer(const uint16_t bufferId) {
+    // Not bufRing->bufs: in C++ the empty struct of __DECLARE_FLEX_ARRAY moves it 8 bytes away from the ring start
+    io_uring_buf& buf=((io_uring_buf*)bufRing)[bufTail & bufMask];
+    buf.addr=(uint64_t)getBuffer(bufferId);
+    buf.len=(uint32_t)bufSize;
+    buf.bid=bufferId;
+    bufTail++;
+}
+
+void IoUring::commitBuffers() {
+    __atomic_store_n(&bufRing->tail,bufTail,__ATOMIC_RELEASE);
+}
+
+#else
+IoUring::IoUring(const unsigned,const bool,const unsigned) {
+    MLOGE<<"Built without io_uring (needs the linux 6.0+ uapi headers)";
+}
+
+IoUring::~IoUring()=default;
+#endif
+
+bool IoUring::isValid() const {
+    return mFd!=-1;
+}
+
+bool IoUring::isSqPoll() const {
+    return mSqPoll;
+}
+
+uint64_t IoUring::getNSyscalls() const {
+    return nSyscalls;
+}
@@ -0,0 +1,120 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_IOURING_H
+#define OPENHDTESTING_IOURING_H
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <climits>
+#include <string>
+
+// Multishot recvmsg and provided buffer rings need the uapi headers of linux 6.0+. Built against older headers only a
+// stub is compiled that never becomes valid, UDPSender / UDPReceiver then keep their classic backend.
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING
+#endif
+
+/**
+ * Minimal io_uring wrapper on the raw syscalls (no liburing dependency): one submission / completion queue pair
+ * and one ring of provided buffers for multishot receives.
+ * With sqPoll a kernel thread picks up the submissions, submit() then only needs a syscall if that thread went idle.
+ * Not thread safe, one instance per thread. Check isValid() after construction, io_uring might be missing or disabled
+ * (e.g. /proc/sys/kernel/io_uring_disabled, seccomp in containers).
+ */
+class IoUring{
+public:
+    // True if io_uring_setup() works on this kernel (probed once)
+    static bool isSupported();
+    explicit IoUring(unsigned entries,bool sqPoll=false,unsigned sqPollIdleMs=1000);
+    ~IoUring();
+    IoUring(const IoUring&)=delete;
+    IoUring& operator=(const IoUring&)=delete;
+    bool isValid()const;
+    bool isSqPoll()const;
+    // N of io_uring_enter() syscalls so far
+    uint64_t getNSyscalls()const;
+#ifdef HAVE_IO_URING
+    // Next free submission queue entry (zeroed), nullptr if the submission queue is full
+    io_uring_sqe* getSqe();
+    /**
+     * Hand all sqes from getSqe() to the kernel and wait for at least @param waitNr completions.
+     * In sqPoll mode this only enters the kernel if the poll thread needs a wakeup or waitNr>0.
+     * @return the n of submitted sqes or -errno
+     */
+    int submit(unsigned waitNr=0);
+    // Wait up to @param timeout until at least one completion is available, false on timeout
+    bool waitCqe(std::chrono::nanoseconds timeout);
+    // Call @param onCqe for up to @param max available completions without any syscall, returns their count
+    template<class F>
+    unsigned forEachCqe(F onCqe,const unsigned max=UINT_MAX){
+        unsigned head=*cqHead;
+        const unsigned tail=__atomic_load_n(cqTail,__ATOMIC_ACQUIRE);
+        unsigned n=0;
+        while(head!=tail && n<max){
+            onCqe(cqes[head & cqMask]);
+            head++;
+            n++;
+        }
+        __atomic_store_n(cqHead,head,__ATOMIC_RELEASE);
+        return n;
+    }
+    /**
+     * Register a ring of @param nBuffers (power of 2) provided buffers of @param bufferSize each for buffer group
+     * @param groupId. Receives with IOSQE_BUFFER_SELECT pick a buffer, the buffer id is in the cqe flags
+     * (cqe.flags >> IORING_CQE_BUFFER_SHIFT). Hand it back with recycleBuffer() once the data is consumed.
+     */
+    bool setupBufferRing(uint16_t groupId,unsigned nBuffers,size_t bufferSize);
+    uint8_t* getBuffer(uint16_t bufferId)const;
+    size_t getBufferSize()const;
+    // Buffers are queued and only visible to the kernel after commitBuffers()
+    void recycleBuffer(uint16_t bufferId);
+    void commitBuffers();
+#endif
+private:
+    int mFd=-1;
+    bool mSqPoll=false;
+    uint64_t nSyscalls=0;
+#ifdef HAVE_IO_URING
+    void release();
+    int enter(unsigned toSubmit,unsigned minComplete,unsigned flags,const void* arg=nullptr,size_t argSize=0);
+    // Submission queue
+    void* sqRingPtr=nullptr;
+    size_t sqRingSize=0;
+    unsigned* sqHead=nullptr;
+    unsigned* sqTail=nullptr;
+    unsigned* sqFlags=nullptr;
+    unsigned* sqArray=nullptr;
+    unsigned sqMask=0;
+    unsigned sqEntries=0;
+    // sqes handed out by getSqe(), not yet visible to the kernel
+    unsigned sqeTail=0;
+    io_uring_sqe* sqes=nullptr;
+    size_t sqesSize=0;
+    // Completion queue, shares the mapping with the submission queue on all kernels with IORING_FEAT_SINGLE_MMAP
+    void* cqRingPtr=nullptr;
+    size_t cqRingSize=0;
+    unsigned* cqHead=nullptr;
+    unsigned* cqTail=nullptr;
+    unsigned cqMask=0;
+    io_uring_cqe* cqes=nullptr;
+    // Provided buffer ring
+    io_uring_buf_ring* bufRing=nullptr;
+    size_t bufRingSize=0;
+    uint8_t* bufMemory=nullptr;
+    size_t bufSize=0;
+    unsigned bufMask=0;
+    uint16_t bufTail=0;
+#endif
+};
+
+#endif //OPENHDTESTING_IOURING_H
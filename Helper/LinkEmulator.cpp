@@ -0,0 +1,265 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#include "LinkEmulator.h"
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+
+// Delayed packets closer than this to their departure time are sent by spinning instead of sleeping
+static constexpr auto SPIN_MARGIN=std::chrono::microseconds(50);
+
+LinkEmulator::LinkEmulator(int port,const std::string& destinationIp,int destinationPort,LinkEmulatorConfig config,size_t maxBatchSize):
+mPort(port),mConfig(std::move(config)),mMaxBatchSize(maxBatchSize),random(mConfig.seed){
+    mDestination.sin_family=AF_INET;
+    mDestination.sin_port=htons(destinationPort);
+    inet_pton(AF_INET,destinationIp.c_str(),&mDestination.sin_addr);
+    pool.resize(POOL_SIZE*MAX_PACKET_SIZE);
+    freeSlots.reserve(POOL_SIZE);
+    for(uint32_t i=0;i<POOL_SIZE;i++){
+        freeSlots.push_back(POOL_SIZE-1-i);
+    }
+    scheduled.reserve(POOL_SIZE);
+}
+
+LinkEmulator::~LinkEmulator() {
+    stop();
+}
+
+void LinkEmulator::start() {
+    mSocket=socket(AF_INET,SOCK_DGRAM,IPPROTO_UDP);
+    if(mSocket<0){
+        MLOGE<<"Cannot create socket";
+        return;
+    }
+    int enable=1;
+    setsockopt(mSocket,SOL_SOCKET,SO_REUSEADDR,&enable,sizeof(int));
+    sockaddr_in myaddr{};
+    myaddr.sin_family=AF_INET;
+    myaddr.sin_addr.s_addr=htonl(INADDR_ANY);
+    myaddr.sin_port=htons(mPort);
+    if(bind(mSocket,(sockaddr*)&myaddr,sizeof(myaddr))==-1){
+        MLOGE<<"Error binding Port; "<<mPort;
+        close(mSocket);
+        mSocket=-1;
+        return;
+    }
+    startTime=std::chrono::steady_clock::now();
+    running=true;
+    mReceiveThread=std::make_unique<std::thread>([this]{receiveLoop();});
+    mSendThread=std::make_unique<std::thread>([this]{sendLoop();});
+}
+
+void LinkEmulator::stop() {
+    if(mReceiveThread==nullptr)return;
+    {
+        // Under the lock, else the send thread might check running right before we notify and then wait forever
+        std::lock_guard<std::mutex> lock(mMutex);
+        running=false;
+    }
+    //this stops the recvmmsg even if in blocking mode
+    shutdown(mSocket,SHUT_RD);
+    mReceiveThread->join();
+    mReceiveThread.reset();
+    mCondition.notify_all();
+    mSendThread->join();
+    mSendThread.reset();
+    close(mSocket);
+    mSocket=-1;
+}
+
+LinkEmulator::Stats LinkEmulator::getStats() const {
+    return Stats{nReceived,nForwarded,nLost,nQueueDrops,nDuplicated,nReordered};
+}
+
+LatencyHistogram LinkEmulator::getSchedulingError() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return schedulingError;
+}
+
+std::string LinkEmulator::getStatsReadable() const {
+    const auto stats=getStats();
+    std::stringstream ss;
+    ss<<"received "<<stats.nReceived<<" forwarded "<<stats.nForwarded<<" lost "<<stats.nLost<<" queue drops "<<stats.nQueueDrops
+    <<" duplicated "<<stats.nDuplicated<<" reordered "<<stats.nReordered;
+    return ss.str();
+}
+
+const LinkProfileEntry* LinkEmulator::currentProfileEntry(const std::chrono::steady_clock::time_point now) const {
+    if(mConfig.profile.empty())return nullptr;
+    // The profile has to last at least 1ns, else there is nothing to replay
+    const auto duration=std::max(mConfig.profile.back().offset,std::chrono::nanoseconds(1));
+    const auto offset=std::chrono::duration_cast<std::chrono::nanoseconds>(now-startTime)%duration;
+    const auto next=std::upper_bound(mConfig.profile.begin(),mConfig.profile.end(),offset,[](const std::chrono::nanoseconds value,const LinkProfileEntry& entry){
+        return value<entry.offset;
+    });
+    return next==mConfig.profile.begin() ? &mConfig.profile.front() : &*(next-1);
+}
+
+bool LinkEmulator::passesLoss(const std::chrono::steady_clock::time_point now) {
+    badState=badState ? uniform(random)>=mConfig.pBadToGood : uniform(random)<mConfig.pGoodToBad;
+    if(uniform(random)<(badState ? mConfig.lossBad : mConfig.lossGood)){
+        return false;
+    }
+    const auto* profileEntry=currentProfileEntry(now);
+    return profileEntry==nullptr || uniform(random)>=profileEntry->lossProbability;
+}
+
+std::chrono::steady_clock::time_point LinkEmulator::departureTime(const std::chrono::steady_clock::time_point arrival,const size_t size,bool& reordered) {
+    auto departure=arrival;
+    if(mConfig.rateBitsPerSecond>0){
+        // Bytes that are still waiting in front of this packet
+        const auto backlog=std::max(linkFreeAt-arrival,std::chrono::steady_clock::duration(0));
+        const uint64_t backlogBytes=std::chrono::duration_cast<std::chrono::nanoseconds>(backlog).count()*mConfig.rateBitsPerSecond/8/1000000000;
+        if(backlogBytes+size>mConfig.queueLimitBytes){
+            return std::chrono::steady_clock::time_point::max();
+        }
+        const auto serialization=std::chrono::nanoseconds(size*8*1000000000/mConfig.rateBitsPerSecond);
+        linkFreeAt=std::max(linkFreeAt,arrival)+serialization;
+        departure=linkFreeAt;
+    }
+    const auto* profileEntry=currentProfileEntry(arrival);
+    departure+=profileEntry!=nullptr ? profileEntry->latency : mConfig.latency;
+    if(mConfig.jitter.count()>0){
+        departure+=std::chrono::nanoseconds((int64_t)(uniform(random)*mConfig.jitter.count()));
+    }
+    reordered=uniform(random)<mConfig.reorderProbability;
+    if(reordered){
+        departure+=mConfig.reorderDelay;
+    }else{
+        // Jitter alone does not reorder, like a real link the packets stay in order
+        departure=std::max(departure,lastInOrderDeparture);
+        lastInOrderDeparture=departure;
+    }
+    return departure;
+}
+
+void LinkEmulator::schedule(const uint8_t* data,const size_t size,const std::chrono::steady_clock::time_point departure) {
+    if(freeSlots.empty()){
+        nQueueDrops++;
+        return;
+    }
+    const uint32_t slot=freeSlots.back();
+    freeSlots.pop_back();
+    memcpy(&pool[slot*MAX_PACKET_SIZE],data,size);
+    scheduled.push_back({departure,nScheduled++,slot,(uint32_t)size});
+    std::push_heap(scheduled.begin(),scheduled.end(),std::greater<Scheduled>());
+}
+
+void LinkEmulator::receiveLoop() {
+    // Everything is allocated once, the loop itself does not allocate
+    std::vector<uint8_t> buffers(mMaxBatchSize*MAX_PACKET_SIZE);
+    std::vector<mmsghdr> rxMsgs(mMaxBatchSize);
+    std::vector<mmsghdr> txMsgs(mMaxBatchSize*2);
+    std::vector<iovec> rxIovecs(mMaxBatchSize);
+    std::vector<iovec> txIovecs(mMaxBatchSize*2);
+    for(size_t i=0;i<mMaxBatchSize;i++){
+        rxIovecs[i].iov_base=&buffers[i*MAX_PACKET_SIZE];
+        rxIovecs[i].iov_len=MAX_PACKET_SIZE;
+    }
+    while(running){
+        for(size_t i=0;i<mMaxBatchSize;i++){
+            msghdr& hdr=rxMsgs[i].msg_hdr;
+            memset(&hdr,0,sizeof(msghdr));
+            hdr.msg_iov=&rxIovecs[i];
+            hdr.msg_iovlen=1;
+        }
+        const int nMessages=recvmmsg(mSocket,rxMsgs.data(),mMaxBatchSize,MSG_WAITFORONE,nullptr);
+        // After shutdown() recvmmsg returns a single empty message
+        if(nMessages<=0 || rxMsgs[0].msg_len==0){
+            continue;
+        }
+        const auto now=std::chrono::steady_clock::now();
+        nReceived+=nMessages;
+        int nToSend=0;
+        bool anyScheduled=false;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            for(int i=0;i<nMessages;i++){
+                const auto* data=(const uint8_t*)rxIovecs[i].iov_base;
+                const size_t size=rxMsgs[i].msg_len;
+                if((rxMsgs[i].msg_hdr.msg_flags & MSG_TRUNC) || !passesLoss(now)){
+                    nLost++;
+                    continue;
+                }
+                bool reordered=false;
+                const auto departure=departureTime(now,size,reordered);
+                if(departure==std::chrono::steady_clock::time_point::max()){
+                    nQueueDrops++;
+                    continue;
+                }
+                nReordered+=reordered ? 1 : 0;
+                const int nCopies=uniform(random)<mConfig.duplicateProbability ? 2 : 1;
+                nDuplicated+=nCopies-1;
+                for(int copy=0;copy<nCopies;copy++){
+                    if(departure<=now && scheduled.empty()){
+                        // Nothing to wait for and nothing in front of it, forward right away
+                        txIovecs[nToSend]={rxIovecs[i].iov_base,size};
+                        msghdr& hdr=txMsgs[nToSend].msg_hdr;
+                        memset(&hdr,0,sizeof(msghdr));
+                        hdr.msg_iov=&txIovecs[nToSend];
+                        hdr.msg_iovlen=1;
+                        hdr.msg_name=&mDestination;
+                        hdr.msg_namelen=sizeof(sockaddr_in);
+                        nToSend++;
+                    }else{
+                        schedule(data,size,departure);
+                        anyScheduled=true;
+                    }
+                }
+            }
+        }
+        if(anyScheduled){
+            mCondition.notify_one();
+        }
+        int nSent=0;
+        while(nSent<nToSend){
+            const int result=sendmmsg(mSocket,&txMsgs[nSent],nToSend-nSent,0);
+            if(result<=0){
+                MLOGE<<"Cannot forward "<<strerror(errno);
+                break;
+            }
+            nSent+=result;
+        }
+        nForwarded+=nSent;
+    }
+}
+
+void LinkEmulator::sendLoop() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(running){
+        if(scheduled.empty()){
+            mCondition.wait(lock);
+            continue;
+        }
+        const auto departure=scheduled.front().departure;
+        const auto now=std::chrono::steady_clock::now();
+        if(departure>now){
+            if(departure-now>SPIN_MARGIN){
+                // Woken up early if the receive thread schedules a packet that has to leave before this one
+                mCondition.wait_until(lock,departure-SPIN_MARGIN);
+            }else{
+                lock.unlock();
+                while(std::chrono::steady_clock::now()<departure){}
+                lock.lock();
+            }
+            continue;
+        }
+        std::pop_heap(scheduled.begin(),scheduled.end(),std::greater<Scheduled>());
+        const Scheduled packet=scheduled.back();
+        scheduled.pop_back();
+        // The slot is not reused until it is back in freeSlots
+        lock.unlock();
+        const auto result=sendto(mSocket,&pool[packet.slot*MAX_PACKET_SIZE],packet.size,0,(const sockaddr*)&mDestination,sizeof(sockaddr_in));
+        const auto sendTime=std::chrono::steady_clock::now();
+        lock.lock();
+        if(result>0){
+            nForwarded++;
+        }
+        schedulingError.add(std::chrono::duration_cast<std::chrono::nanoseconds>(sendTime-packet.departure));
+        freeSlots.push_back(packet.slot);
+    }
+}
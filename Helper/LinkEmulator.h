@@ -0,0 +1,122 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_LINKEMULATOR_H
+#define OPENHDTESTING_LINKEMULATOR_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <random>
+#include <netinet/in.h>
+#include "TimeHelper.hpp"
+
+// One step of a recorded link, active from offset until the offset of the next entry
+struct LinkProfileEntry{
+    std::chrono::nanoseconds offset;
+    std::chrono::nanoseconds latency;
+    float lossProbability;
+};
+
+struct LinkEmulatorConfig{
+    // Added to each packet
+    std::chrono::nanoseconds latency{0};
+    // Uniform random extra delay in [0,jitter]
+    std::chrono::nanoseconds jitter{0};
+    // Gilbert-Elliott burst loss. Per packet the state changes from good to bad with pGoodToBad and back with pBadToGood,
+    // in each state a packet is lost with lossGood / lossBad
+    float pGoodToBad=0;
+    float pBadToGood=1;
+    float lossGood=0;
+    float lossBad=1;
+    // A reordered packet gets reorderDelay on top and is overtaken by the following packets
+    float reorderProbability=0;
+    std::chrono::nanoseconds reorderDelay=std::chrono::milliseconds(1);
+    float duplicateProbability=0;
+    // 0 = unlimited, else packets are serialized at this rate and wait in a queue of up to queueLimitBytes (drop tail)
+    uint64_t rateBitsPerSecond=0;
+    size_t queueLimitBytes=64*1024;
+    // If not empty, replayed in a loop. Replaces latency and adds its loss probability on top of the Gilbert-Elliott loss
+    std::vector<LinkProfileEntry> profile;
+    uint32_t seed=0;
+};
+
+/**
+ * Userspace stand-in for a wfb_tx -> air -> wfb_rx link. Receives datagrams on @param port and forwards them to
+ * destinationIp:destinationPort with the impairments of LinkEmulatorConfig.
+ * Packets without delay are forwarded directly by the receive thread with sendmmsg (no thread handoff), delayed packets
+ * are copied into a preallocated pool and sent by a second thread at their departure time.
+ */
+class LinkEmulator{
+public:
+    LinkEmulator(int port,const std::string& destinationIp,int destinationPort,LinkEmulatorConfig config,size_t maxBatchSize=32);
+    ~LinkEmulator();
+    void start();
+    void stop();
+    struct Stats{
+        uint64_t nReceived;
+        uint64_t nForwarded;
+        uint64_t nLost;
+        uint64_t nQueueDrops;
+        uint64_t nDuplicated;
+        uint64_t nReordered;
+    };
+    Stats getStats()const;
+    // How late each delayed packet was sent compared to its departure time
+    LatencyHistogram getSchedulingError()const;
+    std::string getStatsReadable()const;
+    // Larger datagrams are dropped
+    static constexpr size_t MAX_PACKET_SIZE=2048;
+    static constexpr size_t POOL_SIZE=4096;
+private:
+    void receiveLoop();
+    void sendLoop();
+    // Decide if the packet is lost, returns false if so
+    bool passesLoss(std::chrono::steady_clock::time_point now);
+    // Returns the departure time or time_point::max() if the queue is full
+    std::chrono::steady_clock::time_point departureTime(std::chrono::steady_clock::time_point arrival,size_t size,bool& reordered);
+    // Copy into a pool slot and hand over to the send thread, mMutex must be held
+    void schedule(const uint8_t* data,size_t size,std::chrono::steady_clock::time_point departure);
+    const LinkProfileEntry* currentProfileEntry(std::chrono::steady_clock::time_point now)const;
+    const int mPort;
+    sockaddr_in mDestination{};
+    const LinkEmulatorConfig mConfig;
+    const size_t mMaxBatchSize;
+    int mSocket=-1;
+    std::atomic<bool> running=false;
+    std::unique_ptr<std::thread> mReceiveThread;
+    std::unique_ptr<std::thread> mSendThread;
+    // Only used by the receive thread
+    std::mt19937 random;
+    std::uniform_real_distribution<float> uniform{0.0f,1.0f};
+    bool badState=false;
+    std::chrono::steady_clock::time_point linkFreeAt{};
+    std::chrono::steady_clock::time_point lastInOrderDeparture{};
+    std::chrono::steady_clock::time_point startTime{};
+    // Delayed packets, guarded by mMutex
+    struct Scheduled{
+        std::chrono::steady_clock::time_point departure;
+        // keeps packets with the same departure in arrival order
+        uint64_t order;
+        uint32_t slot;
+        uint32_t size;
+        bool operator>(const Scheduled& other)const{
+            return departure!=other.departure ? departure>other.departure : order>other.order;
+        }
+    };
+    mutable std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::vector<Scheduled> scheduled;
+    std::vector<uint8_t> pool;
+    std::vector<uint32_t> freeSlots;
+    uint64_t nScheduled=0;
+    LatencyHistogram schedulingError;
+    std::atomic<uint64_t> nReceived=0,nForwarded=0,nLost=0,nQueueDrops=0,nDuplicated=0,nReordered=0;
+};
+
+#endif //OPENHDTESTING_LINKEMULATOR_H
@@ -0,0 +1,177 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#include "LinuxThreadHelper.h"
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <cstring>
+#include <alloca.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "AndroidLogger.hpp"
+#include "StringHelper.hpp"
+
+std::string LinuxThreadHelper::policyName(const int policy){
+    switch(policy){
+        case SCHED_OTHER:return "SCHED_OTHER";
+        case SCHED_FIFO:return "SCHED_FIFO";
+        case SCHED_RR:return "SCHED_RR";
+        case SCHED_BATCH:return "SCHED_BATCH";
+        case SCHED_IDLE:return "SCHED_IDLE";
+        default:return "policy "+std::to_string(policy);
+    }
+}
+
+int LinuxThreadHelper::findIrqCpu(const std::string& interfaceName){
+    std::ifstream file("/proc/interrupts");
+    std::string line;
+    // First line are the cpu names (CPU0 CPU1 ...)
+    if(!std::getline(file,line)){
+        MLOGE<<"Cannot read /proc/interrupts";
+        return -1;
+    }
+    std::stringstream header(line);
+    std::string cpuName;
+    std::vector<uint64_t> countPerCpu;
+    while(header>>cpuName){
+        countPerCpu.push_back(0);
+    }
+    bool found=false;
+    while(std::getline(file,line)){
+        // The device name is the last column, interfaces often have one interrupt per queue (e.g. eth0-rx-0)
+        std::stringstream columns(line);
+        std::vector<std::string> values;
+        std::string value;
+        while(columns>>value){
+            values.push_back(value);
+        }
+        if(values.size()<countPerCpu.size()+2 || values.back().find(interfaceName)==std::string::npos){
+            continue;
+        }
+        found=true;
+        for(size_t cpu=0;cpu<countPerCpu.size();cpu++){
+            countPerCpu[cpu]+=std::strtoull(values[cpu+1].c_str(),nullptr,10);
+        }
+    }
+    if(!found){
+        return -1;
+    }
+    int irqCpu=0;
+    for(size_t cpu=1;cpu<countPerCpu.size();cpu++){
+        if(countPerCpu[cpu]>countPerCpu[irqCpu]){
+            irqCpu=(int)cpu;
+        }
+    }
+    return irqCpu;
+}
+
+void LinuxThreadHelper::prefault(void* data,const size_t size){
+    const long pageSize=sysconf(_SC_PAGESIZE);
+    volatile uint8_t* p=(volatile uint8_t*)data;
+    for(size_t i=0;i<size;i+=pageSize){
+        p[i]=p[i];
+    }
+}
+
+// Touches the pages below the current stack frame, noinline such that the alloca() is freed right after
+static void __attribute__((noinline)) prefaultStack(const size_t size){
+    volatile uint8_t* stack=(volatile uint8_t*)alloca(size);
+    LinuxThreadHelper::prefault((void*)stack,size);
+}
+
+// Locked memory of the process in kB, from /proc/self/status
+static long getLockedMemoryKb(){
+    std::ifstream file("/proc/self/status");
+    std::string line;
+    while(std::getline(file,line)){
+        if(line.rfind("VmLck:",0)==0){
+            return std::strtol(line.c_str()+6,nullptr,10);
+        }
+    }
+    return 0;
+}
+
+std::string LinuxThreadHelper::apply(const Config& config){
+    std::stringstream ss;
+    if(config.lockMemory){
+        if(mlockall(MCL_CURRENT | MCL_FUTURE)!=0){
+            MLOGE<<"mlockall failed "<<strerror(errno);
+            ss<<"mlockall failed ("<<strerror(errno)<<"), ";
+        }
+    }
+    if(config.prefaultStackSize>0){
+        prefaultStack(config.prefaultStackSize);
+        ss<<StringHelper::memorySizeReadable(config.prefaultStackSize)<<" stack prefaulted, ";
+    }
+    int cpu=config.cpu;
+    if(!config.irqInterface.empty()){
+        const int irqCpu=findIrqCpu(config.irqInterface);
+        if(irqCpu<0){
+            MLOGE<<"No interrupts for "<<config.irqInterface;
+            ss<<"no irq of "<<config.irqInterface<<", ";
+        }else{
+            cpu=(irqCpu+config.irqCpuOffset)%(int)sysconf(_SC_NPROCESSORS_ONLN);
+            ss<<"irq of "<<config.irqInterface<<" on cpu "<<irqCpu<<", ";
+        }
+    }
+    if(cpu>=0){
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(cpu,&cpuSet);
+        const int result=pthread_setaffinity_np(pthread_self(),sizeof(cpu_set_t),&cpuSet);
+        if(result!=0){
+            MLOGE<<"Cannot pin to cpu "<<cpu<<" "<<strerror(result);
+            ss<<"cpu "<<cpu<<" failed ("<<strerror(result)<<"), ";
+        }
+    }
+    if(config.policy!=SCHED_OTHER){
+        sched_param param{};
+        param.sched_priority=config.priority;
+        const int result=pthread_setschedparam(pthread_self(),config.policy,&param);
+        if(result!=0){
+            MLOGE<<"Cannot set "<<policyName(config.policy)<<" priority "<<config.priority<<" "<<strerror(result);
+            ss<<policyName(config.policy)<<" failed ("<<strerror(result)<<"), ";
+        }
+    }
+    // Read back what the thread really runs with
+    ss<<getThreadReadable();
+    return ss.str();
+}
+
+std::string LinuxThreadHelper::getThreadReadable(pthread_t thread){
+    std::stringstream ss;
+    int policy=SCHED_OTHER;
+    sched_param param{};
+    pthread_getschedparam(thread,&policy,&param);
+    ss<<policyName(policy)<<" priority "<<param.sched_priority;
+    if(pthread_equal(thread,pthread_self())){
+        // The nice value only applies to SCHED_OTHER and is per thread on linux
+        ss<<" nice "<<getpriority(PRIO_PROCESS,(id_t)syscall(SYS_gettid));
+    }
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    if(pthread_getaffinity_np(thread,sizeof(cpu_set_t),&cpuSet)==0){
+        ss<<", cpus";
+        const int nCpus=(int)sysconf(_SC_NPROCESSORS_CONF);
+        bool first=true;
+        for(int cpu=0;cpu<nCpus;cpu++){
+            if(!CPU_ISSET(cpu,&cpuSet))continue;
+            // Print ranges like 0-3
+            int last=cpu;
+            while(last+1<nCpus && CPU_ISSET(last+1,&cpuSet))last++;
+            ss<<(first ? " " : ",")<<cpu;
+            if(last>cpu)ss<<"-"<<last;
+            first=false;
+            cpu=last;
+        }
+    }
+    const long lockedKb=getLockedMemoryKb();
+    if(lockedKb>0){
+        ss<<", "<<StringHelper::memorySizeReadable(lockedKb*1024)<<" memory locked";
+    }
+    return ss.str();
+}
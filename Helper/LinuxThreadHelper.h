@@ -0,0 +1,47 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_LINUXTHREADHELPER_H
+#define OPENHDTESTING_LINUXTHREADHELPER_H
+
+#include <string>
+#include <cstddef>
+#include <pthread.h>
+#include <sched.h>
+
+// Linux counterpart of NDKThreadHelper: real-time scheduling, CPU affinity and memory locking for latency critical
+// threads. Without CAP_SYS_NICE / RLIMIT_RTPRIO and RLIMIT_MEMLOCK most of it fails, that is why apply() reports
+// what actually took effect instead of what was requested.
+namespace LinuxThreadHelper{
+    struct Config{
+        // SCHED_OTHER leaves the scheduling untouched
+        int policy=SCHED_OTHER;
+        // 1..99 for SCHED_FIFO / SCHED_RR
+        int priority=0;
+        // -1 leaves the affinity untouched
+        int cpu=-1;
+        // If not empty, pin to the core that handles most interrupts of this network interface (e.g. "eth0","wlan0"),
+        // plus irqCpuOffset (0 = same core as the softirq processing, 1 = the core next to it). Overrides cpu if found
+        std::string irqInterface;
+        int irqCpuOffset=0;
+        // mlockall(MCL_CURRENT | MCL_FUTURE), no page faults on buffers allocated later either
+        bool lockMemory=false;
+        // Touch this much of the thread stack up front, such that a deep call does not page fault on the hot path
+        size_t prefaultStackSize=0;
+    };
+    std::string policyName(int policy);
+    // Parses /proc/interrupts, -1 if there is no interrupt for @param interfaceName
+    int findIrqCpu(const std::string& interfaceName);
+    // Write to each page of @param data, such that the first access on the hot path does not page fault
+    void prefault(void* data,size_t size);
+    /**
+     * Apply @param config to the calling thread (the stack can only be prefaulted from the thread itself)
+     * @return what actually took effect, e.g. "SCHED_FIFO priority 80, cpu 2 (irq of eth0 on cpu 1), memory locked"
+     */
+    std::string apply(const Config& config);
+    // Scheduling, affinity and locked memory of @param thread, e.g. "SCHED_OTHER priority 0 nice 0, cpus 0-3"
+    std::string getThreadReadable(pthread_t thread=pthread_self());
+}
+
+#endif //OPENHDTESTING_LINUXTHREADHELPER_H
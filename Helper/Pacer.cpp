@@ -0,0 +1,111 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#include "Pacer.h"
+#include <thread>
+#include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+// steady_clock is CLOCK_MONOTONIC on linux
+static timespec toTimespec(const std::chrono::steady_clock::time_point& timePoint){
+    const auto ns=std::chrono::duration_cast<std::chrono::nanoseconds>(timePoint.time_since_epoch()).count();
+    timespec ts{};
+    ts.tv_sec=ns/1000000000;
+    ts.tv_nsec=ns%1000000000;
+    return ts;
+}
+
+static void nanosleepUntil(const std::chrono::steady_clock::time_point& deadline){
+    const timespec ts=toTimespec(deadline);
+    // returns EINTR when interrupted by a signal, just continue sleeping in this case
+    while(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,nullptr)==EINTR){}
+}
+
+std::string Pacer::strategyName(const Strategy strategy) {
+    switch(strategy){
+        case Strategy::SLEEP_FOR:return "sleep_for";
+        case Strategy::NANOSLEEP:return "nanosleep";
+        case Strategy::TIMERFD:return "timerfd";
+        case Strategy::HYBRID:return "hybrid";
+        case Strategy::TXTIME:return "txtime";
+    }
+    return "unknown";
+}
+
+Pacer::Pacer(Strategy strategy,std::chrono::nanoseconds spinMargin,std::chrono::nanoseconds txTimeLead):
+mStrategy(strategy),mSpinMargin(spinMargin),mTxTimeLead(txTimeLead){
+    if(mStrategy==Strategy::TIMERFD){
+        mTimerFd=timerfd_create(CLOCK_MONOTONIC,0);
+        if(mTimerFd<0){
+            MLOGE<<"Cannot create timerfd "<<strerror(errno);
+        }
+    }
+}
+
+Pacer::~Pacer() {
+    if(mTimerFd>=0){
+        close(mTimerFd);
+    }
+}
+
+void Pacer::waitUntil(const std::chrono::steady_clock::time_point deadline) {
+    switch(mStrategy){
+        case Strategy::SLEEP_FOR:
+            while(std::chrono::steady_clock::now()<deadline){
+                std::this_thread::sleep_for(std::chrono::microseconds(10));
+            }
+            break;
+        case Strategy::NANOSLEEP:
+            nanosleepUntil(deadline);
+            break;
+        case Strategy::TIMERFD:{
+            if(mTimerFd<0 || std::chrono::steady_clock::now()>=deadline){
+                // timerfd_settime with a deadline in the past fires immediately, but skip the syscalls
+                nanosleepUntil(deadline);
+                break;
+            }
+            itimerspec spec{};
+            spec.it_value=toTimespec(deadline);
+            timerfd_settime(mTimerFd,TFD_TIMER_ABSTIME,&spec,nullptr);
+            uint64_t nExpirations;
+            while(read(mTimerFd,&nExpirations,sizeof(nExpirations))<0 && errno==EINTR){}
+        }
+            break;
+        case Strategy::HYBRID:
+            nanosleepUntil(deadline-mSpinMargin);
+            while(std::chrono::steady_clock::now()<deadline){
+                // busy wait
+            }
+            break;
+        case Strategy::TXTIME:
+            nanosleepUntil(deadline-mTxTimeLead);
+            break;
+    }
+}
+
+AvgCalculator Pacer::calibrate(const Strategy strategy,const std::chrono::nanoseconds interval,const int nSamples) {
+    Pacer pacer{strategy};
+    AvgCalculator wakeupError;
+    auto deadline=std::chrono::steady_clock::now();
+    for(int i=0;i<nSamples;i++){
+        deadline+=interval;
+        pacer.waitUntil(deadline);
+        const auto now=std::chrono::steady_clock::now();
+        // For TXTIME the kernel does the precise part, measure the error of the early wakeup instead
+        const auto wanted=strategy==Strategy::TXTIME ? deadline-pacer.mTxTimeLead : deadline;
+        wakeupError.add(std::max(std::chrono::nanoseconds(0),std::chrono::duration_cast<std::chrono::nanoseconds>(now-wanted)));
+    }
+    return wakeupError;
+}
+
+void Pacer::calibrateAll(const std::chrono::nanoseconds interval,const int nSamples) {
+    for(int i=0;i<N_STRATEGIES;i++){
+        const auto strategy=(Strategy)i;
+        const auto wakeupError=calibrate(strategy,interval,nSamples);
+        MLOGD<<"Wakeup error "<<strategyName(strategy)<<" "<<wakeupError.getAvgReadable();
+    }
+}
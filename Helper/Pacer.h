@@ -0,0 +1,89 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_PACER_H
+#define OPENHDTESTING_PACER_H
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "TimeHelper.hpp"
+
+/**
+ * Waits until a deadline with a selectable strategy. Used to send packets at a constant rate (e.g. one packet every
+ * 500us) without bunching them into bursts. All deadlines are absolute (steady_clock), such that an overshoot of one
+ * wait does not shift all following packets.
+ * Not thread safe, use one instance per sending thread.
+ */
+class Pacer{
+public:
+    enum class Strategy{
+        // the old way: std::this_thread::sleep_for(10us) until the deadline has passed
+        SLEEP_FOR,
+        // clock_nanosleep() with an absolute deadline
+        NANOSLEEP,
+        // timerfd armed with an absolute deadline, then a blocking read()
+        TIMERFD,
+        // clock_nanosleep() until (deadline - spinMargin), then busy wait. Most precise, but uses some CPU
+        HYBRID,
+        // Wake up txTimeLead early and let the kernel release the packet at the deadline (SO_TXTIME, needs the fq qdisc
+        // on the outgoing interface, else the tx time is ignored). Use with UDPSender::mySendToAt()
+        TXTIME
+    };
+    static std::string strategyName(Strategy strategy);
+    static constexpr const int N_STRATEGIES=5;
+    /**
+     * @param spinMargin: HYBRID only, how long before the deadline to stop sleeping and start spinning
+     * @param txTimeLead: TXTIME only, how long before the deadline the caller is woken up to hand the packet to the kernel
+     */
+    explicit Pacer(Strategy strategy,std::chrono::nanoseconds spinMargin=std::chrono::microseconds(100),
+                   std::chrono::nanoseconds txTimeLead=std::chrono::microseconds(500));
+    ~Pacer();
+    Pacer(const Pacer&)=delete;
+    // Returns when the deadline is reached. For TXTIME this returns txTimeLead before the deadline
+    void waitUntil(std::chrono::steady_clock::time_point deadline);
+    Strategy getStrategy()const{
+        return mStrategy;
+    }
+    // Like TestSleep::sleep(), but for each strategy: wait nSamples times for interval and measure how late
+    // the wakeup was compared to the deadline
+    static AvgCalculator calibrate(Strategy strategy,std::chrono::nanoseconds interval,int nSamples=200);
+    // calibrate all strategies and log the wakeup error of each of them
+    static void calibrateAll(std::chrono::nanoseconds interval,int nSamples=200);
+private:
+    const Strategy mStrategy;
+    const std::chrono::nanoseconds mSpinMargin;
+    const std::chrono::nanoseconds mTxTimeLead;
+    int mTimerFd=-1;
+};
+
+/**
+ * Measures how evenly a paced sequence of events (e.g. packets sent) is spaced.
+ * Jitter is the absolute deviation of each interval from the wanted interval.
+ */
+class PacingJitter{
+public:
+    explicit PacingJitter(std::chrono::nanoseconds wantedInterval):mWantedInterval(wantedInterval){}
+    void add(const std::chrono::steady_clock::time_point& timePoint){
+        if(lastTimePoint!=std::chrono::steady_clock::time_point{}){
+            const auto interval=std::chrono::duration_cast<std::chrono::nanoseconds>(timePoint-lastTimePoint);
+            intervals.add(interval);
+            jitter.add(std::chrono::abs(interval-mWantedInterval));
+        }
+        lastTimePoint=timePoint;
+    }
+    std::string getReadable()const{
+        std::stringstream ss;
+        ss<<"interval "<<intervals.getAvgReadable()<<" (wanted "<<MyTimeHelper::R(mWantedInterval)<<")\n";
+        ss<<"jitter "<<jitter.getAvgReadable();
+        return ss.str();
+    }
+private:
+    const std::chrono::nanoseconds mWantedInterval;
+    std::chrono::steady_clock::time_point lastTimePoint{};
+    AvgCalculator intervals;
+    AvgCalculator jitter;
+};
+
+#endif //OPENHDTESTING_PACER_H
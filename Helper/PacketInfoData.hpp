@@ -0,0 +1,104 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_PACKETINFODATA_HPP
+#define OPENHDTESTING_PACKETINFODATA_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <cassert>
+#include <chrono>
+#include <algorithm>
+#include <climits>
+#include "CRC32C.hpp"
+
+// Header written at the beginning of each test packet. It is self contained, e.g. a receiver
+// in another process or on another host can validate a packet without knowing what was sent.
+// Little endian, only plain integers such that the layout is the same on all platforms (x86,arm).
+struct PacketInfoData{
+    // Increment when the layout changes
+    static constexpr uint8_t VERSION=3;
+    uint8_t version;
+    uint8_t reserved;
+    // Allows multiple test streams on the same port, packets of other streams are ignored
+    uint16_t streamId;
+    uint32_t seqNr;
+    // n of bytes following this header
+    uint32_t payloadLength;
+    // CRC32C of the payload (everything after this header)
+    uint32_t payloadCrc32c;
+    // steady_clock of the sender, in ns since its epoch
+    int64_t timestampNs;
+    // 0 when sent, a UDPReflector writes the time the packet spent inside it (not covered by the crc)
+    uint32_t reflectorHoldNs;
+    std::chrono::steady_clock::time_point getTimestamp()const{
+        return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(timestampNs)));
+    }
+    std::chrono::nanoseconds getReflectorHold()const{
+        return std::chrono::nanoseconds(reflectorHoldNs);
+    }
+} __attribute__ ((packed));
+static_assert(sizeof(PacketInfoData)==28);
+
+namespace PacketInfo{
+    enum class Validation{
+        VALID,
+        // smaller than the header or payloadLength does not match the datagram size
+        INVALID_SIZE,
+        INVALID_VERSION,
+        // the payload was corrupted
+        INVALID_CRC
+    };
+    // Write the header into data, the payload (everything after the header) has to be filled already.
+    // The timestamp (steady_clock + @param clockOffset) is taken after the checksum, such that the latency does not
+    // include the time for calculating it. Returns the written timestamp.
+    // A packet released later by the kernel (SO_TXTIME) passes its launch time as @param sendTime instead of now.
+    inline std::chrono::steady_clock::time_point write(uint8_t* data,const size_t size,const uint16_t streamId,const uint32_t seqNr,
+                      const std::chrono::nanoseconds clockOffset=std::chrono::nanoseconds(0),
+                      const std::chrono::steady_clock::time_point sendTime=std::chrono::steady_clock::time_point{}){
+        assert(size>=sizeof(PacketInfoData));
+        PacketInfoData info{};
+        info.version=PacketInfoData::VERSION;
+        info.streamId=streamId;
+        info.seqNr=seqNr;
+        info.payloadLength=size-sizeof(PacketInfoData);
+        info.payloadCrc32c=CRC32C::calculate(&data[sizeof(PacketInfoData)],info.payloadLength);
+        const auto now=sendTime==std::chrono::steady_clock::time_point{} ? std::chrono::steady_clock::now() : sendTime;
+        const auto timestamp=now+std::chrono::duration_cast<std::chrono::steady_clock::duration>(clockOffset);
+        info.timestampNs=std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp.time_since_epoch()).count();
+        memcpy(data,&info,sizeof(PacketInfoData));
+        return timestamp;
+    }
+    // Only the reflector hold time, e.g. by the reflector right before echoing the packet
+    inline void writeReflectorHold(uint8_t* data,const std::chrono::nanoseconds hold){
+        const auto holdNs=(uint32_t)std::min(std::max(hold.count(),(int64_t)0),(int64_t)UINT32_MAX);
+        memcpy(&data[offsetof(PacketInfoData,reflectorHoldNs)],&holdNs,sizeof(holdNs));
+    }
+    // Read the header, data has to be at least sizeof(PacketInfoData)
+    inline PacketInfoData read(const uint8_t* data){
+        PacketInfoData info;
+        memcpy(&info,data,sizeof(PacketInfoData));
+        return info;
+    }
+    // Check size,version and payload checksum of a received packet
+    inline Validation validate(const uint8_t* data,const size_t size){
+        if(size<sizeof(PacketInfoData)){
+            return Validation::INVALID_SIZE;
+        }
+        const auto info=read(data);
+        if(info.version!=PacketInfoData::VERSION){
+            return Validation::INVALID_VERSION;
+        }
+        if(info.payloadLength!=size-sizeof(PacketInfoData)){
+            return Validation::INVALID_SIZE;
+        }
+        if(CRC32C::calculate(&data[sizeof(PacketInfoData)],info.payloadLength)!=info.payloadCrc32c){
+            return Validation::INVALID_CRC;
+        }
+        return Validation::VALID;
+    }
+}
+
+#endif //OPENHDTESTING_PACKETINFODATA_HPP
@@ -0,0 +1,171 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_PACKETTRACE_HPP
+#define OPENHDTESTING_PACKETTRACE_HPP
+
+#include <cstdint>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include "AndroidLogger.hpp"
+
+// Per packet trace of the receiver, stored in a memory mapped file.
+// Writing a record is a plain memory write (no lock, no syscall), the kernel writes the pages back to the file.
+// The record count in the header is updated with each record, such that the trace is usable even if the process crashes.
+
+struct PacketTraceRecord{
+    static constexpr uint32_t FLAG_INVALID_CRC=1;
+    static constexpr uint32_t FLAG_CORRUPTED=2;
+    uint32_t seqNr;
+    uint32_t size;
+    // already converted into the rx clock (steady_clock)
+    int64_t txTimestampNs;
+    int64_t rxTimestampNs;
+    uint32_t flags;
+} __attribute__ ((packed));
+
+struct PacketTraceHeader{
+    static constexpr uint32_t MAGIC=0x4F485452;
+    static constexpr uint32_t VERSION=1;
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t reserved;
+    uint64_t nRecords;
+} __attribute__ ((packed));
+
+class PacketTraceWriter{
+public:
+    // The file is created with space for @param maxRecords, records after that are dropped
+    PacketTraceWriter(const std::string& fileName,const std::size_t maxRecords):maxRecords(maxRecords){
+        fd=open(fileName.c_str(),O_RDWR | O_CREAT | O_TRUNC,0644);
+        if(fd<0){
+            MLOGE<<"Cannot open "<<fileName;
+            return;
+        }
+        mappedSize=sizeof(PacketTraceHeader)+maxRecords*sizeof(PacketTraceRecord);
+        // Allocate the blocks now, a sparse file (ftruncate) would allocate them on the first write to each page.
+        // Not every file system supports fallocate, then we can only resize
+        const int allocateError=posix_fallocate(fd,0,mappedSize);
+        if(allocateError!=0 && ftruncate(fd,mappedSize)!=0){
+            MLOGE<<"Cannot resize "<<fileName<<" "<<strerror(allocateError);
+            return;
+        }
+        void* mapped=mmap(nullptr,mappedSize,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+        if(mapped==MAP_FAILED){
+            MLOGE<<"Cannot mmap "<<fileName;
+            return;
+        }
+        // MAP_POPULATE only maps the pages read only, the first write to each would still fault (page_mkwrite).
+        // Write every page once such that the receive path does not fault. Pages the kernel wrote back in the meantime
+        // can fault once more, the writeback itself happens off the receive thread
+        const long pageSize=sysconf(_SC_PAGESIZE);
+        for(std::size_t offset=0;offset<mappedSize;offset+=pageSize){
+            ((volatile uint8_t*)mapped)[offset]=0;
+        }
+        header=(PacketTraceHeader*)mapped;
+        *header=PacketTraceHeader{PacketTraceHeader::MAGIC,PacketTraceHeader::VERSION,sizeof(PacketTraceRecord),0,0};
+        records=(PacketTraceRecord*)((uint8_t*)mapped+sizeof(PacketTraceHeader));
+    }
+    ~PacketTraceWriter(){
+        if(header!=nullptr){
+            const std::size_t usedSize=sizeof(PacketTraceHeader)+header->nRecords*sizeof(PacketTraceRecord);
+            munmap(header,mappedSize);
+            // Remove the unused space at the end
+            if(ftruncate(fd,usedSize)!=0){
+                MLOGE<<"Cannot shrink trace file";
+            }
+        }
+        if(fd>=0){
+            close(fd);
+        }
+    }
+    PacketTraceWriter(const PacketTraceWriter&)=delete;
+    // Only call from one thread (the receiver thread)
+    void add(const PacketTraceRecord& record){
+        if(header==nullptr)return;
+        if(header->nRecords>=maxRecords){
+            nDroppedRecords++;
+            return;
+        }
+        records[header->nRecords]=record;
+        header->nRecords++;
+    }
+    std::size_t getNRecords()const{
+        return header==nullptr ? 0 : header->nRecords;
+    }
+    std::size_t getNDroppedRecords()const{
+        return nDroppedRecords;
+    }
+private:
+    const std::size_t maxRecords;
+    int fd=-1;
+    std::size_t mappedSize=0;
+    PacketTraceHeader* header=nullptr;
+    PacketTraceRecord* records=nullptr;
+    std::size_t nDroppedRecords=0;
+};
+
+// Read only mapping of a trace written by PacketTraceWriter
+class PacketTraceReader{
+public:
+    explicit PacketTraceReader(const std::string& fileName){
+        const int fd=open(fileName.c_str(),O_RDONLY);
+        if(fd<0){
+            MLOGE<<"Cannot open "<<fileName;
+            return;
+        }
+        struct stat fileStat{};
+        fstat(fd,&fileStat);
+        if((std::size_t)fileStat.st_size<sizeof(PacketTraceHeader)){
+            MLOGE<<"Invalid trace "<<fileName;
+            close(fd);
+            return;
+        }
+        mappedSize=fileStat.st_size;
+        void* mapped=mmap(nullptr,mappedSize,PROT_READ,MAP_PRIVATE,fd,0);
+        close(fd);
+        if(mapped==MAP_FAILED){
+            MLOGE<<"Cannot mmap "<<fileName;
+            return;
+        }
+        header=(const PacketTraceHeader*)mapped;
+        if(header->magic!=PacketTraceHeader::MAGIC || header->version!=PacketTraceHeader::VERSION || header->recordSize!=sizeof(PacketTraceRecord) ||
+           sizeof(PacketTraceHeader)+header->nRecords*sizeof(PacketTraceRecord)>mappedSize){
+            MLOGE<<"Invalid trace "<<fileName;
+            munmap(mapped,mappedSize);
+            header=nullptr;
+            return;
+        }
+        // We read the whole trace once from begin to end
+        madvise(mapped,mappedSize,MADV_SEQUENTIAL);
+    }
+    ~PacketTraceReader(){
+        if(header!=nullptr){
+            munmap((void*)header,mappedSize);
+        }
+    }
+    PacketTraceReader(const PacketTraceReader&)=delete;
+    bool isValid()const{
+        return header!=nullptr;
+    }
+    std::size_t size()const{
+        return header==nullptr ? 0 : header->nRecords;
+    }
+    const PacketTraceRecord* begin()const{
+        return header==nullptr ? nullptr : (const PacketTraceRecord*)((const uint8_t*)header+sizeof(PacketTraceHeader));
+    }
+    const PacketTraceRecord* end()const{
+        return begin()+size();
+    }
+private:
+    std::size_t mappedSize=0;
+    const PacketTraceHeader* header=nullptr;
+};
+
+#endif //OPENHDTESTING_PACKETTRACE_HPP
@@ -0,0 +1,187 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#include "ReceiverGroup.h"
+#include "SocketHelper.hpp"
+#include <linux/filter.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <sstream>
+#include <mutex>
+
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+std::string ReceiverGroup::steeringName(const Steering steering){
+    switch(steering){
+        case Steering::HASH:return "hash";
+        case Steering::INCOMING_CPU:return "incoming cpu";
+        case Steering::CPU_BPF:return "cpu bpf";
+    }
+    return "";
+}
+
+ReceiverGroup::ReceiverGroup(int port,DATA_CALLBACK onDataReceived,Config config):
+mPort(port),onDataReceived(std::move(onDataReceived)),mConfig(std::move(config)){}
+
+ReceiverGroup::~ReceiverGroup() {
+    stopReceiving();
+}
+
+bool ReceiverGroup::setupSteering() {
+    const int nCpus=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(mConfig.steering==Steering::INCOMING_CPU){
+        for(int i=0;i<mConfig.nWorkers;i++){
+            const int cpu=mConfig.firstCpu<0 ? i : (mConfig.firstCpu+i)%nCpus;
+            if(setsockopt(workers[i]->socket,SOL_SOCKET,SO_INCOMING_CPU,&cpu,sizeof(cpu))!=0){
+                MLOGE<<"Cannot set SO_INCOMING_CPU "<<strerror(errno);
+                return false;
+            }
+        }
+    }else if(mConfig.steering==Steering::CPU_BPF){
+        // A = cpu that processes the packet, return ((A - firstCpu) mod nCpus) % nWorkers = index of the socket in the group
+        // (bind order), which is the worker pinned to that cpu. The + nCpus keeps the unsigned subtraction from wrapping
+        const uint32_t firstCpu=mConfig.firstCpu<0 ? 0 : (uint32_t)(mConfig.firstCpu%nCpus);
+        sock_filter code[]={
+            {BPF_LD | BPF_W | BPF_ABS,0,0,(uint32_t)(SKF_AD_OFF+SKF_AD_CPU)},
+            {BPF_ALU | BPF_ADD | BPF_K,0,0,(uint32_t)nCpus-firstCpu},
+            {BPF_ALU | BPF_MOD | BPF_K,0,0,(uint32_t)nCpus},
+            {BPF_ALU | BPF_MOD | BPF_K,0,0,(uint32_t)mConfig.nWorkers},
+            {BPF_RET | BPF_A,0,0,0},
+        };
+        sock_fprog program{};
+        program.len=sizeof(code)/sizeof(code[0]);
+        program.filter=code;
+        // Attached to one socket, applies to the whole group
+        if(setsockopt(workers[0]->socket,SOL_SOCKET,SO_ATTACH_REUSEPORT_CBPF,&program,sizeof(program))!=0){
+            MLOGE<<"Cannot attach reuseport bpf "<<strerror(errno);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ReceiverGroup::startReceiving() {
+    // The workers of the running group are still joinable
+    if(receiving){
+        MLOGE<<"ReceiverGroup is already receiving";
+        return false;
+    }
+    workers.clear();
+    // All sockets are bound before the first worker starts, such that the group is complete before packets arrive
+    for(int i=0;i<mConfig.nWorkers;i++){
+        auto worker=std::make_unique<Worker>();
+        worker->socket=SocketHelper::openUdpReceiveSocket(mPort,mConfig.wantedRcvBufSize,true);
+        if(worker->socket==-1){
+            for(const auto& opened:workers){
+                close(opened->socket);
+            }
+            workers.clear();
+            return false;
+        }
+        workers.push_back(std::move(worker));
+    }
+    if(!setupSteering()){
+        for(const auto& worker:workers){
+            close(worker->socket);
+        }
+        workers.clear();
+        return false;
+    }
+    receiving=true;
+    for(int i=0;i<mConfig.nWorkers;i++){
+        workers[i]->thread=std::make_unique<std::thread>([this,i]{receiveLoop(i);});
+    }
+    return true;
+}
+
+void ReceiverGroup::stopReceiving() {
+    if(!receiving)return;
+    receiving=false;
+    for(const auto& worker:workers){
+        //this stops the recvmmsg even if in blocking mode
+        shutdown(worker->socket,SHUT_RD);
+    }
+    for(const auto& worker:workers){
+        worker->thread->join();
+        worker->thread.reset();
+        close(worker->socket);
+    }
+}
+
+void ReceiverGroup::receiveLoop(const int workerIndex) {
+    Worker& worker=*workers[workerIndex];
+    LinuxThreadHelper::Config threadConfig=mConfig.threadConfig;
+    if(mConfig.firstCpu>=0){
+        threadConfig.cpu=(mConfig.firstCpu+workerIndex)%(int)sysconf(_SC_NPROCESSORS_ONLN);
+        threadConfig.irqInterface.clear();
+    }
+    const auto readable=LinuxThreadHelper::apply(threadConfig);
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        worker.threadConfigReadable=readable;
+    }
+    const size_t maxBatchSize=mConfig.maxBatchSize;
+    const size_t maxDatagramSize=mConfig.maxDatagramSize;
+    std::vector<uint8_t> slots(maxBatchSize*maxDatagramSize);
+    std::vector<mmsghdr> msgs(maxBatchSize);
+    std::vector<iovec> iovecs(maxBatchSize);
+    for(size_t i=0;i<maxBatchSize;i++){
+        iovecs[i]={&slots[i*maxDatagramSize],maxDatagramSize};
+    }
+    while(receiving){
+        for(size_t i=0;i<maxBatchSize;i++){
+            memset(&msgs[i].msg_hdr,0,sizeof(msghdr));
+            msgs[i].msg_hdr.msg_iov=&iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen=1;
+        }
+        const int nMessages=recvmmsg(worker.socket,msgs.data(),maxBatchSize,MSG_WAITFORONE,nullptr);
+        // After shutdown() recvmmsg returns a single empty message
+        if(nMessages<=0 || msgs[0].msg_len==0){
+            continue;
+        }
+        uint64_t nBytes=0;
+        for(int i=0;i<nMessages;i++){
+            onDataReceived(workerIndex,(const uint8_t*)iovecs[i].iov_base,msgs[i].msg_len);
+            nBytes+=msgs[i].msg_len;
+        }
+        worker.nPackets.fetch_add(nMessages,std::memory_order_relaxed);
+        worker.nBytes.fetch_add(nBytes,std::memory_order_relaxed);
+        worker.nRecvmmsgCalls.fetch_add(1,std::memory_order_relaxed);
+    }
+}
+
+ReceiverGroup::WorkerStats ReceiverGroup::getWorkerStats(const int workerIndex) const {
+    const Worker& worker=*workers[workerIndex];
+    return {worker.nPackets.load(),worker.nBytes.load(),worker.nRecvmmsgCalls.load()};
+}
+
+std::string ReceiverGroup::getStatsReadable() const {
+    uint64_t nTotal=0;
+    for(int i=0;i<(int)workers.size();i++){
+        nTotal+=getWorkerStats(i).nPackets;
+    }
+    std::stringstream ss;
+    for(int i=0;i<(int)workers.size();i++){
+        const auto stats=getWorkerStats(i);
+        std::string threadConfigReadable;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            threadConfigReadable=workers[i]->threadConfigReadable;
+        }
+        ss<<"worker "<<i<<" ("<<threadConfigReadable<<") packets "<<stats.nPackets<<" ("
+        <<(nTotal==0 ? 0 : 100*stats.nPackets/nTotal)<<"%) avg batch "
+        <<(stats.nRecvmmsgCalls==0 ? 0.0 : (double)stats.nPackets/stats.nRecvmmsgCalls)<<"\n";
+    }
+    return ss.str();
+}
+
+const ReceiverGroup::Config& ReceiverGroup::getConfig() const {
+    return mConfig;
+}
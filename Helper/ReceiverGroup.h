@@ -0,0 +1,80 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_RECEIVERGROUP_H
+#define OPENHDTESTING_RECEIVERGROUP_H
+
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <string>
+#include "LinuxThreadHelper.h"
+#include "TimeHelper.hpp"
+
+/**
+ * Multi core receive: nWorkers SO_REUSEPORT sockets on the same port, each drained (recvmmsg) by its own worker thread
+ * pinned to its own core. The kernel distributes the datagrams between the sockets, such that the receive throughput
+ * is no longer limited by what one core can do.
+ * Steering:
+ * HASH: kernel default, by 4 tuple hash. All datagrams of one sender (ip + port) end up at the same worker
+ * INCOMING_CPU: SO_INCOMING_CPU, prefer the socket of the worker on the core that processed the packet in the kernel
+ * (with RSS / RPS spreading the flows over the cores this keeps each packet on one core)
+ * CPU_BPF: a classic BPF reuseport program selects the socket of the worker pinned to the cpu ((cpu-firstCpu) % nWorkers),
+ * same idea without relying on the heuristic
+ */
+class ReceiverGroup{
+public:
+    enum class Steering{HASH,INCOMING_CPU,CPU_BPF};
+    static std::string steeringName(Steering steering);
+    // Called on the worker thread, @param workerIndex can be used for per worker (lock free) state
+    typedef std::function<void(int workerIndex,const uint8_t[],size_t)> DATA_CALLBACK;
+    struct Config{
+        int nWorkers=4;
+        // worker i is pinned to core (firstCpu+i) % n of cores, -1 to not pin
+        int firstCpu=0;
+        Steering steering=Steering::HASH;
+        size_t maxBatchSize=32;
+        size_t maxDatagramSize=65507;
+        size_t wantedRcvBufSize=0;
+        // policy / priority / mlock for all workers, the cpu of each worker is set from firstCpu
+        LinuxThreadHelper::Config threadConfig;
+    };
+    ReceiverGroup(int port,DATA_CALLBACK onDataReceived,Config config);
+    ~ReceiverGroup();
+    // false if the sockets cannot be opened, the steering cannot be set up or the group is already receiving
+    bool startReceiving();
+    void stopReceiving();
+    struct WorkerStats{
+        uint64_t nPackets;
+        uint64_t nBytes;
+        uint64_t nRecvmmsgCalls;
+    };
+    WorkerStats getWorkerStats(int workerIndex)const;
+    // One line per worker, e.g. "worker 0 (SCHED_OTHER priority 0 nice 0, cpus 0) packets 1000 (25%) avg batch 1.2"
+    std::string getStatsReadable()const;
+    const Config& getConfig()const;
+private:
+    struct Worker{
+        int socket=-1;
+        std::unique_ptr<std::thread> thread;
+        std::atomic<uint64_t> nPackets{0};
+        std::atomic<uint64_t> nBytes{0};
+        std::atomic<uint64_t> nRecvmmsgCalls{0};
+        std::string threadConfigReadable;
+    };
+    bool setupSteering();
+    void receiveLoop(int workerIndex);
+    const int mPort;
+    const DATA_CALLBACK onDataReceived;
+    const Config mConfig;
+    std::atomic<bool> receiving=false;
+    std::vector<std::unique_ptr<Worker>> workers;
+    // the workers write their threadConfigReadable after start
+    mutable std::mutex mMutex;
+};
+
+#endif //OPENHDTESTING_RECEIVERGROUP_H
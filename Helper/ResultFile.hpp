@@ -0,0 +1,108 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_RESULTFILE_HPP
+#define OPENHDTESTING_RESULTFILE_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "AndroidLogger.hpp"
+
+// Compact binary result files written by the tx-only and rx-only roles of the test (one fixed size record per packet).
+// Both files are joined by sequence number afterwards, such that tx and rx can run in different processes / on
+// different hosts without sharing any state during the test.
+
+// Written by the tx role, one per sent packet
+struct TxRecord{
+    uint32_t seqNr;
+    uint32_t size;
+    // steady_clock of the tx side (same clock that is written into PacketInfoData)
+    int64_t txTimestampNs;
+} __attribute__ ((packed));
+
+// Written by the rx role, one per received packet (duplicates included)
+struct RxRecord{
+    static constexpr uint32_t FLAG_INVALID_CRC=1;
+    // Clock sync was enabled but had no estimate yet when the packet arrived, clockOffsetNs is meaningless
+    static constexpr uint32_t FLAG_NO_CLOCK_ESTIMATE=2;
+    uint32_t seqNr;
+    uint32_t size;
+    // tx timestamp from the packet header (tx clock)
+    int64_t txTimestampNs;
+    // steady_clock of the rx side when the packet arrived in the receive callback
+    int64_t rxTimestampNs;
+    // estimated (tx clock - rx clock) at rxTimestamp, 0 without clock sync
+    int64_t clockOffsetNs;
+    uint32_t flags;
+} __attribute__ ((packed));
+
+struct ResultFileHeader{
+    static constexpr uint32_t MAGIC=0x4F484454;
+    static constexpr uint32_t VERSION=1;
+    uint32_t magic;
+    uint32_t version;
+    // sizeof(TxRecord) or sizeof(RxRecord)
+    uint32_t recordSize;
+    uint32_t reserved;
+} __attribute__ ((packed));
+
+// Appends records to a file, buffered by stdio such that add() does not make a syscall per packet
+template<typename T>
+class ResultFileWriter{
+public:
+    explicit ResultFileWriter(const std::string& fileName){
+        file=fopen(fileName.c_str(),"wb");
+        if(file==nullptr){
+            MLOGE<<"Cannot open "<<fileName;
+            return;
+        }
+        setvbuf(file,nullptr,_IOFBF,1024*1024);
+        const ResultFileHeader header{ResultFileHeader::MAGIC,ResultFileHeader::VERSION,sizeof(T),0};
+        fwrite(&header,sizeof(header),1,file);
+    }
+    ~ResultFileWriter(){
+        if(file!=nullptr){
+            fclose(file);
+        }
+    }
+    ResultFileWriter(const ResultFileWriter&)=delete;
+    void add(const T& record){
+        if(file==nullptr)return;
+        fwrite(&record,sizeof(T),1,file);
+        nRecords++;
+    }
+    std::size_t getNRecords()const{
+        return nRecords;
+    }
+private:
+    FILE* file=nullptr;
+    std::size_t nRecords=0;
+};
+
+// Reads all records of a file written by ResultFileWriter<T>. Returns false if the file does not exist or has the wrong format
+template<typename T>
+static bool readResultFile(const std::string& fileName,std::vector<T>& records){
+    FILE* file=fopen(fileName.c_str(),"rb");
+    if(file==nullptr){
+        MLOGE<<"Cannot open "<<fileName;
+        return false;
+    }
+    ResultFileHeader header{};
+    if(fread(&header,sizeof(header),1,file)!=1 || header.magic!=ResultFileHeader::MAGIC ||
+       header.version!=ResultFileHeader::VERSION || header.recordSize!=sizeof(T)){
+        MLOGE<<"Invalid result file "<<fileName;
+        fclose(file);
+        return false;
+    }
+    T record;
+    while(fread(&record,sizeof(T),1,file)==1){
+        records.push_back(record);
+    }
+    fclose(file);
+    return true;
+}
+
+#endif //OPENHDTESTING_RESULTFILE_HPP
@@ -0,0 +1,153 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_SEQUENCETRACKER_HPP
+#define OPENHDTESTING_SEQUENCETRACKER_HPP
+
+#include <cstdint>
+#include <array>
+#include <sstream>
+#include <string>
+#include <algorithm>
+
+// Classifies received sequence numbers as in order, reordered (late, with the distance to the highest sequence number),
+// duplicate or lost. Keeps a bitmap of the last WINDOW_SIZE sequence numbers, a sequence number is only counted as lost
+// once it leaves the window without being received. Consecutive lost sequence numbers are one loss burst.
+// Fixed memory, O(1) per packet (amortized over the skipped sequence numbers). Handles wrap around of the uint32_t.
+class SequenceTracker{
+public:
+    static constexpr uint32_t WINDOW_SIZE=1024;
+    // Bursts longer than this are counted in the last bucket of the burst histogram
+    static constexpr uint32_t MAX_BURST_LENGTH=64;
+    enum class Result{IN_ORDER,AFTER_GAP,REORDERED,DUPLICATE,TOO_LATE};
+    Result add(const uint32_t seqNr){
+        nReceived++;
+        if(!anyReceived){
+            anyReceived=true;
+            firstSeqNr=seqNr;
+            highestSeqNr=seqNr;
+            setBit(seqNr);
+            return Result::IN_ORDER;
+        }
+        const int32_t delta=(int32_t)(seqNr-highestSeqNr);
+        if(delta>0){
+            // Every sequence number we skip reuses a slot of the window, the old one in that slot is final
+            const uint32_t nAdvance=(uint32_t)delta;
+            const uint32_t nEvict=std::min(nAdvance,WINDOW_SIZE);
+            for(uint32_t i=1;i<=nEvict;i++){
+                evict(highestSeqNr+i);
+            }
+            // Sequence numbers that were never inside the window are lost, too
+            if(nAdvance>WINDOW_SIZE){
+                const uint32_t nNeverInWindow=nAdvance-WINDOW_SIZE;
+                nLost+=nNeverInWindow;
+                currentBurst+=nNeverInWindow;
+            }
+            nSkipped+=nAdvance-1;
+            highestSeqNr=seqNr;
+            setBit(seqNr);
+            return nAdvance==1 ? Result::IN_ORDER : Result::AFTER_GAP;
+        }
+        const uint32_t distance=(uint32_t)(-delta);
+        if(distance>=WINDOW_SIZE || (int32_t)(seqNr-firstSeqNr)<0){
+            // Already counted as lost (or from before the first packet), we cannot tell if it is a duplicate
+            nTooLate++;
+            return Result::TOO_LATE;
+        }
+        if(getBit(seqNr)){
+            nDuplicates++;
+            return Result::DUPLICATE;
+        }
+        setBit(seqNr);
+        nReordered++;
+        sumReorderDistance+=distance;
+        maxReorderDistance=std::max(maxReorderDistance,distance);
+        return Result::REORDERED;
+    }
+    // Count the sequence numbers that are still missing in the window as lost, call once all packets were received
+    void finish(){
+        if(!anyReceived)return;
+        for(uint32_t i=1;i<=WINDOW_SIZE;i++){
+            evict(highestSeqNr+i);
+        }
+        endBurst();
+        firstSeqNr=highestSeqNr+1;
+    }
+    void reset(){
+        *this=SequenceTracker();
+    }
+    uint64_t getNReceived()const{return nReceived;}
+    // Only final losses, see finish()
+    uint64_t getNLost()const{return nLost;}
+    uint64_t getNReordered()const{return nReordered;}
+    uint64_t getNDuplicates()const{return nDuplicates;}
+    uint64_t getNTooLate()const{return nTooLate;}
+    // Sequence numbers that were skipped when a packet arrived (lost or reordered), not delayed by the window
+    uint64_t getNSkipped()const{return nSkipped;}
+    uint32_t getMaxReorderDistance()const{return maxReorderDistance;}
+    // Index n holds the n of bursts with length n, the last index all bursts of MAX_BURST_LENGTH or more
+    const std::array<uint64_t,MAX_BURST_LENGTH+1>& getBurstHistogram()const{
+        return burstHistogram;
+    }
+    uint32_t getLongestBurst()const{return longestBurst;}
+    std::string getReadable()const{
+        std::stringstream ss;
+        ss<<"received "<<nReceived<<" lost "<<nLost<<" reordered "<<nReordered<<" (max distance "<<maxReorderDistance
+        <<" avg "<<(nReordered==0 ? 0 : (double)sumReorderDistance/nReordered)<<") duplicates "<<nDuplicates<<" too late "<<nTooLate;
+        return ss.str();
+    }
+    // length:count for each burst length that occurred
+    std::string getBurstHistogramReadable()const{
+        std::stringstream ss;
+        ss<<"Loss bursts (length:count) ";
+        for(uint32_t length=1;length<=MAX_BURST_LENGTH;length++){
+            if(burstHistogram[length]==0)continue;
+            ss<<length<<(length==MAX_BURST_LENGTH ? "+" : "")<<":"<<burstHistogram[length]<<" ";
+        }
+        ss<<"longest "<<longestBurst;
+        return ss.str();
+    }
+private:
+    std::array<uint64_t,WINDOW_SIZE/64> window{};
+    bool anyReceived=false;
+    uint32_t firstSeqNr=0;
+    uint32_t highestSeqNr=0;
+    uint64_t nReceived=0,nLost=0,nReordered=0,nDuplicates=0,nTooLate=0,nSkipped=0;
+    uint64_t sumReorderDistance=0;
+    uint32_t maxReorderDistance=0;
+    uint32_t currentBurst=0;
+    uint32_t longestBurst=0;
+    std::array<uint64_t,MAX_BURST_LENGTH+1> burstHistogram{};
+    bool getBit(const uint32_t seqNr)const{
+        const uint32_t slot=seqNr%WINDOW_SIZE;
+        return (window[slot/64]>>(slot%64)) & 1;
+    }
+    void setBit(const uint32_t seqNr){
+        const uint32_t slot=seqNr%WINDOW_SIZE;
+        window[slot/64]|=(uint64_t)1<<(slot%64);
+    }
+    // @param newSeqNr takes over the slot of newSeqNr-WINDOW_SIZE, which leaves the window
+    void evict(const uint32_t newSeqNr){
+        const uint32_t oldSeqNr=newSeqNr-WINDOW_SIZE;
+        // Slots before the first packet were never part of the stream
+        if((int32_t)(oldSeqNr-firstSeqNr)>=0){
+            if(getBit(oldSeqNr)){
+                endBurst();
+            }else{
+                nLost++;
+                currentBurst++;
+            }
+        }
+        const uint32_t slot=newSeqNr%WINDOW_SIZE;
+        window[slot/64]&=~((uint64_t)1<<(slot%64));
+    }
+    void endBurst(){
+        if(currentBurst==0)return;
+        burstHistogram[std::min(currentBurst,MAX_BURST_LENGTH)]++;
+        longestBurst=std::max(longestBurst,currentBurst);
+        currentBurst=0;
+    }
+};
+
+#endif //OPENHDTESTING_SEQUENCETRACKER_HPP
@@ -0,0 +1,77 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_SOCKETHELPER_HPP
+#define OPENHDTESTING_SOCKETHELPER_HPP
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <cstring>
+#include <cerrno>
+#include "TimeHelper.hpp"
+
+// Small helpers for the socket options / control messages shared by UDPReceiver,UDPSender and UDPReflector
+namespace SocketHelper{
+    // Enable SO_TIMESTAMPING software receive timestamps on @param sockfd
+    inline bool enableKernelRxTimestamps(int sockfd){
+        const int flags=SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        if(setsockopt(sockfd,SOL_SOCKET,SO_TIMESTAMPING,&flags,sizeof(flags))<0){
+            MLOGE<<"Cannot enable kernel timestamps "<<strerror(errno);
+            return false;
+        }
+        return true;
+    }
+    // Returns the software receive timestamp the kernel attached to this message (SO_TIMESTAMPING) as steady_clock time point.
+    // If there is none, the current time is returned instead
+    inline std::chrono::steady_clock::time_point getKernelRxTimestamp(msghdr& hdr){
+        for(cmsghdr* cm=CMSG_FIRSTHDR(&hdr);cm!=nullptr;cm=CMSG_NXTHDR(&hdr,cm)){
+            if(cm->cmsg_level==SOL_SOCKET && cm->cmsg_type==SCM_TIMESTAMPING){
+                scm_timestamping ts{};
+                memcpy(&ts,CMSG_DATA(cm),sizeof(ts));
+                return MyTimeHelper::realtimeToSteady(ts.ts[0]);
+            }
+        }
+        return std::chrono::steady_clock::now();
+    }
+    // UDP socket bound to INADDR_ANY:@param port, the receive buffer is increased to @param wantedRcvBufSize if that
+    // is bigger than the default (0 leaves it untouched). With @param reusePort (SO_REUSEPORT instead of SO_REUSEADDR)
+    // several sockets can bind the same port and the kernel load balances between them. Returns -1 on error
+    inline int openUdpReceiveSocket(const int port,const size_t wantedRcvBufSize=0,const bool reusePort=false){
+        const int sockfd=socket(AF_INET,SOCK_DGRAM,IPPROTO_UDP);
+        if(sockfd==-1){
+            MLOGE<<"Error creating socket "<<strerror(errno);
+            return -1;
+        }
+        const int enable=1;
+        if(setsockopt(sockfd,SOL_SOCKET,reusePort ? SO_REUSEPORT : SO_REUSEADDR,&enable,sizeof(enable))<0){
+            MLOGE<<"Error setting reuse "<<strerror(errno);
+        }
+        int recvBufferSize=0;
+        socklen_t len=sizeof(recvBufferSize);
+        getsockopt(sockfd,SOL_SOCKET,SO_RCVBUF,&recvBufferSize,&len);
+        if(wantedRcvBufSize>(size_t)recvBufferSize){
+            const int wanted=(int)wantedRcvBufSize;
+            if(setsockopt(sockfd,SOL_SOCKET,SO_RCVBUF,&wanted,sizeof(wanted))<0){
+                MLOGE<<"Cannot increase buffer size to "<<wantedRcvBufSize;
+            }
+        }
+        sockaddr_in myaddr{};
+        myaddr.sin_family=AF_INET;
+        myaddr.sin_addr.s_addr=htonl(INADDR_ANY);
+        myaddr.sin_port=htons(port);
+        if(bind(sockfd,(sockaddr*)&myaddr,sizeof(myaddr))==-1){
+            MLOGE<<"Error binding Port; "<<port<<" "<<strerror(errno);
+            close(sockfd);
+            return -1;
+        }
+        return sockfd;
+    }
+    // Large enough for the SCM_TIMESTAMPING control message
+    static constexpr const size_t CONTROL_BUFFER_SIZE=128;
+}
+
+#endif //OPENHDTESTING_SOCKETHELPER_HPP
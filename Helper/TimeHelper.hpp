@@ -10,6 +10,9 @@
 #include <chrono>
 #include <deque>
 #include <algorithm>
+#include <ctime>
+#include <array>
+#include <cmath>
 
 // This file holds various classes/namespaces usefully for measuring and comparing
 // latency samples
@@ -40,6 +43,15 @@ namespace MyTimeHelper{
     }
     static std::string ReadableNS(uint64_t nanoseconds){
         return R(std::chrono::nanoseconds(nanoseconds));
+    }
+    // Kernel timestamps (e.g. SO_TIMESTAMPING) use CLOCK_REALTIME, convert them to steady_clock such that
+    // they can be compared to the other time points. Only valid for timestamps that are not too old (clock adjustments)
+    inline std::chrono::steady_clock::time_point realtimeToSteady(const timespec& ts){
+        const auto nowSteady=std::chrono::steady_clock::now();
+        const auto nowSystem=std::chrono::system_clock::now();
+        const auto realtime=std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::seconds(ts.tv_sec)+std::chrono::nanoseconds(ts.tv_nsec)));
+        return nowSteady-std::chrono::duration_cast<std::chrono::steady_clock::duration>(nowSystem-realtime);
     }
 	static std::string timeSamplesAsString(const std::vector<std::chrono::nanoseconds>& samples){
 		std::stringstream ss;
@@ -272,6 +284,267 @@ public:
 };
 
 
+// Same interface as AvgCalculator2, but for live statistics (e.g. the OSD) that are queried per packet / per frame:
+// add() and all get methods are amortized O(1). Keeps a running sum and two monotonic queues for min and max
+// instead of scanning all samples on each call.
+// The window is either the last n samples or all samples that are not older than a given duration (e.g. 500ms).
+// All memory is allocated in the constructor, add() never allocates. A time based window holds at most maxSamples,
+// with more samples in the window the oldest ones are dropped early.
+class WindowedAvgCalculator{
+private:
+    // Fixed capacity FIFO that can also be popped at the back (for the monotonic queues)
+    template<class T>
+    class FixedRing{
+    public:
+        explicit FixedRing(const size_t capacity):data(capacity){}
+        bool empty()const{return count==0;}
+        bool full()const{return count==data.size();}
+        size_t size()const{return count;}
+        const T& front()const{return data[head];}
+        const T& back()const{return data[(head+count-1)%data.size()];}
+        void push_back(const T& value){
+            assert(!full());
+            data[(head+count)%data.size()]=value;
+            count++;
+        }
+        void pop_front(){head=(head+1)%data.size();count--;}
+        void pop_back(){count--;}
+        void clear(){head=0;count=0;}
+    private:
+        std::vector<T> data;
+        size_t head=0;
+        size_t count=0;
+    };
+    struct Sample{
+        std::chrono::nanoseconds value;
+        std::chrono::steady_clock::time_point timePoint;
+    };
+    struct Extreme{
+        std::chrono::nanoseconds value;
+        uint64_t index;
+    };
+    // 0 for time based window
+    const size_t sampleSize;
+    const std::chrono::steady_clock::duration windowDuration;
+    // mutable since samples that fall out of a time based window are removed lazily, also on get calls
+    mutable FixedRing<Sample> samples;
+    // front is the min / max of the window
+    mutable FixedRing<Extreme> minQueue;
+    mutable FixedRing<Extreme> maxQueue;
+    mutable std::chrono::nanoseconds sum{0};
+    // index of samples.front()
+    mutable uint64_t oldestIndex=0;
+    void removeOldest()const{
+        sum-=samples.front().value;
+        if(minQueue.front().index==oldestIndex)minQueue.pop_front();
+        if(maxQueue.front().index==oldestIndex)maxQueue.pop_front();
+        samples.pop_front();
+        oldestIndex++;
+    }
+    void removeOutdated(const std::chrono::steady_clock::time_point& now)const{
+        if(sampleSize!=0)return;
+        while(!samples.empty() && now-samples.front().timePoint>windowDuration){
+            removeOldest();
+        }
+    }
+public:
+    // Window of the last @param sampleSize samples
+    explicit WindowedAvgCalculator(size_t sampleSize=60):sampleSize(sampleSize),windowDuration(0),
+    samples(sampleSize),minQueue(sampleSize),maxQueue(sampleSize){
+        assert(sampleSize>0);
+    }
+    // Window of all samples added within the last @param windowDuration, but at most @param maxSamples
+    explicit WindowedAvgCalculator(std::chrono::steady_clock::duration windowDuration,size_t maxSamples=4096):sampleSize(0),
+    windowDuration(windowDuration),samples(maxSamples),minQueue(maxSamples),maxQueue(maxSamples){
+        assert(maxSamples>0);
+    }
+    void add(const std::chrono::nanoseconds& value,const std::chrono::steady_clock::time_point& now=std::chrono::steady_clock::now()){
+        if(value<std::chrono::nanoseconds(0)){
+            MLOGE<<"Cannot add negative value";
+            return;
+        }
+        removeOutdated(now);
+        if(samples.full()){
+            removeOldest();
+        }
+        const uint64_t index=oldestIndex+samples.size();
+        samples.push_back({value,now});
+        sum+=value;
+        while(!minQueue.empty() && minQueue.back().value>=value)minQueue.pop_back();
+        minQueue.push_back({value,index});
+        while(!maxQueue.empty() && maxQueue.back().value<=value)maxQueue.pop_back();
+        maxQueue.push_back({value,index});
+    }
+    // For a time based window all get methods only see the samples that are not older than windowDuration at @param now
+    std::chrono::nanoseconds getAvg(const std::chrono::steady_clock::time_point& now=std::chrono::steady_clock::now())const{
+        removeOutdated(now);
+        if(samples.empty()){
+            return std::chrono::nanoseconds(0);
+        }
+        return sum / samples.size();
+    }
+    std::chrono::nanoseconds getMin(const std::chrono::steady_clock::time_point& now=std::chrono::steady_clock::now())const{
+        removeOutdated(now);
+        if(minQueue.empty())return std::chrono::nanoseconds(0);
+        return minQueue.front().value;
+    }
+    std::chrono::nanoseconds getMax(const std::chrono::steady_clock::time_point& now=std::chrono::steady_clock::now())const{
+        removeOutdated(now);
+        if(maxQueue.empty())return std::chrono::nanoseconds(0);
+        return maxQueue.front().value;
+    }
+    void reset(){
+        samples.clear();
+        minQueue.clear();
+        maxQueue.clear();
+        sum=std::chrono::nanoseconds(0);
+        oldestIndex=0;
+    }
+    size_t getNSamples(const std::chrono::steady_clock::time_point& now=std::chrono::steady_clock::now())const{
+        removeOutdated(now);
+        return samples.size();
+    }
+    std::string getAvgReadable(const bool averageOnly=false)const{
+        const auto now=std::chrono::steady_clock::now();
+        std::stringstream ss;
+        if(averageOnly){
+            ss<<"avg="<<MyTimeHelper::R(getAvg(now));
+            return ss.str();
+        }
+        ss<<"min="<<MyTimeHelper::R(getMin(now))<<" max="<<MyTimeHelper::R(getMax(now))<<" avg="<<MyTimeHelper::R(getAvg(now))<<" N samples="<<getNSamples(now);
+        return ss.str();
+    }
+};
+
+// Fixed memory latency histogram with logarithmic buckets (like HdrHistogram).
+// Unlike AvgCalculator2 no samples are stored, add() is O(1) and the memory usage does not depend on
+// the n of samples. Percentiles are accurate to 1/SUB_BUCKET_COUNT (<1%) of the value.
+// Values from 0 to 2^SUB_BUCKET_BITS ns are stored exactly, after that each power of two range
+// is split into SUB_BUCKET_COUNT buckets. Two histograms can be merged without loosing precision.
+class LatencyHistogram{
+private:
+    static constexpr int SUB_BUCKET_BITS=7;
+    static constexpr uint64_t SUB_BUCKET_COUNT=uint64_t(1)<<SUB_BUCKET_BITS;
+    // Values up to 2^MAX_VALUE_BITS ns (~73 minutes), bigger values end up in the last bucket
+    static constexpr int MAX_VALUE_BITS=42;
+    static constexpr std::size_t N_BUCKETS=(MAX_VALUE_BITS-SUB_BUCKET_BITS+1)*SUB_BUCKET_COUNT;
+    std::array<uint64_t,N_BUCKETS> buckets{};
+    uint64_t nSamples=0;
+    // sum,min and max are exact
+    std::chrono::nanoseconds sum{0};
+    std::chrono::nanoseconds min=std::chrono::nanoseconds::max();
+    std::chrono::nanoseconds max{0};
+    static std::size_t bucketIndex(uint64_t value){
+        if(value<SUB_BUCKET_COUNT){
+            return value;
+        }
+        const int msb=63-__builtin_clzll(value);
+        if(msb>=MAX_VALUE_BITS){
+            return N_BUCKETS-1;
+        }
+        const int shift=msb-SUB_BUCKET_BITS;
+        const uint64_t subBucket=(value>>shift)-SUB_BUCKET_COUNT;
+        return (shift+1)*SUB_BUCKET_COUNT+subBucket;
+    }
+    // Returns the highest value that ends up in the same bucket
+    static uint64_t bucketHighestValue(std::size_t index){
+        if(index<SUB_BUCKET_COUNT){
+            return index;
+        }
+        const std::size_t shift=index/SUB_BUCKET_COUNT-1;
+        const uint64_t subBucket=index%SUB_BUCKET_COUNT;
+        return ((SUB_BUCKET_COUNT+subBucket+1)<<shift)-1;
+    }
+public:
+    LatencyHistogram()=default;
+    void add(const std::chrono::nanoseconds& value){
+        if(value<std::chrono::nanoseconds(0)){
+            MLOGE<<"Cannot add negative value";
+            return;
+        }
+        buckets[bucketIndex(value.count())]++;
+        nSamples++;
+        sum+=value;
+        if(value<min)min=value;
+        if(value>max)max=value;
+    }
+    std::chrono::nanoseconds getAvg()const{
+        if(nSamples==0)return std::chrono::nanoseconds(0);
+        return sum/nSamples;
+    }
+    std::chrono::nanoseconds getMin()const{
+        if(nSamples==0)return std::chrono::nanoseconds(0);
+        return min;
+    }
+    std::chrono::nanoseconds getMax()const{
+        return max;
+    }
+    uint64_t getNSamples()const{
+        return nSamples;
+    }
+    void reset(){
+        buckets.fill(0);
+        nSamples=0;
+        sum=std::chrono::nanoseconds(0);
+        min=std::chrono::nanoseconds::max();
+        max=std::chrono::nanoseconds(0);
+    }
+    // Returns the value that @param percentile (0..100) of all samples are smaller than or equal to
+    std::chrono::nanoseconds getPercentile(const double percentile)const{
+        if(nSamples==0)return std::chrono::nanoseconds(0);
+        const auto wantedCount=std::max((uint64_t)1,(uint64_t)std::ceil(percentile/100.0*nSamples));
+        uint64_t count=0;
+        for(std::size_t i=0;i<N_BUCKETS;i++){
+            count+=buckets[i];
+            if(count>=wantedCount){
+                // The bucket covers a range of values, but never report something bigger than the real max
+                return std::min(max,std::chrono::nanoseconds(bucketHighestValue(i)));
+            }
+        }
+        return max;
+    }
+    // Merge the samples of other into this histogram. Exact, same result as if all samples were added to this one
+    void merge(const LatencyHistogram& other){
+        for(std::size_t i=0;i<N_BUCKETS;i++){
+            buckets[i]+=other.buckets[i];
+        }
+        nSamples+=other.nSamples;
+        sum+=other.sum;
+        min=std::min(min,other.min);
+        max=std::max(max,other.max);
+    }
+    std::string getAvgReadable(const bool averageOnly=false)const{
+        std::stringstream ss;
+        if(averageOnly){
+            ss<<"avg="<<MyTimeHelper::R(getAvg());
+            return ss.str();
+        }
+        ss<<"min="<<MyTimeHelper::R(getMin())<<" max="<<MyTimeHelper::R(getMax())<<" avg="<<MyTimeHelper::R(getAvg())<<" N samples="<<nSamples;
+        return ss.str();
+    }
+    std::string getPercentilesReadable()const{
+        std::stringstream ss;
+        ss<<"p50="<<MyTimeHelper::R(getPercentile(50))<<" p90="<<MyTimeHelper::R(getPercentile(90))
+          <<" p99="<<MyTimeHelper::R(getPercentile(99))<<" p99.9="<<MyTimeHelper::R(getPercentile(99.9))
+          <<" max="<<MyTimeHelper::R(getMax());
+        return ss.str();
+    }
+    // One line per power of two range that has samples, e.g. "[16.384us,32.768us) 1234"
+    std::string getHistogramReadable()const{
+        std::stringstream ss;
+        for(std::size_t begin=0;begin<N_BUCKETS;begin+=SUB_BUCKET_COUNT){
+            uint64_t count=0;
+            for(std::size_t i=begin;i<begin+SUB_BUCKET_COUNT;i++){
+                count+=buckets[i];
+            }
+            if(count==0)continue;
+            const auto lowest=begin==0 ? 0 : bucketHighestValue(begin-1)+1;
+            ss<<"["<<MyTimeHelper::ReadableNS(lowest)<<","<<MyTimeHelper::ReadableNS(bucketHighestValue(begin+SUB_BUCKET_COUNT-1)+1)<<") "<<count<<"\n";
+        }
+        return ss.str();
+    }
+};
+
 class Chronometer:public AvgCalculator {
 public:
     explicit Chronometer(std::string name="Unknown"):mName(std::move(name)){}
@@ -15,18 +15,21 @@
 
 #include <sys/time.h>
 #include <sys/resource.h>
-
-static void printCurrentThreadPriority(const std::string name){
-	int which = PRIO_PROCESS;
-    id_t pid = (id_t)getpid();
-    int priority= getpriority(which, pid);
-	MLOGD<<name<<" has priority "<<priority<<"\n";
-}
+#include "SocketHelper.hpp"
 
 UDPReceiver::UDPReceiver(JavaVM* javaVm,int port,std::string name,int CPUPriority,DATA_CALLBACK  onDataReceivedCallback,
 size_t WANTED_RCVBUF_SIZE,const bool ENABLE_NONBLOCKING):
         mPort(port),mName(std::move(name)),WANTED_RCVBUF_SIZE(WANTED_RCVBUF_SIZE),mCPUPriority(CPUPriority),onDataReceivedCallback(std::move(onDataReceivedCallback))
 		,javaVm(javaVm),ENABLE_NONBLOCKING(ENABLE_NONBLOCKING){
+    if(ENABLE_NONBLOCKING){
+        enableAdaptiveSpin();
+    }
+#ifndef __ANDROID__
+    if(javaVm==nullptr && mCPUPriority>0){
+        mThreadConfig.policy=SCHED_FIFO;
+        mThreadConfig.priority=mCPUPriority;
+    }
+#endif
 }
 
 void UDPReceiver::registerOnSourceIPFound(SOURCE_IP_CALLBACK onSourceIP1) {
@@ -41,31 +44,245 @@ std::string UDPReceiver::getSourceIPAddress()const {
     return senderIP;
 }
 
+sockaddr_in UDPReceiver::getSourceAddress()const {
+    return mSourceAddress;
+}
+
+void UDPReceiver::enableBatchedReceive(size_t maxBatchSize,DATA_BATCH_CALLBACK onDataBatchReceived1,size_t maxDatagramSize){
+    assert(mUDPReceiverThread==nullptr);
+    mMaxBatchSize=maxBatchSize;
+    onDataBatchReceived=std::move(onDataBatchReceived1);
+    mMaxDatagramSize=std::min(maxDatagramSize,UDP_PACKET_MAX_SIZE);
+}
+
+void UDPReceiver::enableKernelTimestamps(DATA_CALLBACK_TIMESTAMPED onDataReceivedTimestamped1){
+    assert(mUDPReceiverThread==nullptr);
+    mKernelTimestamps=true;
+    onDataReceivedTimestamped=std::move(onDataReceivedTimestamped1);
+}
+
+float UDPReceiver::getAvgBatchSize()const{
+    if(avgBatchSize.getNSamples()==0)return 0;
+    return avgBatchSize.getAvg();
+}
+
+void UDPReceiver::enableDecoupledCallback(size_t capacity,DatagramRing::Policy policy,size_t maxDatagramSize){
+    assert(mUDPReceiverThread==nullptr);
+    mRingCapacity=capacity;
+    mRingPolicy=policy;
+    mRingDatagramSize=std::min(maxDatagramSize,UDP_PACKET_MAX_SIZE);
+}
+
+void UDPReceiver::setConsumerThreadConfig(const LinuxThreadHelper::Config& config){
+    assert(mUDPReceiverThread==nullptr);
+    mConsumerThreadConfig=config;
+}
+
+std::string UDPReceiver::getDecoupledStatsReadable()const{
+    if(mDatagramRing==nullptr)return "";
+    return mDatagramRing->getStatsReadable();
+}
+
+const DatagramRing* UDPReceiver::getDatagramRing()const{
+    return mDatagramRing.get();
+}
+
+void UDPReceiver::enableAdaptiveSpin(const std::chrono::microseconds maxSpin,const bool adaptive,const int busyPollUs){
+    assert(mUDPReceiverThread==nullptr);
+    mMaxSpin=maxSpin;
+    mAdaptiveSpin=adaptive;
+    mBusyPollUs=busyPollUs;
+}
+
+std::string UDPReceiver::getSpinStatsReadable()const{
+    if(mMaxSpin.count()==0)return "";
+    const uint64_t nHits=nSpinHits;
+    const uint64_t nMisses=nSpinMisses;
+    std::stringstream ss;
+    ss<<"spin budget "<<MyTimeHelper::R(std::chrono::nanoseconds(mSpinBudgetNs.load()))<<" receives while spinning "<<nHits
+    <<" ("<<(nHits+nMisses==0 ? 0 : 100*nHits/(nHits+nMisses))<<"%) blocked "<<nMisses;
+    return ss.str();
+}
+
+void UDPReceiver::enableIoUring(const bool sqPoll,const unsigned nBuffers){
+    assert(mUDPReceiverThread==nullptr);
+    mIoUringEnabled=true;
+    mIoUringSqPoll=sqPoll;
+    mIoUringBuffers=nBuffers;
+}
+
+std::string UDPReceiver::getBackendReadable()const{
+    if(mIoUring==nullptr){
+        return mIoUringEnabled ? "classic (io_uring fallback: "+mIoUringFallbackReason+")" : "classic";
+    }
+    std::stringstream ss;
+    ss<<"io_uring"<<(mIoUring->isSqPoll() ? " sqpoll" : "")<<" syscalls per datagram "
+    <<(mIoUringNDatagrams==0 ? 0.0 : (double)mIoUring->getNSyscalls()/mIoUringNDatagrams);
+    return ss.str();
+}
+
+void UDPReceiver::setThreadConfig(const LinuxThreadHelper::Config& config){
+    assert(mUDPReceiverThread==nullptr);
+    mThreadConfig=config;
+}
+
+std::string UDPReceiver::getThreadConfigReadable()const{
+    std::lock_guard<std::mutex> lock(mThreadConfigMutex);
+    return mThreadConfigReadable;
+}
+
+std::string UDPReceiver::getConsumerThreadConfigReadable()const{
+    std::lock_guard<std::mutex> lock(mThreadConfigMutex);
+    return mConsumerThreadConfigReadable;
+}
+
+void UDPReceiver::setEventLoop(EventLoop* eventLoop){
+    assert(mUDPReceiverThread==nullptr);
+    mEventLoop=eventLoop;
+}
+
+std::thread::native_handle_type UDPReceiver::getThreadHandle()const{
+    if(mEventLoop!=nullptr){
+        return mEventLoop->getThreadHandle();
+    }
+    assert(mUDPReceiverThread!=nullptr);
+    return mUDPReceiverThread->native_handle();
+}
+
 void UDPReceiver::startReceiving() {
     receiving=true;
+    if(mRingCapacity>0){
+        mDatagramRing=std::make_unique<DatagramRing>(mRingCapacity,mRingDatagramSize,mRingPolicy);
+        mConsumerThread=std::make_unique<std::thread>([this]{this->consumeLoop();});
+    }
+    if(mEventLoop!=nullptr){
+        startOnEventLoop();
+        return;
+    }
+    // Opened and closed on the calling thread, the receiver thread only uses mSocket
+    if(!openSocket()){
+        return;
+    }
+    allocateBuffers();
     mUDPReceiverThread=std::make_unique<std::thread>([this]{this->receiveFromUDPLoop();} );
 #ifdef __ANDROID__
     NDKThreadHelper::setName(mUDPReceiverThread->native_handle(),mName.c_str());
 #endif
 }
 
+void UDPReceiver::startOnEventLoop() {
+    {
+        std::lock_guard<std::mutex> lock(mThreadConfigMutex);
+        mThreadConfigReadable="event loop "+mEventLoop->getName();
+    }
+    if(!openSocket()){
+        return;
+    }
+    allocateBuffers();
+    mEventLoop->addReadable(mSocket,[this]{
+        // Level triggered, after a few batches the other sockets of the loop get their turn and we are called again
+        for(int i=0;i<MAX_RECEIVES_PER_WAKEUP && receiving;i++){
+            if(receiveOnce(MSG_DONTWAIT)==0){
+                break;
+            }
+        }
+    });
+}
+
 void UDPReceiver::stopReceiving() {
     receiving=false;
-    //this stops the recvfrom even if in blocking mode
-    shutdown(mSocket,SHUT_RD);
-    if(mUDPReceiverThread->joinable()){
-        mUDPReceiverThread->join();
+    if(mEventLoop!=nullptr){
+        // Waits until our callback is not running anymore
+        if(mSocket!=-1){
+            mEventLoop->remove(mSocket);
+        }
+    }else if(mUDPReceiverThread){
+        //this stops the recvfrom even if in blocking mode
+        shutdown(mSocket,SHUT_RD);
+        if(mUDPReceiverThread->joinable()){
+            mUDPReceiverThread->join();
+        }
+        mUDPReceiverThread.reset();
+    }
+    if(mSocket!=-1){
+        close(mSocket);
+        mSocket=-1;
+    }
+    if(mConsumerThread){
+        // No more datagrams are pushed, the consumer delivers what is left and exits
+        mDatagramRing->stop();
+        mConsumerThread->join();
+        mConsumerThread.reset();
+        MLOGD<<"UDPReceiver ring "<<mDatagramRing->getStatsReadable()<<"\n";
+    }
+    // With spin-then-block the budget is derived from the same gaps, one line such that both are read together
+	MLOGD<<"UDPReceiver avgDeltaBetween(recvfrom) "<<avgDeltaBetweenPackets.getAvgReadable()
+	<<(mMaxSpin.count()>0 ? " "+getSpinStatsReadable() : "")<<"\n";
+    if(mMaxBatchSize>0){
+        MLOGD<<"UDPReceiver batch size(recvmmsg) "<<avgBatchSize.getAvgReadable()<<"\n";
     }
-    mUDPReceiverThread.reset();
-	MLOGD<<"UDPReceiver avgDeltaBetween(recvfrom) "<<avgDeltaBetweenPackets.getAvgReadable()<<"\n";
 }
 
-void UDPReceiver::receiveFromUDPLoop() {
-	printCurrentThreadPriority("TEST_UDP_RECCEIVER");
+void UDPReceiver::onNewDatagram(const sockaddr_in& source,const size_t message_length){
+    nReceivedBytes+=message_length;
+    // inet_ntoa and the std::string would allocate for each packet, the sender hardly ever changes
+    if(mAnySource && source.sin_addr.s_addr==mSourceAddress.sin_addr.s_addr && source.sin_port==mSourceAddress.sin_port){
+        return;
+    }
+    mAnySource=true;
+    mSourceAddress=source;
+    const char* p=inet_ntoa(source.sin_addr);
+    senderIP=p;
+    if(onSourceIP!=nullptr){
+        onSourceIP(p);
+    }
+}
+
+void UDPReceiver::callDataCallbacks(const uint8_t* data,const size_t size,const std::chrono::steady_clock::time_point kernelRxTimestamp){
+    if(onDataBatchReceived!=nullptr){
+        const Datagram datagram{data,size,kernelRxTimestamp};
+        onDataBatchReceived(&datagram,1);
+    }else if(onDataReceivedTimestamped!=nullptr){
+        onDataReceivedTimestamped(data,size,kernelRxTimestamp);
+    }else{
+        onDataReceivedCallback(data,size);
+    }
+}
+
+void UDPReceiver::deliver(const uint8_t* data,const size_t size,const std::chrono::steady_clock::time_point kernelRxTimestamp){
+    if(mDatagramRing){
+        mDatagramRing->push(data,size,kernelRxTimestamp);
+    }else{
+        callDataCallbacks(data,size,kernelRxTimestamp);
+    }
+}
+
+void UDPReceiver::consumeLoop() {
+#ifndef __ANDROID__
+    {
+        const auto readable=LinuxThreadHelper::apply(mConsumerThreadConfig);
+        MLOGD<<mName<<" consumer runs with "<<readable;
+        std::lock_guard<std::mutex> lock(mThreadConfigMutex);
+        mConsumerThreadConfigReadable=readable;
+    }
+#endif
+    const auto onDatagram=[this](const uint8_t* data,size_t size,std::chrono::steady_clock::time_point kernelRxTimestamp){
+        callDataCallbacks(data,size,kernelRxTimestamp);
+    };
+    while(true){
+        while(mDatagramRing->pop(onDatagram)){}
+        if(mDatagramRing->isStopped() && mDatagramRing->getDepth()==0){
+            break;
+        }
+        mDatagramRing->waitForData(std::chrono::milliseconds(100));
+    }
+}
+
+bool UDPReceiver::openSocket() {
     mSocket=socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (mSocket == -1) {
         MLOGD<<"Error creating socket";
-        return;
+        return false;
     }
     int enable = 1;
     if (setsockopt(mSocket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0){
@@ -76,7 +293,7 @@ void UDPReceiver::receiveFromUDPLoop() {
     getsockopt(mSocket, SOL_SOCKET, SO_RCVBUF, &recvBufferSize, &len);
     MLOGD<<"Default socket recv buffer is "<<StringHelper::memorySizeReadable(recvBufferSize);
 
-    if(WANTED_RCVBUF_SIZE>recvBufferSize){
+    if(WANTED_RCVBUF_SIZE>(size_t)recvBufferSize){
         recvBufferSize=WANTED_RCVBUF_SIZE;
         if(setsockopt(mSocket, SOL_SOCKET, SO_RCVBUF, &WANTED_RCVBUF_SIZE,len)) {
             MLOGD<<"Cannot increase buffer size to "<<StringHelper::memorySizeReadable(WANTED_RCVBUF_SIZE);
@@ -84,10 +301,15 @@ void UDPReceiver::receiveFromUDPLoop() {
         getsockopt(mSocket, SOL_SOCKET, SO_RCVBUF, &recvBufferSize, &len);
         MLOGD<<"Wanted "<<StringHelper::memorySizeReadable(WANTED_RCVBUF_SIZE)<<" Set "<<StringHelper::memorySizeReadable(recvBufferSize);
     }
-    if(javaVm!=nullptr){
-#ifdef __ANDROID__
-         NDKThreadHelper::setProcessThreadPriorityAttachDetach(javaVm, mCPUPriority, mName.c_str());
-#endif
+    if(mBusyPollUs>0){
+        if(setsockopt(mSocket,SOL_SOCKET,SO_BUSY_POLL,&mBusyPollUs,sizeof(mBusyPollUs))!=0){
+            MLOGE<<"Cannot set SO_BUSY_POLL "<<mBusyPollUs<<"us "<<strerror(errno);
+        }
+    }
+    if(mKernelTimestamps){
+        if(!SocketHelper::enableKernelRxTimestamps(mSocket)){
+            MLOGE<<"Using time of recvmsg instead";
+        }
     }
     struct sockaddr_in myaddr;
     memset((uint8_t *) &myaddr, 0, sizeof(myaddr));
@@ -96,53 +318,324 @@ void UDPReceiver::receiveFromUDPLoop() {
     myaddr.sin_port = htons(mPort);
     if (bind(mSocket, (struct sockaddr *) &myaddr, sizeof(myaddr)) == -1) {
         MLOGE<<"Error binding Port; "<<mPort;
+        close(mSocket);
+        mSocket=-1;
+        return false;
+    }
+    return true;
+}
+
+void UDPReceiver::allocateBuffers() {
+    if(mMaxBatchSize==0){
+        //wrap into unique pointer to avoid running out of stack
+        mBuffer=std::make_unique<std::array<uint8_t,UDP_PACKET_MAX_SIZE>>();
+        return;
+    }
+    // All slots are allocated once, recvmmsg() writes directly into them
+    auto& b=mBatchBuffers;
+    b.slots.resize(mMaxBatchSize*mMaxDatagramSize);
+    b.msgs.resize(mMaxBatchSize);
+    b.iovecs.resize(mMaxBatchSize);
+    b.sources.resize(mMaxBatchSize);
+    b.datagrams.resize(mMaxBatchSize);
+    b.controls.resize(mKernelTimestamps ? mMaxBatchSize : 0);
+    for(size_t i=0;i<mMaxBatchSize;i++){
+        b.iovecs[i].iov_base=&b.slots[i*mMaxDatagramSize];
+        b.iovecs[i].iov_len=mMaxDatagramSize;
+    }
+}
+
+void UDPReceiver::receiveFromUDPLoop() {
+#ifndef __ANDROID__
+    {
+        const auto readable=LinuxThreadHelper::apply(mThreadConfig);
+        MLOGD<<mName<<" runs with "<<readable;
+        std::lock_guard<std::mutex> lock(mThreadConfigMutex);
+        mThreadConfigReadable=readable;
+    }
+#endif
+    if(javaVm!=nullptr){
+#ifdef __ANDROID__
+         NDKThreadHelper::setProcessThreadPriorityAttachDetach(javaVm, mCPUPriority, mName.c_str());
+#endif
+    }
+    if(mIoUringEnabled){
+        if(receiveWithIoUring()){
+            return;
+        }
+        MLOGE<<mName<<" io_uring not usable ("<<mIoUringFallbackReason<<"), using recvfrom / recvmmsg";
+    }
+    //TODO investigate: does a big buffer size create latency with MSG_WAITALL ?
+    //I do not think so. recvfrom should return as soon as new data arrived,not when the buffer is full
+    //But with a bigger buffer we do not loose packets when the receiver thread cannot keep up for a short amount of time
+    // MSG_WAITALL does not wait until we have __n data, but a new UDP packet (that can be smaller than __n)
+    // With MSG_WAITFORONE recvmmsg blocks until the first datagram arrives, then returns everything that is
+    // already queued (up to mMaxBatchSize) without blocking again
+    const int flags=mMaxBatchSize>0 ? MSG_WAITFORONE : MSG_WAITALL;
+    // Spinning forever on MSG_DONTWAIT (the old ENABLE_NONBLOCKING) hogs a whole CPU core, spin only for a while
+    if(mMaxSpin.count()>0){
+        spinThenBlockLoop(flags);
         return;
     }
-    //wrap into unique pointer to avoid running out of stack
-    const auto buff=std::make_unique<std::array<uint8_t,UDP_PACKET_MAX_SIZE>>();
+    while (receiving) {
+        receiveOnce(flags);
+    }
+}
+
+int UDPReceiver::receiveOnce(const int flags) {
+    return mMaxBatchSize>0 ? receiveBatch(flags) : (receiveSingle(flags)>0 ? 1 : 0);
+}
 
+ssize_t UDPReceiver::receiveSingle(const int flags) {
     sockaddr_in source;
     socklen_t sourceLen= sizeof(sockaddr_in);
-    
-    while (receiving) {
-        //TODO investigate: does a big buffer size create latency with MSG_WAITALL ?
-        //I do not think so. recvfrom should return as soon as new data arrived,not when the buffer is full
-        //But with a bigger buffer we do not loose packets when the receiver thread cannot keep up for a short amount of time
-        // MSG_WAITALL does not wait until we have __n data, but a new UDP packet (that can be smaller than __n)
-        //NOTE: NONBLOCKING hogs a whole CPU core ! do not use whenever possible !
-		ssize_t tmp;
-		if(ENABLE_NONBLOCKING){
-			tmp = recvfrom(mSocket,buff->data(),UDP_PACKET_MAX_SIZE, MSG_DONTWAIT,(sockaddr*)&source,&sourceLen);
-		}else{
-			tmp = recvfrom(mSocket,buff->data(),UDP_PACKET_MAX_SIZE, MSG_WAITALL,(sockaddr*)&source,&sourceLen);
-		}
-		const ssize_t message_length=tmp;
-        if (message_length > 0) { //else -1 was returned;timeout/No data received
-			if(lastReceivedPacket!=std::chrono::steady_clock::time_point{}){
-				const auto delta=std::chrono::steady_clock::now()-lastReceivedPacket;
-				avgDeltaBetweenPackets.add(delta);
-			}
-			lastReceivedPacket=std::chrono::steady_clock::now();
-            //LOGD("Data size %d",(int)message_length);
-            onDataReceivedCallback(buff->data(), (size_t)message_length);
-
-            nReceivedBytes+=message_length;
-            //The source ip stuff
-            const char* p=inet_ntoa(source.sin_addr);
-            std::string s1=std::string(p);
-            if(senderIP!=s1){
-                senderIP=s1;
+    std::chrono::steady_clock::time_point kernelRxTimestamp{};
+    ssize_t message_length;
+    if(mKernelTimestamps){
+        // only used with kernel timestamps, in this case recvmsg() is used instead of recvfrom()
+        std::array<uint8_t,SocketHelper::CONTROL_BUFFER_SIZE> control{};
+        iovec iov{mBuffer->data(),UDP_PACKET_MAX_SIZE};
+        msghdr hdr{};
+        hdr.msg_name=&source;
+        hdr.msg_namelen=sizeof(sockaddr_in);
+        hdr.msg_iov=&iov;
+        hdr.msg_iovlen=1;
+        hdr.msg_control=control.data();
+        hdr.msg_controllen=control.size();
+        message_length = recvmsg(mSocket,&hdr,flags);
+        if(message_length>0){
+            kernelRxTimestamp=SocketHelper::getKernelRxTimestamp(hdr);
+        }
+    }else{
+        message_length = recvfrom(mSocket,mBuffer->data(),UDP_PACKET_MAX_SIZE,flags,(sockaddr*)&source,&sourceLen);
+    }
+    if (message_length > 0) { //else -1 was returned;timeout/No data received
+        addReceiveGap();
+        //LOGD("Data size %d",(int)message_length);
+        deliver(mBuffer->data(),(size_t)message_length,kernelRxTimestamp);
+        onNewDatagram(source,(size_t)message_length);
+    }else{
+        if(errno != EWOULDBLOCK) {
+            //MLOGE<<"Error on recvfrom. errno="<<errno<<" "<<strerror(errno);
+        }
+    }
+    return message_length;
+}
+
+int UDPReceiver::receiveBatch(const int flags) {
+    auto& b=mBatchBuffers;
+    // recvmmsg overwrites msg_len and msg_namelen, so the headers have to be re-initialized each time
+    for(size_t i=0;i<mMaxBatchSize;i++){
+        msghdr& hdr=b.msgs[i].msg_hdr;
+        memset(&hdr,0,sizeof(msghdr));
+        hdr.msg_iov=&b.iovecs[i];
+        hdr.msg_iovlen=1;
+        hdr.msg_name=&b.sources[i];
+        hdr.msg_namelen=sizeof(sockaddr_in);
+        if(mKernelTimestamps){
+            hdr.msg_control=b.controls[i].data();
+            hdr.msg_controllen=SocketHelper::CONTROL_BUFFER_SIZE;
+        }
+        b.msgs[i].msg_len=0;
+    }
+    const int nMessages=recvmmsg(mSocket,b.msgs.data(),mMaxBatchSize,flags,nullptr);
+    // After shutdown() recvmmsg returns a single empty message, same as recvfrom returning 0
+    if(nMessages<=0 || b.msgs[0].msg_len==0){
+        if(errno != EWOULDBLOCK) {
+            //MLOGE<<"Error on recvmmsg. errno="<<errno<<" "<<strerror(errno);
+        }
+        return 0;
+    }
+    for(int i=0;i<nMessages;i++){
+        b.datagrams[i]={(const uint8_t*)b.iovecs[i].iov_base,b.msgs[i].msg_len,{}};
+        if(mKernelTimestamps){
+            b.datagrams[i].kernelRxTimestamp=SocketHelper::getKernelRxTimestamp(b.msgs[i].msg_hdr);
+        }
+    }
+    deliverBatch(b.datagrams.data(),b.sources.data(),nMessages);
+    return nMessages;
+}
+
+void UDPReceiver::spinThenBlockLoop(const int blockingFlags) {
+    const auto maxSpin=std::chrono::nanoseconds(mMaxSpin);
+    // Optimistic until the first window of samples is there
+    auto budget=maxSpin;
+    mSpinBudgetNs=budget.count();
+    // The gaps of the current window are collected by addReceiveGap(), the same measurement as avgDeltaBetweenPackets
+    nSpinWindowGaps=0;
+    nSpinWindowShortGaps=0;
+    sumSpinWindowShortGaps=std::chrono::nanoseconds(0);
+    while(receiving){
+        if(receiveOnce(blockingFlags)==0){
+            continue;
+        }
+        if(budget.count()==0){
+            nSpinMisses++;
+        }
+        auto spinEnd=std::chrono::steady_clock::now()+budget;
+        while(receiving && budget.count()>0){
+            if(receiveOnce(MSG_DONTWAIT)>0){
+                nSpinHits++;
+                spinEnd=std::chrono::steady_clock::now()+budget;
+            }else if(std::chrono::steady_clock::now()>=spinEnd){
+                nSpinMisses++;
+                break;
             }
-            if(onSourceIP!=nullptr){
-                onSourceIP(p);
+        }
+        if(mAdaptiveSpin && nSpinWindowGaps>=SPIN_ADAPT_N_SAMPLES){
+            if(nSpinWindowShortGaps*100>=nSpinWindowGaps*SPIN_MIN_SHORT_GAPS_PERCENT){
+                const auto avgShortGap=sumSpinWindowShortGaps/nSpinWindowShortGaps;
+                budget=std::clamp(avgShortGap*SPIN_BUDGET_FACTOR,std::chrono::nanoseconds(SPIN_MIN_BUDGET),maxSpin);
+            }else{
+                // Most packets arrive more than maxSpin after the previous one, a spin would mostly run out
+                budget=std::chrono::nanoseconds(0);
             }
-        }else{
-            if(errno != EWOULDBLOCK) {
-                //MLOGE<<"Error on recvfrom. errno="<<errno<<" "<<strerror(errno);
+            mSpinBudgetNs=budget.count();
+            nSpinWindowGaps=0;
+            nSpinWindowShortGaps=0;
+            sumSpinWindowShortGaps=std::chrono::nanoseconds(0);
+        }
+    }
+}
+
+void UDPReceiver::addReceiveGap() {
+    const auto now=std::chrono::steady_clock::now();
+    if(lastReceivedPacket!=std::chrono::steady_clock::time_point{}){
+        const auto delta=std::chrono::duration_cast<std::chrono::nanoseconds>(now-lastReceivedPacket);
+        avgDeltaBetweenPackets.add(delta);
+        // Only the gaps a spin could have caught (<= maxSpin) count for the spin budget,
+        // with bursty traffic the long gaps between the bursts would dominate the avg of all gaps
+        if(mMaxSpin.count()>0){
+            nSpinWindowGaps++;
+            if(delta<=mMaxSpin){
+                nSpinWindowShortGaps++;
+                sumSpinWindowShortGaps+=delta;
             }
         }
     }
-    close(mSocket);
+    lastReceivedPacket=now;
+}
+
+void UDPReceiver::deliverBatch(const Datagram datagrams[],const sockaddr_in sources[],const int count) {
+    addReceiveGap();
+    avgBatchSize.add(count);
+    if(mDatagramRing){
+        for(int i=0;i<count;i++){
+            mDatagramRing->push(datagrams[i].data,datagrams[i].size,datagrams[i].kernelRxTimestamp);
+        }
+    }else if(onDataBatchReceived!=nullptr){
+        onDataBatchReceived(datagrams,(size_t)count);
+    }else{
+        for(int i=0;i<count;i++){
+            if(onDataReceivedTimestamped!=nullptr){
+                onDataReceivedTimestamped(datagrams[i].data,datagrams[i].size,datagrams[i].kernelRxTimestamp);
+            }else{
+                onDataReceivedCallback(datagrams[i].data,datagrams[i].size);
+            }
+        }
+    }
+    for(int i=0;i<count;i++){
+        onNewDatagram(sources[i],datagrams[i].size);
+    }
+}
+
+bool UDPReceiver::receiveWithIoUring() {
+    if(!IoUring::isSupported()){
+        mIoUringFallbackReason="no io_uring";
+        return false;
+    }
+#ifdef HAVE_IO_URING
+    // Buffer group of the provided buffers, there is only one per ring
+    static constexpr uint16_t BUFFER_GROUP=0;
+    mIoUring=std::make_unique<IoUring>(64,mIoUringSqPoll);
+    mIoUringNDatagrams=0;
+    IoUring& ring=*mIoUring;
+    // Layout of each provided buffer: io_uring_recvmsg_out, source address, control (timestamps), payload
+    msghdr msg{};
+    msg.msg_namelen=sizeof(sockaddr_in);
+    msg.msg_controllen=mKernelTimestamps ? SocketHelper::CONTROL_BUFFER_SIZE : 0;
+    const size_t payloadOffset=sizeof(io_uring_recvmsg_out)+msg.msg_namelen+msg.msg_controllen;
+    if(!ring.isValid() || !ring.setupBufferRing(BUFFER_GROUP,mIoUringBuffers,payloadOffset+mMaxDatagramSize)){
+        mIoUringFallbackReason="io_uring setup failed";
+        mIoUring.reset();
+        return false;
+    }
+    const size_t maxBatchSize=mMaxBatchSize>0 ? mMaxBatchSize : IO_URING_DEFAULT_BATCH_SIZE;
+    std::vector<Datagram> datagrams(maxBatchSize);
+    std::vector<sockaddr_in> sources(maxBatchSize);
+    std::vector<uint16_t> bufferIds(maxBatchSize);
+    const auto armMultishot=[this,&ring,&msg]{
+        io_uring_sqe* sqe=ring.getSqe();
+        sqe->opcode=IORING_OP_RECVMSG;
+        sqe->fd=mSocket;
+        sqe->addr=(uint64_t)&msg;
+        sqe->len=1;
+        sqe->ioprio=IORING_RECV_MULTISHOT;
+        sqe->flags=IOSQE_BUFFER_SELECT;
+        sqe->buf_group=BUFFER_GROUP;
+        ring.submit();
+    };
+    armMultishot();
+    bool anyReceived=false;
+    bool unsupported=false;
+    while(receiving && !unsupported){
+        if(!ring.waitCqe(std::chrono::milliseconds(100))){
+            continue;
+        }
+        int count=0;
+        bool rearm=false;
+        ring.forEachCqe([&](const io_uring_cqe& cqe){
+            if(!(cqe.flags & IORING_CQE_F_MORE)){
+                rearm=true;
+            }
+            if(cqe.res<=0 || !(cqe.flags & IORING_CQE_F_BUFFER)){
+                // -EINVAL: no multishot recvmsg. -ENOBUFS: all buffers in use, rearmed once we recycled some.
+                // 0 after shutdown()
+                if(cqe.res==-EINVAL && !anyReceived){
+                    unsupported=true;
+                }
+                return;
+            }
+            const auto bufferId=(uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            uint8_t* buffer=ring.getBuffer(bufferId);
+            const auto* out=(const io_uring_recvmsg_out*)buffer;
+            Datagram& datagram=datagrams[count];
+            datagram.data=buffer+payloadOffset;
+            datagram.size=std::min((size_t)out->payloadlen,(size_t)mMaxDatagramSize);
+            datagram.kernelRxTimestamp={};
+            if(mKernelTimestamps){
+                msghdr control{};
+                control.msg_control=buffer+sizeof(io_uring_recvmsg_out)+msg.msg_namelen;
+                control.msg_controllen=out->controllen;
+                datagram.kernelRxTimestamp=SocketHelper::getKernelRxTimestamp(control);
+            }
+            memcpy(&sources[count],buffer+sizeof(io_uring_recvmsg_out),sizeof(sockaddr_in));
+            bufferIds[count]=bufferId;
+            count++;
+        },(unsigned)maxBatchSize);
+        if(count>0){
+            anyReceived=true;
+            mIoUringNDatagrams+=count;
+            deliverBatch(datagrams.data(),sources.data(),count);
+            // The callbacks are done with the data, the kernel can reuse the buffers (no syscall)
+            for(int i=0;i<count;i++){
+                ring.recycleBuffer(bufferIds[i]);
+            }
+            ring.commitBuffers();
+        }
+        if(rearm && receiving && !unsupported){
+            armMultishot();
+        }
+    }
+    if(unsupported){
+        mIoUringFallbackReason="no multishot recvmsg";
+        mIoUring.reset();
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
 }
 
 int UDPReceiver::getPort() const {
@@ -11,7 +11,16 @@
 #include <atomic>
 #include <functional>
 #include <chrono>
+#include <vector>
+#include <memory>
+#include <array>
+#include <mutex>
 #include "TimeHelper.hpp"
+#include "LinuxThreadHelper.h"
+#include "DatagramRing.hpp"
+#include "EventLoop.h"
+#include "SocketHelper.hpp"
+#include "IoUring.h"
 //
 #ifdef __ANDROID__
 #include <jni.h>
@@ -24,23 +33,109 @@ class UDPReceiver {
 public:
     typedef std::function<void(const uint8_t[],size_t)> DATA_CALLBACK;
     typedef std::function<void(const std::string)> SOURCE_IP_CALLBACK;
+    // One datagram of a batch. data points into the receiver's preallocated slots and is only valid
+    // for the duration of the batch callback
+    struct Datagram{
+        const uint8_t* data;
+        size_t size;
+        // Software receive timestamp of the kernel, only set when kernel timestamps are enabled
+        std::chrono::steady_clock::time_point kernelRxTimestamp;
+    };
+    typedef std::function<void(const Datagram datagrams[],size_t count)> DATA_BATCH_CALLBACK;
+    typedef std::function<void(const uint8_t[],size_t,std::chrono::steady_clock::time_point kernelRxTimestamp)> DATA_CALLBACK_TIMESTAMPED;
 public:
     /**
      * @param javaVm used to set thread priority (attach and then detach) for android,
        nullptr when priority doesn't matter/not using android
      * @param port : The port to listen on
-     * @param CPUPriority: The priority the receiver thread will run with if javaVm!=nullptr
+     * @param CPUPriority: The priority the receiver thread will run with if javaVm!=nullptr. On linux (javaVm==nullptr)
+     * a value >0 is used as SCHED_FIFO priority, unless setThreadConfig() was called
      * @param onDataReceivedCallback: called every time new data is received
      * @param WANTED_RCVBUF_SIZE: The buffer allocated by the OS might not be sufficient to buffer incoming data when receiving at a high data rate
      * If @param WANTED_RCVBUF_SIZE is bigger than the size allocated by the OS a bigger buffer is requested, but it is not
      * guaranteed that the size is actually increased. Use 0 to leave the buffer size untouched
+     * @param ENABLE_NONBLOCKING: Spin (receive with MSG_DONTWAIT) after each datagram, then block again.
+     * Same as enableAdaptiveSpin() with the default values
      */
     UDPReceiver(JavaVM* javaVm,int port,std::string name,int CPUPriority,DATA_CALLBACK onDataReceivedCallback,
 	size_t WANTED_RCVBUF_SIZE=0,const bool ENABLE_NONBLOCKING=false);
     /**
-     * Register a callback that is called once and contains the IP address of the first received packet's sender
+     * Register a callback that is called with the IP address of the first received packet's sender,
+     * and again each time the sender changes
      */
     void registerOnSourceIPFound(SOURCE_IP_CALLBACK onSourceIP1);
+    /**
+     * Opt-in batched receive mode. Instead of one recvfrom() per datagram the receiver thread uses recvmmsg() to drain
+     * up to @param maxBatchSize datagrams per wakeup into a preallocated vector of slots.
+     * @param onDataBatchReceived1 called once per wakeup with all datagrams of this batch. If nullptr, the
+     * normal DATA_CALLBACK is called once for each datagram of the batch instead.
+     * @param maxDatagramSize size of each slot, datagrams bigger than that are truncated. Use the max size your
+     * application actually sends (e.g. the wfb MTU) to keep the slots small.
+     * Must be called before startReceiving()
+     */
+    void enableBatchedReceive(size_t maxBatchSize,DATA_BATCH_CALLBACK onDataBatchReceived1=nullptr,size_t maxDatagramSize=UDP_PACKET_MAX_SIZE);
+    /**
+     * Enable SO_TIMESTAMPING software receive timestamps. @param onDataReceivedTimestamped1 is called instead of the normal
+     * DATA_CALLBACK and additionally gets the time the kernel received the packet (converted to steady_clock).
+     * The difference between now() inside the callback and this timestamp is the time spent in the socket queue and
+     * waking up the receiver thread. In batched mode the timestamp is reported via Datagram::kernelRxTimestamp instead.
+     * Must be called before startReceiving()
+     */
+    void enableKernelTimestamps(DATA_CALLBACK_TIMESTAMPED onDataReceivedTimestamped1=nullptr);
+    /**
+     * Opt-in decoupled mode. The receiver thread only copies each datagram into a DatagramRing of @param capacity
+     * preallocated slots (of @param maxDatagramSize each), a consumer thread drains the ring and calls the data callbacks.
+     * A slow callback then no longer stalls recvfrom() (until the ring is full, see @param policy).
+     * In batched mode the DATA_BATCH_CALLBACK is called with one datagram at a time.
+     * Must be called before startReceiving()
+     */
+    void enableDecoupledCallback(size_t capacity,DatagramRing::Policy policy=DatagramRing::Policy::DROP_OLDEST,size_t maxDatagramSize=UDP_PACKET_MAX_SIZE);
+    // Scheduling / affinity / memory locking of the consumer thread of the decoupled mode, like setThreadConfig()
+    void setConsumerThreadConfig(const LinuxThreadHelper::Config& config);
+    // Queue depth and drop counters of the decoupled mode, empty string if it is disabled
+    std::string getDecoupledStatsReadable()const;
+    const DatagramRing* getDatagramRing()const;
+    /**
+     * Spin-then-block receive. After each datagram the receiver thread keeps receiving with MSG_DONTWAIT for a spin budget
+     * and only goes back to a blocking receive when nothing arrived during that time. During bursts the next datagram
+     * is picked up without a wakeup (near busy-loop latency), in between the thread sleeps instead of burning a core.
+     * With @param adaptive the budget is recalculated every SPIN_ADAPT_N_SAMPLES receives from the gaps between them
+     * (the same gaps as avgDeltaBetweenPackets).
+     * Only the gaps a spin could have caught (<= @param maxSpin, e.g. inside a burst) count: if they are at least
+     * SPIN_MIN_SHORT_GAPS_PERCENT of all gaps the budget is SPIN_BUDGET_FACTOR times their avg (at least SPIN_MIN_BUDGET,
+     * at most maxSpin), else the traffic is too sparse for spinning to pay off and the receiver only blocks.
+     * Without adaptive it always spins for maxSpin.
+     * @param busyPollUs if >0, SO_BUSY_POLL for the socket: blocking receives busy poll the NIC queue (napi) for that many
+     * us before sleeping. Needs a driver with napi busy poll (not loopback), values above net.core.busy_read need CAP_NET_ADMIN.
+     * Ignored on an EventLoop and with io_uring. Must be called before startReceiving()
+     */
+    void enableAdaptiveSpin(std::chrono::microseconds maxSpin=std::chrono::microseconds(200),bool adaptive=true,int busyPollUs=0);
+    // Current spin budget and the share of receives that were satisfied while spinning
+    std::string getSpinStatsReadable()const;
+    /**
+     * Receive on @param eventLoop instead of an own thread. startReceiving() then only opens the socket and adds it to
+     * the loop, all callbacks run on the loop thread (shared with the other receivers / senders of the loop).
+     * ENABLE_NONBLOCKING and the thread config are ignored, configure the EventLoop instead.
+     * The loop must outlive the receiver. Must be called before startReceiving()
+     */
+    void setEventLoop(EventLoop* eventLoop);
+    /**
+     * Receive with io_uring instead of recvfrom() / recvmmsg(). One multishot recvmsg stays armed, the kernel writes each
+     * datagram into one of @param nBuffers (power of 2) provided buffers that are registered once, with room for the
+     * maxDatagramSize of enableBatchedReceive() each. Completions are read from shared memory, a syscall is only made
+     * when there is nothing to read and the receiver thread goes to sleep. @param sqPoll adds a kernel submission thread.
+     * Callbacks are the same as for the classic backend (with up to maxBatchSize datagrams per batch callback).
+     * Falls back to the classic backend if the kernel has no io_uring / multishot recvmsg (6.0+).
+     * Ignored on an EventLoop. Must be called before startReceiving()
+     */
+    void enableIoUring(bool sqPoll=false,unsigned nBuffers=256);
+    // "classic" or "io_uring" with the n of syscalls per datagram, read it after stopReceiving()
+    std::string getBackendReadable()const;
+    /**
+     * Real-time scheduling, affinity and memory locking the receiver thread applies to itself when it starts
+     * (Linux, see LinuxThreadHelper). Must be called before startReceiving()
+     */
+    void setThreadConfig(const LinuxThreadHelper::Config& config);
     /**
      * Start receiver thread,which opens UDP port
      */
@@ -52,29 +147,122 @@ public:
     //Get function(s) for private member variables
     long getNReceivedBytes()const;
     std::string getSourceIPAddress()const;
+    // Sender of the last datagram, without string conversion
+    sockaddr_in getSourceAddress()const;
     int getPort()const;
+    // Average n of datagrams returned per recvmmsg() call (only when batched receive is enabled)
+    // A value of 8 means 8 times fewer syscalls compared to calling recvfrom() for each datagram
+    float getAvgBatchSize()const;
+    // Native handle of the receiver thread (or event loop thread), only valid between startReceiving() and stopReceiving()
+    std::thread::native_handle_type getThreadHandle()const;
+    // What the receiver thread actually runs with, "not started" until the thread applied its configuration
+    std::string getThreadConfigReadable()const;
+    // Same for the consumer thread of the decoupled mode
+    std::string getConsumerThreadConfigReadable()const;
 private:
+    bool openSocket();
+    void allocateBuffers();
     void receiveFromUDPLoop();
+    void startOnEventLoop();
+    // One recvfrom() / recvmmsg() with @param flags, returns the n of datagrams received
+    int receiveOnce(int flags);
+    ssize_t receiveSingle(int flags);
+    int receiveBatch(int flags);
+    // Receive until stopReceiving(), blocking with @param blockingFlags after each spin
+    void spinThenBlockLoop(int blockingFlags);
+    // Receive until stopReceiving(), false if io_uring cannot be used (before anything was received)
+    bool receiveWithIoUring();
+    // Statistics and callbacks for @param count datagrams received in one go
+    void deliverBatch(const Datagram datagrams[],const sockaddr_in sources[],int count);
+    // Update statistics and source ip for one received datagram
+    void onNewDatagram(const sockaddr_in& source,size_t message_length);
+    // Calls the data callback(s) right away, or pushes the datagram into the ring in decoupled mode
+    void deliver(const uint8_t* data,size_t size,std::chrono::steady_clock::time_point kernelRxTimestamp);
+    void callDataCallbacks(const uint8_t* data,size_t size,std::chrono::steady_clock::time_point kernelRxTimestamp);
+    void consumeLoop();
     const DATA_CALLBACK onDataReceivedCallback=nullptr;
     SOURCE_IP_CALLBACK onSourceIP= nullptr;
+    DATA_BATCH_CALLBACK onDataBatchReceived=nullptr;
+    DATA_CALLBACK_TIMESTAMPED onDataReceivedTimestamped=nullptr;
+    bool mKernelTimestamps=false;
+    // 0 means batched receive is disabled
+    size_t mMaxBatchSize=0;
+    size_t mMaxDatagramSize=UDP_PACKET_MAX_SIZE;
     const int mPort;
     const int mCPUPriority;
+    LinuxThreadHelper::Config mThreadConfig;
+    mutable std::mutex mThreadConfigMutex;
+    std::string mThreadConfigReadable="not started";
+    LinuxThreadHelper::Config mConsumerThreadConfig;
+    std::string mConsumerThreadConfigReadable="not started";
     // Hmm....
     const size_t WANTED_RCVBUF_SIZE;
     const std::string mName;
     ///We need this reference to stop the receiving thread
-    int mSocket=0;
+    // -1 while no socket is open (not started, stopped or openSocket() failed). Only written by the thread that calls
+    // startReceiving() / stopReceiving()
+    int mSocket=-1;
     std::string senderIP="0.0.0.0";
+    // senderIP is only updated (and SOURCE_IP_CALLBACK only called) when this changes, not per packet
+    sockaddr_in mSourceAddress{};
+    bool mAnySource=false;
     std::atomic<bool> receiving=false;
     std::atomic<long> nReceivedBytes=0;
     std::unique_ptr<std::thread> mUDPReceiverThread;
+    // 0 means decoupled mode is disabled, the ring is created by startReceiving()
+    size_t mRingCapacity=0;
+    DatagramRing::Policy mRingPolicy=DatagramRing::Policy::DROP_OLDEST;
+    size_t mRingDatagramSize=UDP_PACKET_MAX_SIZE;
+    std::unique_ptr<DatagramRing> mDatagramRing;
+    std::unique_ptr<std::thread> mConsumerThread;
+    EventLoop* mEventLoop=nullptr;
+    static constexpr int MAX_RECEIVES_PER_WAKEUP=8;
     //https://en.wikipedia.org/wiki/User_Datagram_Protocol
     //65,507 bytes (65,535 − 8 byte UDP header − 20 byte IP header).
     static constexpr const size_t UDP_PACKET_MAX_SIZE=65507;
     JavaVM* javaVm;
 	std::chrono::steady_clock::time_point lastReceivedPacket{};
 	AvgCalculator avgDeltaBetweenPackets;
+    // Once per receive call (one datagram or one batch): avgDeltaBetweenPackets and the spin window below
+    void addReceiveGap();
+	BaseAvgCalculator<float> avgBatchSize;
 	const bool ENABLE_NONBLOCKING;
+    // 0 means spin-then-block is disabled
+    std::chrono::microseconds mMaxSpin{0};
+    bool mAdaptiveSpin=true;
+    int mBusyPollUs=0;
+    std::atomic<long> mSpinBudgetNs{0};
+    // Gaps since the last budget adaptation, receiver thread only
+    long nSpinWindowGaps=0;
+    long nSpinWindowShortGaps=0;
+    std::chrono::nanoseconds sumSpinWindowShortGaps{0};
+    // Receives that returned data while spinning / blocking receives (after the budget ran out or with a budget of 0)
+    std::atomic<uint64_t> nSpinHits{0};
+    std::atomic<uint64_t> nSpinMisses{0};
+    static constexpr long SPIN_ADAPT_N_SAMPLES=64;
+    static constexpr int SPIN_BUDGET_FACTOR=2;
+    static constexpr long SPIN_MIN_SHORT_GAPS_PERCENT=50;
+    static constexpr std::chrono::microseconds SPIN_MIN_BUDGET{10};
+    // Receive buffers, allocated once per startReceiving()
+    std::unique_ptr<std::array<uint8_t,UDP_PACKET_MAX_SIZE>> mBuffer;
+    struct BatchBuffers{
+        std::vector<uint8_t> slots;
+        std::vector<mmsghdr> msgs;
+        std::vector<iovec> iovecs;
+        std::vector<sockaddr_in> sources;
+        std::vector<Datagram> datagrams;
+        std::vector<std::array<uint8_t,SocketHelper::CONTROL_BUFFER_SIZE>> controls;
+    };
+    BatchBuffers mBatchBuffers;
+    bool mIoUringEnabled=false;
+    bool mIoUringSqPoll=false;
+    unsigned mIoUringBuffers=256;
+    // Only used by the receiver thread, kept after stopReceiving() for getBackendReadable()
+    std::unique_ptr<IoUring> mIoUring;
+    std::string mIoUringFallbackReason;
+    uint64_t mIoUringNDatagrams=0;
+    // datagrams per batch callback if batched receive is not enabled
+    static constexpr size_t IO_URING_DEFAULT_BATCH_SIZE=32;
 };
 
 #endif // FPV_VR_UDPRECEIVER_H
\ No newline at end of file
@@ -0,0 +1,198 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#include "UDPReflector.h"
+#include "SocketHelper.hpp"
+#include "PacketInfoData.hpp"
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <vector>
+#include <array>
+
+//https://en.wikipedia.org/wiki/User_Datagram_Protocol
+static constexpr size_t UDP_PACKET_MAX_SIZE=65507;
+
+UDPReflector::UDPReflector(int port,int replyPort,size_t maxBatchSize):
+mPort(port),mReplyPort(replyPort),mMaxBatchSize(maxBatchSize){}
+
+UDPReflector::~UDPReflector() {
+    stop();
+}
+
+void UDPReflector::start() {
+    mSocket=socket(AF_INET,SOCK_DGRAM,IPPROTO_UDP);
+    if(mSocket<0){
+        MLOGE<<"Cannot create socket";
+        return;
+    }
+    int enable=1;
+    setsockopt(mSocket,SOL_SOCKET,SO_REUSEADDR,&enable,sizeof(int));
+    SocketHelper::enableKernelRxTimestamps(mSocket);
+    sockaddr_in myaddr{};
+    myaddr.sin_family=AF_INET;
+    myaddr.sin_addr.s_addr=htonl(INADDR_ANY);
+    myaddr.sin_port=htons(mPort);
+    if(bind(mSocket,(sockaddr*)&myaddr,sizeof(myaddr))==-1){
+        MLOGE<<"Error binding Port; "<<mPort;
+        close(mSocket);
+        mSocket=-1;
+        return;
+    }
+    running=true;
+    mThread=std::make_unique<std::thread>([this]{loop();});
+}
+
+void UDPReflector::stop() {
+    if(mThread==nullptr)return;
+    running=false;
+    //this stops the recvmmsg even if in blocking mode
+    shutdown(mSocket,SHUT_RD);
+    mThread->join();
+    mThread.reset();
+    close(mSocket);
+    mSocket=-1;
+}
+
+uint64_t UDPReflector::getNReflectedPackets() const {
+    return nReflectedPackets;
+}
+
+LatencyHistogram UDPReflector::getProcessingTime() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return processingTime;
+}
+
+void UDPReflector::loop() {
+    // Everything is allocated once, the loop itself does not allocate
+    std::vector<uint8_t> slots(mMaxBatchSize*UDP_PACKET_MAX_SIZE);
+    std::vector<mmsghdr> rxMsgs(mMaxBatchSize);
+    std::vector<mmsghdr> txMsgs(mMaxBatchSize);
+    std::vector<iovec> rxIovecs(mMaxBatchSize);
+    std::vector<iovec> txIovecs(mMaxBatchSize);
+    std::vector<sockaddr_in> sources(mMaxBatchSize);
+    std::vector<std::array<uint8_t,SocketHelper::CONTROL_BUFFER_SIZE>> controls(mMaxBatchSize);
+    std::vector<std::chrono::steady_clock::time_point> rxTimestamps(mMaxBatchSize);
+    for(size_t i=0;i<mMaxBatchSize;i++){
+        rxIovecs[i].iov_base=&slots[i*UDP_PACKET_MAX_SIZE];
+        rxIovecs[i].iov_len=UDP_PACKET_MAX_SIZE;
+    }
+    while(running){
+        for(size_t i=0;i<mMaxBatchSize;i++){
+            msghdr& hdr=rxMsgs[i].msg_hdr;
+            memset(&hdr,0,sizeof(msghdr));
+            hdr.msg_iov=&rxIovecs[i];
+            hdr.msg_iovlen=1;
+            hdr.msg_name=&sources[i];
+            hdr.msg_namelen=sizeof(sockaddr_in);
+            hdr.msg_control=controls[i].data();
+            hdr.msg_controllen=SocketHelper::CONTROL_BUFFER_SIZE;
+        }
+        const int nMessages=recvmmsg(mSocket,rxMsgs.data(),mMaxBatchSize,MSG_WAITFORONE,nullptr);
+        // After shutdown() recvmmsg returns a single empty message
+        if(nMessages<=0 || rxMsgs[0].msg_len==0){
+            continue;
+        }
+        int nToSend=0;
+        for(int i=0;i<nMessages;i++){
+            const auto* data=(const uint8_t*)rxIovecs[i].iov_base;
+            const size_t size=rxMsgs[i].msg_len;
+            if(size==sizeof(ReflectorStatsRequest)){
+                ReflectorStatsRequest request{};
+                memcpy(&request,data,sizeof(request));
+                if(request.magic==ReflectorStatsRequest::MAGIC){
+                    answerStatsRequest(request,sources[i]);
+                    continue;
+                }
+            }
+            rxTimestamps[nToSend]=SocketHelper::getKernelRxTimestamp(rxMsgs[i].msg_hdr);
+            if(mReplyPort!=0){
+                sources[i].sin_port=htons(mReplyPort);
+            }
+            txIovecs[nToSend]={rxIovecs[i].iov_base,size};
+            msghdr& hdr=txMsgs[nToSend].msg_hdr;
+            memset(&hdr,0,sizeof(msghdr));
+            hdr.msg_iov=&txIovecs[nToSend];
+            hdr.msg_iovlen=1;
+            hdr.msg_name=&sources[i];
+            hdr.msg_namelen=sizeof(sockaddr_in);
+            nToSend++;
+        }
+        // Test packets carry the time until now, such that the originating side can subtract it from each round trip
+        const auto beforeSend=std::chrono::steady_clock::now();
+        for(int i=0;i<nToSend;i++){
+            auto* data=(uint8_t*)txIovecs[i].iov_base;
+            if(txIovecs[i].iov_len>=sizeof(PacketInfoData) && data[0]==PacketInfoData::VERSION){
+                PacketInfo::writeReflectorHold(data,beforeSend-rxTimestamps[i]);
+            }
+        }
+        int nSent=0;
+        while(nSent<nToSend){
+            const int result=sendmmsg(mSocket,&txMsgs[nSent],nToSend-nSent,0);
+            if(result<=0){
+                MLOGE<<"Cannot reflect "<<strerror(errno);
+                break;
+            }
+            nSent+=result;
+        }
+        const auto now=std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(mMutex);
+        for(int i=0;i<nSent;i++){
+            processingTime.add(std::max(std::chrono::nanoseconds(0),std::chrono::duration_cast<std::chrono::nanoseconds>(now-rxTimestamps[i])));
+        }
+        nReflectedPackets+=nSent;
+    }
+}
+
+void UDPReflector::answerStatsRequest(const ReflectorStatsRequest& request,const sockaddr_in& source) {
+    ReflectorStatsResponse response{};
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        response.magic=ReflectorStatsRequest::MAGIC;
+        response.nPackets=processingTime.getNSamples();
+        response.avg=processingTime.getAvg().count();
+        response.p50=processingTime.getPercentile(50).count();
+        response.p90=processingTime.getPercentile(90).count();
+        response.p99=processingTime.getPercentile(99).count();
+        response.p999=processingTime.getPercentile(99.9).count();
+        response.max=processingTime.getMax().count();
+        if(request.flags & ReflectorStatsRequest::FLAG_RESET){
+            processingTime.reset();
+        }
+    }
+    // stats always go back to the source port of the request
+    sendto(mSocket,&response,sizeof(response),0,(const sockaddr*)&source,sizeof(sockaddr_in));
+}
+
+bool UDPReflector::requestStats(const std::string& ip,const int port,ReflectorStatsResponse& response,const bool reset,
+                                const std::chrono::milliseconds timeout) {
+    const int sockfd=socket(AF_INET,SOCK_DGRAM,IPPROTO_UDP);
+    if(sockfd<0){
+        return false;
+    }
+    sockaddr_in address{};
+    address.sin_family=AF_INET;
+    address.sin_port=htons(port);
+    inet_pton(AF_INET,ip.c_str(),&address.sin_addr);
+    const auto timeoutUs=std::chrono::duration_cast<std::chrono::microseconds>(timeout).count();
+    timeval tv{};
+    tv.tv_sec=timeoutUs/1000000;
+    tv.tv_usec=timeoutUs%1000000;
+    setsockopt(sockfd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+    ReflectorStatsRequest request{ReflectorStatsRequest::MAGIC,reset ? ReflectorStatsRequest::FLAG_RESET : 0};
+    bool success=false;
+    if(connect(sockfd,(sockaddr*)&address,sizeof(address))==0 && send(sockfd,&request,sizeof(request),0)==sizeof(request)){
+        success=recv(sockfd,&response,sizeof(response),0)==sizeof(response) && response.magic==ReflectorStatsRequest::MAGIC;
+    }
+    close(sockfd);
+    return success;
+}
+
+std::string UDPReflector::statsReadable(const ReflectorStatsResponse& response) {
+    std::stringstream ss;
+    ss<<"avg="<<MyTimeHelper::ReadableNS(response.avg)<<" p50="<<MyTimeHelper::ReadableNS(response.p50)
+    <<" p90="<<MyTimeHelper::ReadableNS(response.p90)<<" p99="<<MyTimeHelper::ReadableNS(response.p99)
+    <<" p99.9="<<MyTimeHelper::ReadableNS(response.p999)<<" max="<<MyTimeHelper::ReadableNS(response.max)
+    <<" N samples="<<response.nPackets;
+    return ss.str();
+}
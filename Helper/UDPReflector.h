@@ -0,0 +1,76 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_UDPREFLECTOR_H
+#define OPENHDTESTING_UDPREFLECTOR_H
+
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <netinet/in.h>
+#include "TimeHelper.hpp"
+
+// Sent to the reflector port to get (and optionally reset) the processing time histogram of the reflector
+struct ReflectorStatsRequest{
+    // 'RFST', can never be the first bytes of a PacketInfoData
+    static constexpr uint32_t MAGIC=0x54534652;
+    static constexpr uint32_t FLAG_RESET=1;
+    uint32_t magic;
+    uint32_t flags;
+} __attribute__ ((packed));
+
+// Answer to ReflectorStatsRequest, all times in ns
+struct ReflectorStatsResponse{
+    uint32_t magic;
+    uint64_t nPackets;
+    int64_t avg;
+    int64_t p50;
+    int64_t p90;
+    int64_t p99;
+    int64_t p999;
+    int64_t max;
+} __attribute__ ((packed));
+
+/**
+ * Echoes every datagram received on @param port back to the sender, such that the originating side can measure
+ * the round trip time with its own clock (no clock synchronization needed).
+ * Uses recvmmsg / sendmmsg on preallocated buffers, no allocations after start().
+ * The time each packet spends inside the reflector (kernel rx timestamp until sendmmsg returned) goes into
+ * a histogram that can be queried with requestStats(). Test packets (PacketInfoData) additionally carry their own
+ * hold time (until right before sendmmsg) back, such that the round trip can be corrected per packet.
+ */
+class UDPReflector{
+public:
+    /**
+     * @param replyPort: 0 to reply to the source port of each packet, else reply to the source ip on this port
+     * (e.g. where the UDPReceiver of the originating side listens)
+     */
+    UDPReflector(int port,int replyPort=0,size_t maxBatchSize=32);
+    ~UDPReflector();
+    void start();
+    void stop();
+    uint64_t getNReflectedPackets()const;
+    LatencyHistogram getProcessingTime()const;
+    // Ask the reflector at ip:port for its stats. Returns false on timeout
+    static bool requestStats(const std::string& ip,int port,ReflectorStatsResponse& response,bool reset=false,
+                             std::chrono::milliseconds timeout=std::chrono::milliseconds(500));
+    static std::string statsReadable(const ReflectorStatsResponse& response);
+private:
+    void loop();
+    void answerStatsRequest(const ReflectorStatsRequest& request,const sockaddr_in& source);
+    const int mPort;
+    const int mReplyPort;
+    const size_t mMaxBatchSize;
+    int mSocket=-1;
+    std::atomic<bool> running=false;
+    std::unique_ptr<std::thread> mThread;
+    std::atomic<uint64_t> nReflectedPackets=0;
+    // written by the reflector thread, read on stats request and by getProcessingTime()
+    mutable std::mutex mMutex;
+    LatencyHistogram processingTime;
+};
+
+#endif //OPENHDTESTING_UDPREFLECTOR_H
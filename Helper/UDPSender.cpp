@@ -11,9 +11,16 @@
 #include <endian.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <netinet/udp.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 #include <cstring>
 #include "AndroidLogger.hpp"
 #include "StringHelper.hpp"
+#include <sstream>
+
+// sendmmsg() does not accept more than UIO_MAXIOV messages in one call
+static constexpr size_t MAX_MESSAGES_PER_SENDMMSG=1024;
 
 
 UDPSender::UDPSender(const std::string &IP,const int Port,const int WANTED_SNDBUFF_SIZE):
@@ -44,11 +51,17 @@ UDPSender::UDPSender(const std::string &IP,const int Port,const int WANTED_SNDBU
 }
 
 void UDPSender::mySendTo(const uint8_t* data, ssize_t data_length) {
-    if(data_length>UDP_PACKET_MAX_SIZE){
+    if(data_length>(ssize_t)UDP_PACKET_MAX_SIZE){
         MLOGE<<"Data size exceeds UDP packet size";
         return;
     }
+    if(mIoUring){
+        const Packet packet{data,(size_t)data_length};
+        sendIoUring(&packet,1);
+        return;
+    }
     nSentBytes+=data_length;
+    nSentPackets++;
     // Measure the time this call takes (is there some funkiness ? )
     timeSpentSending.start();
     const auto result= sendto(sockfd, data, data_length, 0, (struct sockaddr *) &(address),
@@ -59,16 +72,400 @@ void UDPSender::mySendTo(const uint8_t* data, ssize_t data_length) {
         //MLOGD<<"Sent "<<data_length;
     }
     timeSpentSending.stop();
+    if(onTxTimestamp!=nullptr){
+        pollTxTimestamps();
+    }
     //if(timeSpentSending.getNSamples()>100){
         //MLOGD<<"TimeSS "<<timeSpentSending.getAvgReadable();
     //    timeSpentSending.reset();
     //}
 }
+void UDPSender::mySendToBatch(const Packet packets[],const size_t count) {
+    if(mIoUring){
+        sendIoUring(packets,count);
+        return;
+    }
+    if(msgs.size()<count){
+        msgs.resize(count);
+        iovecs.resize(count);
+    }
+    for(size_t i=0;i<count;i++){
+        if(packets[i].size>UDP_PACKET_MAX_SIZE){
+            MLOGE<<"Data size exceeds UDP packet size";
+            return;
+        }
+        iovecs[i].iov_base=(void*)packets[i].data;
+        iovecs[i].iov_len=packets[i].size;
+        msghdr& hdr=msgs[i].msg_hdr;
+        memset(&hdr,0,sizeof(msghdr));
+        hdr.msg_name=&address;
+        hdr.msg_namelen=sizeof(sockaddr_in);
+        hdr.msg_iov=&iovecs[i];
+        hdr.msg_iovlen=1;
+    }
+    size_t nSent=0;
+    while(nSent<count){
+        const unsigned int nToSend=std::min(count-nSent,MAX_MESSAGES_PER_SENDMMSG);
+        timeSpentSending.start();
+        const int result=sendmmsg(sockfd,&msgs[nSent],nToSend,0);
+        timeSpentSending.stop();
+        if(result<0){
+            MLOGE<<"Cannot send data (sendmmsg) "<<nToSend<<" "<<strerror(errno);
+            return;
+        }
+        for(int i=0;i<result;i++){
+            nSentBytes+=packets[nSent+i].size;
+        }
+        nSentPackets+=result;
+        nSent+=result;
+    }
+    if(onTxTimestamp!=nullptr){
+        pollTxTimestamps();
+    }
+}
+
+void UDPSender::mySendToBatchGather(const iovec iovs[],const size_t iovsPerPacket,const size_t count) {
+    if(msgs.size()<count){
+        msgs.resize(count);
+    }
+    for(size_t i=0;i<count;i++){
+        msghdr& hdr=msgs[i].msg_hdr;
+        memset(&hdr,0,sizeof(msghdr));
+        hdr.msg_name=&address;
+        hdr.msg_namelen=sizeof(sockaddr_in);
+        // sendmmsg does not write to the iovecs
+        hdr.msg_iov=(iovec*)&iovs[i*iovsPerPacket];
+        hdr.msg_iovlen=iovsPerPacket;
+    }
+    size_t nSent=0;
+    while(nSent<count){
+        const unsigned int nToSend=std::min(count-nSent,MAX_MESSAGES_PER_SENDMMSG);
+        timeSpentSending.start();
+        const int result=sendmmsg(sockfd,&msgs[nSent],nToSend,0);
+        timeSpentSending.stop();
+        if(result<0){
+            MLOGE<<"Cannot send data (sendmmsg) "<<nToSend<<" "<<strerror(errno);
+            return;
+        }
+        for(int i=0;i<result;i++){
+            nSentBytes+=msgs[nSent+i].msg_len;
+        }
+        nSentPackets+=result;
+        nSent+=result;
+    }
+    if(onTxTimestamp!=nullptr){
+        pollTxTimestamps();
+    }
+}
+
+void UDPSender::mySendToGSO(const Packet packets[],const size_t count) {
+    if(count==0)return;
+    const size_t segmentSize=packets[0].size;
+    for(size_t i=0;i<count-1;i++){
+        if(packets[i].size!=segmentSize){
+            MLOGE<<"GSO needs packets of equal size, only the last one may be smaller";
+            mySendToBatch(packets,count);
+            return;
+        }
+    }
+    if(!gsoSupported || segmentSize==0 || packets[count-1].size>segmentSize){
+        mySendToBatch(packets,count);
+        return;
+    }
+    // The total size of all segments together must still fit into one (virtual) UDP packet
+    const size_t maxSegmentsPerSend=std::max((size_t)1,std::min(UDP_MAX_GSO_SEGMENTS,UDP_PACKET_MAX_SIZE/segmentSize));
+    if(iovecs.size()<maxSegmentsPerSend){
+        iovecs.resize(maxSegmentsPerSend);
+    }
+    // Control message that holds the segment size
+    union{
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        cmsghdr align;
+    } control{};
+    size_t nSent=0;
+    while(nSent<count){
+        const size_t nToSend=std::min(count-nSent,maxSegmentsPerSend);
+        size_t nBytes=0;
+        for(size_t i=0;i<nToSend;i++){
+            iovecs[i].iov_base=(void*)packets[nSent+i].data;
+            iovecs[i].iov_len=packets[nSent+i].size;
+            nBytes+=packets[nSent+i].size;
+        }
+        msghdr hdr{};
+        hdr.msg_name=&address;
+        hdr.msg_namelen=sizeof(sockaddr_in);
+        hdr.msg_iov=iovecs.data();
+        hdr.msg_iovlen=nToSend;
+        // A single segment does not need GSO (and the kernel would reject segment size == total size on some versions)
+        if(nToSend>1){
+            hdr.msg_control=control.buf;
+            hdr.msg_controllen=sizeof(control.buf);
+            cmsghdr* cm=CMSG_FIRSTHDR(&hdr);
+            cm->cmsg_level=SOL_UDP;
+            cm->cmsg_type=UDP_SEGMENT;
+            cm->cmsg_len=CMSG_LEN(sizeof(uint16_t));
+            *((uint16_t*)CMSG_DATA(cm))=(uint16_t)segmentSize;
+        }
+        timeSpentSending.start();
+        const auto result=sendmsg(sockfd,&hdr,0);
+        timeSpentSending.stop();
+        if(result<0){
+            if(errno==EIO || errno==EINVAL || errno==ENOPROTOOPT){
+                // EIO: the outgoing device cannot do checksum offload, EINVAL/ENOPROTOOPT: kernel without UDP_SEGMENT
+                MLOGE<<"GSO not supported ("<<strerror(errno)<<"), falling back to sendmmsg";
+                gsoSupported=false;
+                mySendToBatch(&packets[nSent],count-nSent);
+            }else{
+                MLOGE<<"Cannot send data (GSO) "<<nBytes<<" "<<strerror(errno);
+            }
+            return;
+        }
+        nSentBytes+=nBytes;
+        nSentPackets+=nToSend;
+        nSent+=nToSend;
+    }
+    if(onTxTimestamp!=nullptr){
+        pollTxTimestamps();
+    }
+}
+
+bool UDPSender::enableTxTime() {
+    // fq uses CLOCK_MONOTONIC, same as steady_clock
+    const sock_txtime txTimeConfig{CLOCK_MONOTONIC,0};
+    if(setsockopt(sockfd,SOL_SOCKET,SO_TXTIME,&txTimeConfig,sizeof(txTimeConfig))<0){
+        MLOGE<<"Cannot enable SO_TXTIME "<<strerror(errno);
+        return false;
+    }
+    txTimeEnabled=true;
+    return true;
+}
+
+void UDPSender::mySendToAt(const uint8_t* data,ssize_t data_length,const std::chrono::steady_clock::time_point txTime) {
+    if(!txTimeEnabled){
+        mySendTo(data,data_length);
+        return;
+    }
+    if(data_length>(ssize_t)UDP_PACKET_MAX_SIZE){
+        MLOGE<<"Data size exceeds UDP packet size";
+        return;
+    }
+    nSentBytes+=data_length;
+    nSentPackets++;
+    iovec iov{(void*)data,(size_t)data_length};
+    union{
+        char buf[CMSG_SPACE(sizeof(uint64_t))];
+        cmsghdr align;
+    } control{};
+    msghdr hdr{};
+    hdr.msg_name=&address;
+    hdr.msg_namelen=sizeof(sockaddr_in);
+    hdr.msg_iov=&iov;
+    hdr.msg_iovlen=1;
+    hdr.msg_control=control.buf;
+    hdr.msg_controllen=sizeof(control.buf);
+    cmsghdr* cm=CMSG_FIRSTHDR(&hdr);
+    cm->cmsg_level=SOL_SOCKET;
+    cm->cmsg_type=SCM_TXTIME;
+    cm->cmsg_len=CMSG_LEN(sizeof(uint64_t));
+    const uint64_t txTimeNs=std::chrono::duration_cast<std::chrono::nanoseconds>(txTime.time_since_epoch()).count();
+    memcpy(CMSG_DATA(cm),&txTimeNs,sizeof(txTimeNs));
+    timeSpentSending.start();
+    const auto result=sendmsg(sockfd,&hdr,0);
+    timeSpentSending.stop();
+    if(result<0){
+        MLOGE<<"Cannot send data (txtime) "<<data_length<<" "<<strerror(errno);
+    }
+    if(onTxTimestamp!=nullptr){
+        pollTxTimestamps();
+    }
+}
+
+void UDPSender::enableKernelTxTimestamps(TX_TIMESTAMP_CALLBACK onTxTimestamp1) {
+    // OPT_ID numbers the datagrams, OPT_TSONLY avoids looping the whole packet back on the error queue
+    const int flags=SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    if(setsockopt(sockfd,SOL_SOCKET,SO_TIMESTAMPING,&flags,sizeof(flags))<0){
+        MLOGE<<"Cannot enable kernel tx timestamps "<<strerror(errno);
+        return;
+    }
+    onTxTimestamp=std::move(onTxTimestamp1);
+}
+
+void UDPSender::pollTxTimestamps() {
+    std::array<uint8_t,256> control{};
+    while(true){
+        msghdr hdr{};
+        hdr.msg_control=control.data();
+        hdr.msg_controllen=control.size();
+        if(recvmsg(sockfd,&hdr,MSG_ERRQUEUE | MSG_DONTWAIT)<0){
+            // EAGAIN, error queue is empty
+            return;
+        }
+        // Each message holds the timestamp and a sock_extended_err with the packet index
+        std::chrono::steady_clock::time_point timestamp{};
+        bool hasTimestamp=false;
+        uint32_t packetIndex=0;
+        bool hasIndex=false;
+        for(cmsghdr* cm=CMSG_FIRSTHDR(&hdr);cm!=nullptr;cm=CMSG_NXTHDR(&hdr,cm)){
+            if(cm->cmsg_level==SOL_SOCKET && cm->cmsg_type==SCM_TIMESTAMPING){
+                scm_timestamping ts{};
+                memcpy(&ts,CMSG_DATA(cm),sizeof(ts));
+                timestamp=MyTimeHelper::realtimeToSteady(ts.ts[0]);
+                hasTimestamp=true;
+            }else if(cm->cmsg_level==SOL_IP && cm->cmsg_type==IP_RECVERR){
+                sock_extended_err err{};
+                memcpy(&err,CMSG_DATA(cm),sizeof(err));
+                if(err.ee_origin==SO_EE_ORIGIN_TIMESTAMPING){
+                    packetIndex=err.ee_data;
+                    hasIndex=true;
+                }
+            }
+        }
+        if(hasTimestamp && hasIndex){
+            onTxTimestamp(packetIndex,timestamp);
+        }
+    }
+}
+
 void UDPSender::logSendtoDelay() {
-    MLOGD<<"Time UDPSender "<<timeSpentSending.getAvgReadable()<<"\n";
+    MLOGD<<"Time UDPSender "<<timeSpentSending.getAvgReadable()<<" per packet "<<MyTimeHelper::R(getAvgSendDelayPerPacket())<<"\n";
+}
+
+std::chrono::nanoseconds UDPSender::getAvgSendDelayPerPacket()const{
+    if(nSentPackets==0)return std::chrono::nanoseconds(0);
+    return timeSpentSending.getAvg()*timeSpentSending.getNSamples()/nSentPackets;
+}
+
+
+bool UDPSender::enableIoUring(const bool sqPoll,const unsigned nBuffers,const size_t maxDatagramSize) {
+    if(!IoUring::isSupported()){
+        MLOGE<<"No io_uring, using sendto / sendmmsg";
+        return false;
+    }
+#ifdef HAVE_IO_URING
+    auto ring=std::make_unique<IoUring>(nBuffers,sqPoll);
+    if(!ring->isValid()){
+        return false;
+    }
+    mIoUringBufferSize=std::min(maxDatagramSize,UDP_PACKET_MAX_SIZE);
+    mIoUringBufferMemory.resize(nBuffers*mIoUringBufferSize);
+    // One msghdr per buffer, it has to stay valid until the send completed. The destination goes into msg_name,
+    // the socket stays unconnected for the other send methods
+    mIoUringIovecs.resize(nBuffers);
+    mIoUringMsgs.resize(nBuffers);
+    for(unsigned i=0;i<nBuffers;i++){
+        mIoUringIovecs[i]={&mIoUringBufferMemory[i*mIoUringBufferSize],0};
+        mIoUringMsgs[i]={};
+        mIoUringMsgs[i].msg_name=&address;
+        mIoUringMsgs[i].msg_namelen=sizeof(address);
+        mIoUringMsgs[i].msg_iov=&mIoUringIovecs[i];
+        mIoUringMsgs[i].msg_iovlen=1;
+    }
+    mIoUringFreeBuffers.clear();
+    for(unsigned i=0;i<nBuffers;i++){
+        mIoUringFreeBuffers.push_back((uint16_t)i);
+    }
+    mIoUring=std::move(ring);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void UDPSender::sendIoUring(const Packet packets[],const size_t count) {
+#ifdef HAVE_IO_URING
+    timeSpentSending.start();
+    size_t nQueued=0;
+    for(size_t i=0;i<count;i++){
+        if(packets[i].size>mIoUringBufferSize){
+            // Skipped, but the other packets of the batch still go out
+            MLOGE<<"Data size exceeds io_uring buffer size";
+            mIoUringNFailedSends++;
+            continue;
+        }
+        io_uring_sqe* sqe=nullptr;
+        while(mIoUringFreeBuffers.empty() || (sqe=mIoUring->getSqe())==nullptr){
+            // Hand what we have to the kernel and wait for a buffer
+            if(nQueued>0){
+                nQueued=0;
+                mIoUring->submit();
+            }
+            if(!reapIoUring(true)){
+                break;
+            }
+        }
+        if(sqe==nullptr){
+            MLOGE<<"Dropping "<<(count-i)<<" packets, no io_uring buffer became free";
+            mIoUringNFailedSends+=count-i;
+            break;
+        }
+        const uint16_t bufferId=mIoUringFreeBuffers.back();
+        mIoUringFreeBuffers.pop_back();
+        iovec& iov=mIoUringIovecs[bufferId];
+        memcpy(iov.iov_base,packets[i].data,packets[i].size);
+        iov.iov_len=packets[i].size;
+        sqe->opcode=IORING_OP_SENDMSG;
+        sqe->fd=sockfd;
+        sqe->addr=(uint64_t)&mIoUringMsgs[bufferId];
+        sqe->len=1;
+        sqe->user_data=bufferId;
+        nQueued++;
+        nSentBytes+=packets[i].size;
+        nSentPackets++;
+    }
+    if(nQueued>0){
+        mIoUring->submit();
+    }
+    reapIoUring(false);
+    timeSpentSending.stop();
+    if(onTxTimestamp!=nullptr){
+        pollTxTimestamps();
+    }
+#endif
 }
 
+bool UDPSender::reapIoUring(const bool wait) {
+#ifdef HAVE_IO_URING
+    if(wait && !mIoUring->waitCqe(std::chrono::seconds(1))){
+        MLOGE<<"io_uring send did not complete";
+        return false;
+    }
+    mIoUring->forEachCqe([this](const io_uring_cqe& cqe){
+        if(cqe.res<0){
+            if(mIoUringNFailedSends==0){
+                MLOGE<<"Cannot send data (io_uring) "<<strerror(-cqe.res);
+            }
+            mIoUringNFailedSends++;
+        }
+        mIoUringFreeBuffers.push_back((uint16_t)cqe.user_data);
+    });
+#endif
+    return true;
+}
+
+void UDPSender::flush() {
+    if(!mIoUring)return;
+    const size_t nBuffers=mIoUringBufferMemory.size()/mIoUringBufferSize;
+    while(mIoUringFreeBuffers.size()<nBuffers){
+        if(!reapIoUring(true)){
+            return;
+        }
+    }
+}
+
+std::string UDPSender::getBackendReadable()const{
+    if(!mIoUring){
+        return "classic";
+    }
+    std::stringstream ss;
+    ss<<"io_uring"<<(mIoUring->isSqPoll() ? " sqpoll" : "")<<" syscalls per datagram "
+    <<(nSentPackets==0 ? 0.0 : (double)mIoUring->getNSyscalls()/nSentPackets)<<" failed "<<mIoUringNFailedSends;
+    return ss.str();
+}
+
+uint64_t UDPSender::getNFailedSends()const{
+    return mIoUringNFailedSends;
+}
 
 UDPSender::~UDPSender() {
-    //TODO
+    flush();
 }
@@ -8,13 +8,23 @@
 #include <string>
 #include <arpa/inet.h>
 #include <array>
+#include <vector>
+#include <functional>
+#include <memory>
 #include "TimeHelper.hpp"
+#include "IoUring.h"
 
 /**
  * Allows sending UDP data on the current thread. No extra thread for sending is created (make sure to not call mySendTo() on the UI thread)
  */
 class UDPSender{
 public:
+    // One packet of a batch. Does not own the data
+    struct Packet{
+        const uint8_t* data;
+        size_t size;
+    };
+    typedef std::function<void(uint32_t packetIndex,std::chrono::steady_clock::time_point kernelTxTimestamp)> TX_TIMESTAMP_CALLBACK;
     /**
      * Construct a UDP sender that sends UDP data packets
      * @param IP ipv4 address to send data to
@@ -28,17 +38,85 @@ public:
     // Do not rename to sendto() because this method also exists from the linux socket lib
     // (This method does nothing else than validate the data size, then call sendto()
     void mySendTo(const uint8_t* data, ssize_t data_length);
+    // Send @param count udp packets with as few sendmmsg() calls as possible (one call for up to 1024 packets)
+    // Each packet becomes its own datagram, same as calling mySendTo() for each of them
+    void mySendToBatch(const Packet packets[],size_t count);
+    // Same as mySendToBatch(), but datagram i is gathered from the @param iovsPerPacket buffers starting at iovs[i*iovsPerPacket]
+    // (e.g. a header and a slice of a large payload), such that the payload does not have to be copied into one buffer first
+    void mySendToBatchGather(const iovec iovs[],size_t iovsPerPacket,size_t count);
+    // Send @param count packets of equal size using UDP generic segmentation offload (UDP_SEGMENT).
+    // The kernel splits one big buffer into datagrams of packets[0].size bytes, only the last packet may be smaller.
+    // One syscall carries up to UDP_MAX_GSO_SEGMENTS datagrams, e.g. a whole video frame of 1466 byte packets.
+    // Falls back to mySendToBatch() if the kernel / NIC does not support GSO
+    void mySendToGSO(const Packet packets[],size_t count);
+    /**
+     * Enable SO_TXTIME. Needs the fq qdisc on the outgoing interface (tc qdisc replace dev eth0 root fq),
+     * without it the kernel ignores the transmit time. Returns false if the kernel does not support SO_TXTIME
+     */
+    bool enableTxTime();
+    // Same as mySendTo(), but the kernel releases the packet at @param txTime (see enableTxTime())
+    void mySendToAt(const uint8_t* data, ssize_t data_length,std::chrono::steady_clock::time_point txTime);
     //https://en.wikipedia.org/wiki/User_Datagram_Protocol
     //65,507 bytes (65,535 − 8 byte UDP header − 20 byte IP header).
     static constexpr const size_t UDP_PACKET_MAX_SIZE=65507;
     std::size_t nSentBytes=0;
     static constexpr std::size_t EXAMPLE_MEDIUM_SNDBUFF_SIZE=1024*1024;
+    /**
+     * Enable SO_TIMESTAMPING software transmit timestamps. The kernel reports the time each datagram left the network stack
+     * (handed to the driver) on the socket error queue. @param onTxTimestamp1 is called with the index of the packet
+     * (counting every send call from 0, one per datagram for mySendTo) and the timestamp converted to steady_clock.
+     */
+    void enableKernelTxTimestamps(TX_TIMESTAMP_CALLBACK onTxTimestamp1);
+    // Read all pending tx timestamps from the error queue. Called after each send call when tx timestamps are enabled,
+    // but timestamps might be generated after the send call returned. Call this once more after the last packet.
+    void pollTxTimestamps();
+    /**
+     * Send mySendTo() / mySendToBatch() with io_uring instead of sendto() / sendmmsg(). Each datagram is copied into one
+     * of @param nBuffers buffers (of @param maxDatagramSize) and queued as IORING_OP_SENDMSG with the destination in
+     * msg_name, one batch is one submission. The calls return once the datagrams are queued, buffers are reused when
+     * their completion was reaped. The datagrams are independent sqes (not linked), a failed send does not cancel the
+     * rest of the batch. The kernel issues them in submission order, only a send that has to wait for socket buffer space
+     * can complete after later ones.
+     * With @param sqPoll a kernel thread picks up the submissions and a send does not need any syscall (while that
+     * thread is busy). The other send methods keep using their syscalls on the same socket.
+     * Returns false and keeps the classic backend if the kernel has no io_uring
+     */
+    bool enableIoUring(bool sqPoll=false,unsigned nBuffers=256,size_t maxDatagramSize=UDP_PACKET_MAX_SIZE);
+    // Wait until the kernel completed all queued io_uring sends (no-op for the classic backend)
+    void flush();
+    // "classic" or "io_uring" with the n of syscalls per datagram and failed sends
+    std::string getBackendReadable()const;
+    // io_uring only: datagrams that were not sent (see mIoUringNFailedSends)
+    uint64_t getNFailedSends()const;
 	void logSendtoDelay();
+	// Average time spent inside the send syscall(s) divided by the n of packets they carried
+	std::chrono::nanoseconds getAvgSendDelayPerPacket()const;
+	// Kernel limit for the n of segments in one GSO send (UDP_MAX_SEGMENTS in linux/udp.h)
+	static constexpr const size_t UDP_MAX_GSO_SEGMENTS=64;
 private:
     int sockfd;
     sockaddr_in address{};
+    // Measures the time each send syscall takes (one sample per syscall, not per packet)
     Chronometer timeSpentSending;
+    std::size_t nSentPackets=0;
+    bool gsoSupported=true;
+    bool txTimeEnabled=false;
+    TX_TIMESTAMP_CALLBACK onTxTimestamp=nullptr;
+    // reused between calls to mySendToBatch() / mySendToGSO() to not allocate on each call
+    std::vector<mmsghdr> msgs;
+    std::vector<iovec> iovecs;
     const int WANTED_SNDBUFF_SIZE;
+    void sendIoUring(const Packet packets[],size_t count);
+    // Free the buffers of all completed sends, with @param wait block until at least one completed (false on timeout)
+    bool reapIoUring(bool wait);
+    std::unique_ptr<IoUring> mIoUring;
+    std::vector<uint8_t> mIoUringBufferMemory;
+    std::vector<iovec> mIoUringIovecs;
+    std::vector<msghdr> mIoUringMsgs;
+    size_t mIoUringBufferSize=0;
+    std::vector<uint16_t> mIoUringFreeBuffers;
+    // Sends that failed in the kernel, were too big for a buffer or dropped because no buffer became free
+    uint64_t mIoUringNFailedSends=0;
 };
 
 
@@ -0,0 +1,90 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_VIDEOTRAFFICGENERATOR_HPP
+#define OPENHDTESTING_VIDEOTRAFFICGENERATOR_HPP
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include "AndroidLogger.hpp"
+
+// Frame sizes of an encoded video stream (e.g. h264). Either from a simple GOP model (one big key frame followed by
+// gopLength-1 small frames, each varying randomly around its mean) or replayed from a recorded list of frame sizes.
+class VideoTrafficGenerator{
+public:
+    struct Frame{
+        uint32_t frameIdx;
+        uint32_t size;
+        bool keyFrame;
+    };
+    struct GOPModel{
+        int fps=30;
+        int bitrateKbit=8000;
+        // one key frame every gopLength frames
+        int gopLength=30;
+        // size of a key frame relative to the other frames
+        float keyFrameRatio=8.0f;
+        // each frame is up to +-variation of its mean size
+        float variation=0.2f;
+        uint32_t seed=0;
+    };
+    explicit VideoTrafficGenerator(const GOPModel& model):model(model),random(model.seed){
+        // gopLength*avg = keyFrame + (gopLength-1)*frame with keyFrame=keyFrameRatio*frame
+        const double avgFrameSize=model.bitrateKbit*1000.0/8.0/model.fps;
+        frameSize=avgFrameSize*model.gopLength/(model.keyFrameRatio+model.gopLength-1);
+    }
+    // Replay @param frameSizes (in a loop) at @param fps, a frame of at least twice the average size counts as key frame
+    VideoTrafficGenerator(std::vector<uint32_t> frameSizes,const int fps):recordedFrameSizes(std::move(frameSizes)){
+        model.fps=fps;
+        double avg=0;
+        for(const auto size:recordedFrameSizes){
+            avg+=size;
+        }
+        frameSize=recordedFrameSizes.empty() ? 0 : avg/recordedFrameSizes.size();
+    }
+    // One frame size in bytes per line
+    static bool loadFrameSizes(const std::string& fileName,std::vector<uint32_t>& frameSizes){
+        std::ifstream file(fileName);
+        if(!file){
+            MLOGE<<"Cannot open "<<fileName;
+            return false;
+        }
+        uint32_t size;
+        while(file>>size){
+            frameSizes.push_back(size);
+        }
+        return !frameSizes.empty();
+    }
+    Frame nextFrame(){
+        const uint32_t frameIdx=nFrames++;
+        if(!recordedFrameSizes.empty()){
+            const uint32_t size=recordedFrameSizes[frameIdx%recordedFrameSizes.size()];
+            return {frameIdx,size,size>=2*frameSize};
+        }
+        const bool keyFrame=frameIdx%model.gopLength==0;
+        const double mean=keyFrame ? frameSize*model.keyFrameRatio : frameSize;
+        std::uniform_real_distribution<double> distribution(1.0-model.variation,1.0+model.variation);
+        return {frameIdx,(uint32_t)std::max(1.0,mean*distribution(random)),keyFrame};
+    }
+    std::chrono::nanoseconds getFrameInterval()const{
+        return std::chrono::nanoseconds(1000*1000*1000/model.fps);
+    }
+    int getFps()const{
+        return model.fps;
+    }
+private:
+    GOPModel model;
+    std::mt19937 random;
+    std::vector<uint32_t> recordedFrameSizes;
+    // mean size of a non key frame (GOP model) or of all frames (recorded)
+    double frameSize=0;
+    uint32_t nFrames=0;
+};
+
+#endif //OPENHDTESTING_VIDEOTRAFFICGENERATOR_HPP
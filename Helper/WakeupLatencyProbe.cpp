@@ -0,0 +1,68 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#include "WakeupLatencyProbe.h"
+#include <ctime>
+
+WakeupLatencyProbe::WakeupLatencyProbe(std::chrono::microseconds interval):mInterval(interval){}
+
+WakeupLatencyProbe::~WakeupLatencyProbe() {
+    stop();
+}
+
+void WakeupLatencyProbe::start(const LinuxThreadHelper::Config& threadConfig) {
+    running=true;
+    mThread=std::make_unique<std::thread>([this,threadConfig]{loop(threadConfig);});
+}
+
+void WakeupLatencyProbe::stop() {
+    if(mThread==nullptr)return;
+    running=false;
+    mThread->join();
+    mThread.reset();
+}
+
+void WakeupLatencyProbe::loop(const LinuxThreadHelper::Config& threadConfig) {
+    {
+        const auto readable=LinuxThreadHelper::apply(threadConfig);
+        std::lock_guard<std::mutex> lock(mMutex);
+        scheduling=readable;
+    }
+    const long intervalNs=std::chrono::duration_cast<std::chrono::nanoseconds>(mInterval).count();
+    timespec next{};
+    clock_gettime(CLOCK_MONOTONIC,&next);
+    while(running){
+        next.tv_nsec+=intervalNs;
+        while(next.tv_nsec>=1000000000L){
+            next.tv_nsec-=1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&next,nullptr);
+        timespec now{};
+        clock_gettime(CLOCK_MONOTONIC,&now);
+        const int64_t latencyNs=(now.tv_sec-next.tv_sec)*1000000000LL+(now.tv_nsec-next.tv_nsec);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            wakeupLatency.add(std::chrono::nanoseconds(std::max(latencyNs,(int64_t)0)));
+        }
+        // Like cyclictest, deadlines that were missed completely are skipped instead of measured as immediate wakeups
+        if(latencyNs>intervalNs){
+            next=now;
+        }
+    }
+}
+
+LatencyHistogram WakeupLatencyProbe::getWakeupLatency() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return wakeupLatency;
+}
+
+std::chrono::microseconds WakeupLatencyProbe::getInterval() const {
+    return mInterval;
+}
+
+std::string WakeupLatencyProbe::getSchedulingReadable() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return scheduling;
+}
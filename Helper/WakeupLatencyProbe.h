@@ -0,0 +1,42 @@
+//
+// Created by consti10 on 17.10.20.
+//
+
+#ifndef OPENHDTESTING_WAKEUPLATENCYPROBE_H
+#define OPENHDTESTING_WAKEUPLATENCYPROBE_H
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include "TimeHelper.hpp"
+#include "LinuxThreadHelper.h"
+
+/**
+ * cyclictest like probe: a thread sleeps until an absolute deadline (clock_nanosleep, CLOCK_MONOTONIC) every interval
+ * and records how late it woke up. Run it during a measurement with the same scheduling policy and priority as the
+ * receiver thread, then a high wakeup latency tail shows that the scheduler (not the network stack) is the cause of a
+ * high UDP latency tail. Replaces the manual perf sched record / perf sched latency step.
+ */
+class WakeupLatencyProbe{
+public:
+    explicit WakeupLatencyProbe(std::chrono::microseconds interval=std::chrono::microseconds(1000));
+    ~WakeupLatencyProbe();
+    // The probe thread applies @param threadConfig to itself, pass the config of the receiver thread to mirror it
+    void start(const LinuxThreadHelper::Config& threadConfig=LinuxThreadHelper::Config{});
+    void stop();
+    LatencyHistogram getWakeupLatency()const;
+    std::chrono::microseconds getInterval()const;
+    // e.g. "SCHED_FIFO priority 50, cpus 2", what the probe thread actually runs with
+    std::string getSchedulingReadable()const;
+private:
+    void loop(const LinuxThreadHelper::Config& threadConfig);
+    const std::chrono::microseconds mInterval;
+    std::atomic<bool> running=false;
+    std::unique_ptr<std::thread> mThread;
+    mutable std::mutex mMutex;
+    LatencyHistogram wakeupLatency;
+    std::string scheduling="not started";
+};
+
+#endif //OPENHDTESTING_WAKEUPLATENCYPROBE_H
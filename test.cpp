@@ -3,19 +3,52 @@
 #include "TimeHelper.hpp"
 #include "UDPSender.h"
 #include "UDPReceiver.h"
+#include "Pacer.h"
+#include "PacketInfoData.hpp"
+#include "ClockSync.h"
+#include "UDPReflector.h"
+#include "ResultFile.hpp"
+#include "PacketTrace.hpp"
+#include "SequenceTracker.hpp"
+#include "LinkEmulator.h"
+#include "FEC.h"
+#include "GF256.hpp"
+#include "VideoTrafficGenerator.hpp"
+#include "Fragmentation.h"
+#include "WakeupLatencyProbe.h"
+#include "LinuxThreadHelper.h"
+#include "InlineUDPReceiver.hpp"
+#include "EventLoop.h"
+#include "ReceiverGroup.h"
 #include <cstring>
+#include <cerrno>
+#include <limits>
 #include <atomic>
-#include <mutex>
+#include <fstream>
 #include <sys/time.h>
 #include <sys/resource.h>
 
-static void printCurrentThreadPriority(const std::string name){
-	int which = PRIO_PROCESS;
-    id_t pid = (id_t)getpid();
-    int priority= getpriority(which, pid);
-	MLOGD<<name<<" has priority "<<priority<<"\n";
+// Counts all heap allocations except the ones of threads that opt out (the sending main thread), used by -m alloc
+// to check that the receive path does not allocate per packet
+static std::atomic<uint64_t> nHeapAllocations{0};
+static thread_local bool ignoreHeapAllocations=false;
+void* operator new(std::size_t size){
+    if(!ignoreHeapAllocations){
+        nHeapAllocations.fetch_add(1,std::memory_order_relaxed);
+    }
+    void* p=malloc(size==0 ? 1 : size);
+    if(p==nullptr){
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void operator delete(void* p)noexcept{
+    free(p);
 }
-	
+void operator delete(void* p,std::size_t)noexcept{
+    free(p);
+}
+
 static void fillBufferWithRandomData(std::vector<uint8_t>& data){
     const std::size_t size=data.size();
     for(std::size_t i=0;i<size;i++){
@@ -29,126 +62,379 @@ std::vector<uint8_t> createRandomDataBuffer(const ssize_t sizeBytes){
   fillBufferWithRandomData(buf);
   return buf;
 }
-// same as above but return shared ptr
-std::shared_ptr<std::vector<uint8_t>> createRandomDataBuffer2(const ssize_t sizeBytes){
-  auto buf=std::make_shared<std::vector<uint8_t>>(sizeBytes);
-  fillBufferWithRandomData(*buf);
-  return buf;
-}
 
-struct PacketInfoData{
-    uint32_t seqNr;
-    std::chrono::steady_clock::time_point timestamp;
-} __attribute__ ((packed));
-//static_assert(sizeof(PacketInfoData)==4+8);
-
-uint32_t currentSequenceNumber=0;
-
-void writeSequenceNumberAndTimestamp(std::vector<uint8_t>& data){
-    assert(data.size()>=sizeof(PacketInfoData));
-    PacketInfoData* packetInfoData=(PacketInfoData*)data.data();
-    packetInfoData->seqNr=currentSequenceNumber;
-    packetInfoData->timestamp= std::chrono::steady_clock::now();
+// Counter based pseudo random generator (splitmix64 finalizer). Each 8 byte word of a payload only depends on
+// the sequence number of the packet and the word index. This way the receiver can regenerate the payload
+// of any packet and compare it without storing a copy of each sent packet.
+static uint64_t payloadWord(const uint32_t seqNr,const uint64_t wordIndex){
+    uint64_t z=((uint64_t)seqNr<<32 | wordIndex)+0x9E3779B97F4A7C15ULL;
+    z=(z ^ (z>>30))*0xBF58476D1CE4E5B9ULL;
+    z=(z ^ (z>>27))*0x94D049BB133111EBULL;
+    return z ^ (z>>31);
 }
 
-PacketInfoData getSequenceNumberAndTimestamp(const std::vector<uint8_t>& data){
-    assert(data.size()>=sizeof(PacketInfoData));
-    PacketInfoData packetInfoData;
-    std::memcpy(&packetInfoData,data.data(),sizeof(PacketInfoData));
-    return packetInfoData;
+// Fill the whole buffer with the payload for seqNr
+static void fillBufferWithPayload(uint8_t* data,const std::size_t size,const uint32_t seqNr){
+    for(std::size_t offset=0;offset<size;offset+=sizeof(uint64_t)){
+        const uint64_t word=payloadWord(seqNr,offset/sizeof(uint64_t));
+        std::memcpy(&data[offset],&word,std::min(sizeof(uint64_t),size-offset));
+    }
 }
+static void fillBufferWithPayload(std::vector<uint8_t>& data,const uint32_t seqNr){
+    fillBufferWithPayload(data.data(),data.size(),seqNr);
+}
+
+uint32_t currentSequenceNumber=0;
 
-// Returns true if everyhting except the first couble of bytes (PacketInfoData) match
+// Returns true if everything except the first couple of bytes (PacketInfoData) matches the payload generated for seqNr
 // first couple of bytes are the PacketInfoData (which is written after creating the packet)
-bool compareSentAndReceivedPacket(const std::vector<uint8_t>& sb,const std::vector<uint8_t>& rb){
-    if(sb.size()!=rb.size()){
-        return false;
+static bool verifyPayload(const uint8_t* data,const std::size_t size,const uint32_t seqNr){
+    for(std::size_t wordBegin=0;wordBegin<size;wordBegin+=sizeof(uint64_t)){
+        const uint64_t word=payloadWord(seqNr,wordBegin/sizeof(uint64_t));
+        const std::size_t begin=std::max(wordBegin,sizeof(PacketInfoData));
+        const std::size_t end=std::min(wordBegin+sizeof(uint64_t),size);
+        if(begin>=end)continue;
+        if(std::memcmp(&data[begin],((const uint8_t*)&word)+(begin-wordBegin),end-begin)!=0){
+            return false;
+        }
     }
-    const int result=memcmp (&sb.data()[sizeof(PacketInfoData)],&rb.data()[sizeof(PacketInfoData)],sb.size()-sizeof(PacketInfoData));
-    return result==0;
+    return true;
 }
 
 struct Options{
-    const int PACKET_SIZE=1466;
-    const int WANTED_PACKETS_PER_SECOND=1024;
-    const int N_PACKETS=WANTED_PACKETS_PER_SECOND*5;
-    const int INPUT_PORT=6001;
-    const int OUTPUT_PORT=6001;
+    int PACKET_SIZE=1466;
+    int WANTED_PACKETS_PER_SECOND=1024;
+    int N_PACKETS=WANTED_PACKETS_PER_SECOND*5;
+    int INPUT_PORT=6001;
+    int OUTPUT_PORT=6001;
 	// Default to localhost
-	const std::string DESTINATION_IP="127.0.0.1";
+	std::string DESTINATION_IP="127.0.0.1";
+	// 0 = one recvfrom() per datagram, else use recvmmsg() with up to n datagrams per call
+	int RECEIVE_BATCH_SIZE=0;
+	// Use SO_TIMESTAMPING on sender and receiver to split the latency into stages
+	bool KERNEL_TIMESTAMPS=false;
+	// How the sender waits between packets
+	Pacer::Strategy PACING=Pacer::Strategy::NANOSLEEP;
+	// Written into each packet, the receiver ignores packets with a different stream id
+	uint16_t STREAM_ID=0;
+	// Estimate the offset between the tx and rx clock with pings on CLOCK_SYNC_PORT and use it for one way latency
+	bool CLOCK_SYNC=false;
+	int CLOCK_SYNC_PORT=6003;
+	// Added to the clock of the tx side (the timestamps written into the packets) to test the clock sync on one machine
+	std::chrono::nanoseconds CLOCK_OFFSET{0};
+	// Send to a UDPReflector (test -m reflect) at DESTINATION_IP instead, latency is then the round trip time
+	bool ROUND_TRIP=false;
+	int REFLECTOR_PORT=6004;
+	// If set, the receiver writes one record per packet into this file (memory mapped), see test -m analyze
+	std::string TRACE_FILE{};
+	// test -m emulate relays from this port to DESTINATION_IP:INPUT_PORT (in place of wfb_tx / wfb_rx)
+	int EMULATOR_PORT=6002;
+	LinkEmulatorConfig EMULATOR_CONFIG{};
+	// 0 = no FEC, else each block of FEC_K packets gets FEC_N-FEC_K parity packets (like wfb -k -n)
+	int FEC_K=0;
+	int FEC_N=0;
+	// Close a block early if its first packet is older than this (0 = never)
+	std::chrono::milliseconds FEC_TIMEOUT{0};
+	// Send video frames (see test_video) instead of a constant packet rate
+	bool VIDEO=false;
+	VideoTrafficGenerator::GOPModel VIDEO_MODEL{};
+	// If set, the frame sizes are replayed from this file instead of the GOP model
+	std::string VIDEO_FRAME_SIZES_FILE{};
+	// Send each video frame as one payload through FragmentingSender / ReassemblingReceiver
+	bool FRAGMENTATION=false;
+	// 0 = off, else run a WakeupLatencyProbe with this interval next to the receiver during test_latency
+	std::chrono::microseconds WAKEUP_PROBE_INTERVAL{0};
+	// Real-time scheduling / affinity / memory locking of the receiver thread and of the sending (main) thread
+	LinuxThreadHelper::Config RECEIVER_THREAD_CONFIG{};
+	LinuxThreadHelper::Config SENDER_THREAD_CONFIG{};
+	// The consumer thread of DECOUPLED_CAPACITY
+	LinuxThreadHelper::Config CONSUMER_THREAD_CONFIG{};
+	// 0 = data callback on the receiver thread, else on a consumer thread behind a DatagramRing of this capacity
+	size_t DECOUPLED_CAPACITY=0;
+	DatagramRing::Policy DECOUPLED_POLICY=DatagramRing::Policy::DROP_OLDEST;
+	// 0 = blocking receive, else spin up to this long after each datagram (adaptive, see UDPReceiver::enableAdaptiveSpin)
+	std::chrono::microseconds RECEIVER_MAX_SPIN{0};
+	int RECEIVER_BUSY_POLL_US=0;
 };
 
-// Use this to validate received data (mutex for thread safety)
-struct SentDataSave{
-    std::vector<std::shared_ptr<std::vector<uint8_t>>> sentPackets;
-    std::mutex mMutex;
-};
-SentDataSave sentDataSave{};
-AvgCalculator2 avgUDPProcessingTime{0};
+// Fixed memory, no matter how many packets are sent
+LatencyHistogram avgUDPProcessingTime;
 //AvgCalculator avgUDPProcessingTime;
-std::uint32_t lastReceivedSequenceNr=0;
+// Latency of the last 500ms for the live log. The window is only touched by the receiver thread (no allocation,
+// no printing there), which publishes a snapshot every 100ms that the sending thread logs about once per second
+struct LiveLatency{
+    WindowedAvgCalculator window{std::chrono::milliseconds(500),32768};
+    std::chrono::steady_clock::time_point lastPublish{};
+    std::atomic<uint64_t> minNs{0};
+    std::atomic<uint64_t> maxNs{0};
+    std::atomic<uint64_t> avgNs{0};
+    std::atomic<uint64_t> nSamples{0};
+    std::chrono::steady_clock::time_point lastLog{};
+    void add(const std::chrono::nanoseconds latency,const std::chrono::steady_clock::time_point now){
+        window.add(latency,now);
+        if(now-lastPublish<std::chrono::milliseconds(100))return;
+        lastPublish=now;
+        minNs.store(window.getMin(now).count(),std::memory_order_relaxed);
+        maxNs.store(window.getMax(now).count(),std::memory_order_relaxed);
+        avgNs.store(window.getAvg(now).count(),std::memory_order_relaxed);
+        nSamples.store(window.getNSamples(now),std::memory_order_relaxed);
+    }
+    void logIfDue(){
+        const auto now=std::chrono::steady_clock::now();
+        if(now-lastLog<std::chrono::seconds(1))return;
+        lastLog=now;
+        const uint64_t n=nSamples.exchange(0);
+        if(n==0)return;
+        std::cout<<"Live (last 500ms) min="<<MyTimeHelper::R(std::chrono::nanoseconds(minNs.load()))<<" max="<<MyTimeHelper::R(std::chrono::nanoseconds(maxNs.load()))
+        <<" avg="<<MyTimeHelper::R(std::chrono::nanoseconds(avgNs.load()))<<" N samples="<<n<<"\n";
+    }
+    // Only while the receiver thread does not add samples
+    void reset(){
+        window.reset();
+        lastPublish={};
+        nSamples=0;
+        lastLog=std::chrono::steady_clock::now();
+    }
+};
+LiveLatency liveUDPProcessingTime;
 const bool COMPARE_RECEIVED_DATA=true;
-std::vector<int> lostPacketsSeqNrDiffs;
+// lost / reordered / duplicate packets and the loss burst lengths
+SequenceTracker sequenceTracker;
 std::size_t receivedPackets=0;
 std::size_t receivedBytes=0;
+std::size_t nCorruptedPackets=0;
+uint16_t expectedStreamId=0;
+// Packets that failed the header validation (size,version or crc), per reason
+std::array<std::size_t,4> nInvalidPackets{};
+std::size_t nForeignStreamPackets=0;
+// Set when the tx side uses a different clock, converts the tx timestamps into the local clock
+std::unique_ptr<ClockSyncClient> clockSyncClient;
+// Set when a trace file was requested
+std::unique_ptr<PacketTraceWriter> packetTrace;
 
 static void validateReceivedData(const uint8_t* dataP,size_t data_length){
+    // Before the checksum, like the sender takes its timestamp after it
+    const auto rxTimestamp=std::chrono::steady_clock::now();
+    const auto validation=PacketInfo::validate(dataP,data_length);
+    if(validation!=PacketInfo::Validation::VALID){
+        nInvalidPackets[(int)validation]++;
+        // The header itself is only usable if the payload was corrupted
+        if(validation!=PacketInfo::Validation::INVALID_CRC){
+            return;
+        }
+    }
+    const auto info=PacketInfo::read(dataP);
+    if(info.streamId!=expectedStreamId){
+        nForeignStreamPackets++;
+        return;
+    }
     receivedPackets++;
 	receivedBytes+=data_length;
-    const auto data=std::vector<uint8_t>(dataP,dataP+data_length);
-    const auto info=getSequenceNumberAndTimestamp(data);
-    const auto latency=std::chrono::steady_clock::now()-info.timestamp;
-	if(latency>std::chrono::milliseconds(1)){
-        std::cout<<"XGot data"<<data_length<<" "<<info.seqNr<<" "<<MyTimeHelper::R(latency)<<"\n";
-	}
-    //MLOGD<<"XGot data"<<data_length<<" "<<info.seqNr<<" "<<MyTimeHelper::R(latency)<<"\n";
+    const auto txTimestamp=clockSyncClient ? clockSyncClient->remoteToLocal(info.getTimestamp()) : info.getTimestamp();
+    // An error in the clock offset estimation can make the one way latency of the fastest packets negative.
+    // For a round trip the time inside the reflector is not part of the latency
+    const auto latency=std::max(rxTimestamp-txTimestamp-info.getReflectorHold(),std::chrono::steady_clock::duration(0));
     // do not use the first couple of packets, system needs to ramp up first
     //if(info.seqNr>10){
         avgUDPProcessingTime.add(latency);
     //}
-    if(lastReceivedSequenceNr!=0){
-        const auto delta=info.seqNr-lastReceivedSequenceNr;
-        if(delta!=1){
-            std::cout<<"Missing a packet though FEC "<<delta<<"\n";
-			lostPacketsSeqNrDiffs.push_back(delta);
+    liveUDPProcessingTime.add(latency,rxTimestamp);
+    sequenceTracker.add(info.seqNr);
+    uint32_t traceFlags=validation==PacketInfo::Validation::INVALID_CRC ? PacketTraceRecord::FLAG_INVALID_CRC : 0;
+    if(COMPARE_RECEIVED_DATA){
+        // The payload is a function of the sequence number, no need to keep the sent packets around
+        if(!verifyPayload(dataP,data_length,info.seqNr)){
+            //Also this should never happen !
+            std::cout<<"Packets do not match ! "<<info.seqNr<<"\n";
+            nCorruptedPackets++;
+            traceFlags|=PacketTraceRecord::FLAG_CORRUPTED;
         }
     }
-    lastReceivedSequenceNr=info.seqNr;
-    if(COMPARE_RECEIVED_DATA){
-       sentDataSave.mMutex.lock();
-       if((info.seqNr<sentDataSave.sentPackets.size()) && sentDataSave.sentPackets.at(info.seqNr)!=nullptr){
-           const auto originalPacketData=sentDataSave.sentPackets.at(info.seqNr);
-           if(!compareSentAndReceivedPacket(*originalPacketData,data)){
-                //Also this should never happen !
-               std::cout<<"Packets do not match !"<<"\n";
-           }else{
-                //std::cout<<"Packets do match"<<"\n";
-           }
-           // Free memory such that we do not run out of RAM (once received,we do not need the packet a second time)
-           //originalPacketData.at(info.seqNr)->reset();
-       }else{
-            // Should never happen
-            MLOGE<<"Got probably invalid seqNr "<<info.seqNr<<" "<<sentDataSave.sentPackets.size()<<"\n";
-       }
-       sentDataSave.mMutex.unlock();
+    if(packetTrace){
+        packetTrace->add({info.seqNr,(uint32_t)data_length,std::chrono::duration_cast<std::chrono::nanoseconds>(txTimestamp.time_since_epoch()).count(),
+                          std::chrono::duration_cast<std::chrono::nanoseconds>(rxTimestamp.time_since_epoch()).count(),traceFlags});
+    }
+}
+
+// Per packet time points of each stage, only recorded when kernel timestamps are enabled.
+// Indexed by sequence number and allocated once for all packets of the test run
+struct LatencyStages{
+    // written into the packet right before sendto()
+    std::vector<std::chrono::steady_clock::time_point> userTx;
+    // the kernel handed the packet to the (loopback) driver, from the sender socket error queue
+    std::vector<std::chrono::steady_clock::time_point> kernelTx;
+    // the kernel received the packet, from the receiver socket
+    std::vector<std::chrono::steady_clock::time_point> kernelRx;
+    // the receive callback was called
+    std::vector<std::chrono::steady_clock::time_point> userRx;
+    void reset(const std::size_t nPackets){
+        for(auto* v:{&userTx,&kernelTx,&kernelRx,&userRx}){
+            v->assign(nPackets,std::chrono::steady_clock::time_point{});
+        }
+    }
+};
+LatencyStages latencyStages{};
+
+static void validateReceivedDataTimestamped(const uint8_t* dataP,size_t data_length,std::chrono::steady_clock::time_point kernelRxTimestamp){
+    const auto now=std::chrono::steady_clock::now();
+    if(data_length>=sizeof(PacketInfoData)){
+        PacketInfoData info;
+        std::memcpy(&info,dataP,sizeof(PacketInfoData));
+        if(info.seqNr<latencyStages.userRx.size()){
+            latencyStages.userTx[info.seqNr]=clockSyncClient ? clockSyncClient->remoteToLocal(info.getTimestamp()) : info.getTimestamp();
+            latencyStages.kernelRx[info.seqNr]=kernelRxTimestamp;
+            latencyStages.userRx[info.seqNr]=now;
+        }
+    }
+    validateReceivedData(dataP,data_length);
+}
+
+// Split the latency of each packet into send syscall (user tx -> kernel tx), network (kernel tx -> kernel rx)
+// and receiver wakeup (kernel rx -> user callback) and print the breakdown of the worst packets
+static void printLatencyStages(){
+    AvgCalculator sendSyscall,kernelTxToRx,kernelRxToUser;
+    std::vector<std::size_t> completeSeqNrs;
+    const auto positive=[](const std::chrono::steady_clock::duration d){
+        // realtime->steady conversion is done on different threads, very small stages might become slightly negative
+        return std::max(std::chrono::nanoseconds(0),std::chrono::duration_cast<std::chrono::nanoseconds>(d));
+    };
+    const auto& s=latencyStages;
+    for(std::size_t i=0;i<s.userRx.size();i++){
+        if(s.kernelTx[i]==std::chrono::steady_clock::time_point{} || s.userRx[i]==std::chrono::steady_clock::time_point{}){
+            continue;
+        }
+        completeSeqNrs.push_back(i);
+        sendSyscall.add(positive(s.kernelTx[i]-s.userTx[i]));
+        kernelTxToRx.add(positive(s.kernelRx[i]-s.kernelTx[i]));
+        kernelRxToUser.add(positive(s.userRx[i]-s.kernelRx[i]));
+    }
+    std::cout<<"------- Latency stages ("<<completeSeqNrs.size()<<" packets with all timestamps) ------- \n";
+    std::cout<<"user tx   -> kernel tx "<<sendSyscall.getAvgReadable()<<"\n";
+    std::cout<<"kernel tx -> kernel rx "<<kernelTxToRx.getAvgReadable()<<"\n";
+    std::cout<<"kernel rx -> user rx   "<<kernelRxToUser.getAvgReadable()<<"\n";
+    const std::size_t nWorst=std::min((std::size_t)10,completeSeqNrs.size());
+    std::partial_sort(completeSeqNrs.begin(),completeSeqNrs.begin()+nWorst,completeSeqNrs.end(),[&s](std::size_t a,std::size_t b){
+        return (s.userRx[a]-s.userTx[a])>(s.userRx[b]-s.userTx[b]);
+    });
+    std::cout<<nWorst<<" highest latencies (total | send | kernel tx->rx | rx->user):\n";
+    for(std::size_t n=0;n<nWorst;n++){
+        const auto i=completeSeqNrs[n];
+        std::cout<<"seqNr "<<i<<" "<<MyTimeHelper::R(s.userRx[i]-s.userTx[i])<<" | "<<MyTimeHelper::R(positive(s.kernelTx[i]-s.userTx[i]))
+        <<" | "<<MyTimeHelper::R(positive(s.kernelRx[i]-s.kernelTx[i]))<<" | "<<MyTimeHelper::R(positive(s.userRx[i]-s.kernelRx[i]))<<"\n";
     }
 }
 
 static void test_latency(const Options& o){
-	printCurrentThreadPriority("TEST_MAIN");
-	
+	const std::string senderThreadConfig=LinuxThreadHelper::apply(o.SENDER_THREAD_CONFIG);
+
 	const std::chrono::nanoseconds TIME_BETWEEN_PACKETS=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::seconds(1))/o.WANTED_PACKETS_PER_SECOND;
     // start the receiver in its own thread
 	// Listening always happens on localhost
-    UDPReceiver udpReceiver{nullptr,o.INPUT_PORT,"LTUdpRec",0,validateReceivedData,0,false};
+    // The FEC stage sits between UDPSender and UDPReceiver, the test only sees the decoded packets
+    const bool fec=o.FEC_K>0;
+    std::unique_ptr<FECDecoder> fecDecoder;
+    if(fec){
+        fecDecoder=std::make_unique<FECDecoder>(o.FEC_K,o.FEC_N,o.PACKET_SIZE,validateReceivedData);
+    }
+    const auto onReceived=[&fecDecoder](const uint8_t* data,size_t size){
+        if(fecDecoder){
+            fecDecoder->processFragment(data,size);
+        }else{
+            validateReceivedData(data,size);
+        }
+    };
+    UDPReceiver udpReceiver{nullptr,o.INPUT_PORT,"LTUdpRec",0,onReceived,0,false};
+    udpReceiver.setThreadConfig(o.RECEIVER_THREAD_CONFIG);
+    if(o.RECEIVER_MAX_SPIN.count()>0){
+        udpReceiver.enableAdaptiveSpin(o.RECEIVER_MAX_SPIN,true,o.RECEIVER_BUSY_POLL_US);
+    }
+    if(o.DECOUPLED_CAPACITY>0){
+        udpReceiver.enableDecoupledCallback(o.DECOUPLED_CAPACITY,o.DECOUPLED_POLICY,o.PACKET_SIZE+(fec ? sizeof(FECFragmentHeader)+sizeof(uint16_t) : 0));
+        udpReceiver.setConsumerThreadConfig(o.CONSUMER_THREAD_CONFIG);
+    }
+    // The stages need one datagram per packet
+    const bool kernelTimestamps=o.KERNEL_TIMESTAMPS && !fec;
+    if(o.KERNEL_TIMESTAMPS && fec){
+        MLOGE<<"Kernel timestamps are not supported with FEC";
+    }
+    if(kernelTimestamps){
+        latencyStages.reset(o.N_PACKETS);
+        udpReceiver.enableKernelTimestamps(validateReceivedDataTimestamped);
+    }
+    if(o.RECEIVE_BATCH_SIZE>0){
+        udpReceiver.enableBatchedReceive(o.RECEIVE_BATCH_SIZE,[kernelTimestamps,&onReceived](const UDPReceiver::Datagram datagrams[],size_t count){
+            for(size_t i=0;i<count;i++){
+                if(kernelTimestamps){
+                    validateReceivedDataTimestamped(datagrams[i].data,datagrams[i].size,datagrams[i].kernelRxTimestamp);
+                }else{
+                    onReceived(datagrams[i].data,datagrams[i].size);
+                }
+            }
+        },o.PACKET_SIZE+(fec ? sizeof(FECFragmentHeader)+sizeof(uint16_t) : 0));
+    }
+    if(!o.TRACE_FILE.empty()){
+        // Room for each packet twice, in case of duplicates
+        packetTrace=std::make_unique<PacketTraceWriter>(o.TRACE_FILE,2*o.N_PACKETS);
+    }
     udpReceiver.startReceiving();
     // Wait a bit such that the OS can start the receiver before we start sending data
     std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    // Same thread config as the receiver, such that both see the same scheduler delays
+    WakeupLatencyProbe wakeupLatencyProbe{o.WAKEUP_PROBE_INTERVAL.count()>0 ? o.WAKEUP_PROBE_INTERVAL : std::chrono::microseconds(1000)};
+    if(o.WAKEUP_PROBE_INTERVAL.count()>0){
+        wakeupLatencyProbe.start(o.RECEIVER_THREAD_CONFIG);
+    }
 
-    UDPSender udpSender{o.DESTINATION_IP,o.OUTPUT_PORT};
+    // The tx side is the reference clock, the rx side (this receiver) estimates its offset. The local server answers
+    // when DESTINATION_IP is this host, for another host run -m syncserver there
+    ClockSyncServer clockSyncServer{o.CLOCK_SYNC_PORT,o.CLOCK_OFFSET};
+    if(o.CLOCK_SYNC){
+        clockSyncServer.start();
+        clockSyncClient=std::make_unique<ClockSyncClient>(o.DESTINATION_IP,o.CLOCK_SYNC_PORT);
+        clockSyncClient->start();
+        if(!clockSyncClient->waitForEstimate(std::chrono::seconds(2))){
+            MLOGE<<"No clock offset estimate, latency will be wrong";
+        }
+        std::cout<<"Clock sync "<<clockSyncClient->getEstimateReadable()<<"\n";
+    }
+
+    ReflectorStatsResponse reflectorStats{};
+    if(o.ROUND_TRIP){
+        // Only count the packets of this run in the reflector processing time
+        if(!UDPReflector::requestStats(o.DESTINATION_IP,o.REFLECTOR_PORT,reflectorStats,true)){
+            MLOGE<<"No reflector at "<<o.DESTINATION_IP<<":"<<o.REFLECTOR_PORT<<" (start it with -m reflect)";
+        }
+    }
+
+    UDPSender udpSender{o.DESTINATION_IP,o.ROUND_TRIP ? o.REFLECTOR_PORT : o.OUTPUT_PORT};
+    // Measure how precise each pacing strategy can hit the wanted time between packets on this system
+    Pacer::calibrateAll(TIME_BETWEEN_PACKETS);
+    Pacer pacer{o.PACING};
+    if(o.PACING==Pacer::Strategy::TXTIME){
+        udpSender.enableTxTime();
+    }
+    PacingJitter sendJitter{TIME_BETWEEN_PACKETS};
+    std::unique_ptr<FECEncoder> fecEncoder;
+    if(fec){
+        fecEncoder=std::make_unique<FECEncoder>(o.FEC_K,o.FEC_N,o.PACKET_SIZE,[&udpSender](const uint8_t data[],size_t size){
+            udpSender.mySendTo(data,size);
+        },o.FEC_TIMEOUT);
+    }
+    if(kernelTimestamps){
+        // One mySendTo() per packet, so the kernel packet index equals the sequence number
+        udpSender.enableKernelTxTimestamps([](uint32_t packetIndex,std::chrono::steady_clock::time_point kernelTxTimestamp){
+            if(packetIndex<latencyStages.kernelTx.size()){
+                latencyStages.kernelTx[packetIndex]=kernelTxTimestamp;
+            }
+        });
+    }
     currentSequenceNumber=0;
+    expectedStreamId=o.STREAM_ID;
     avgUDPProcessingTime.reset();
-    sentDataSave.sentPackets.clear();
+    liveUDPProcessingTime.reset();
+    sequenceTracker.reset();
+    // Reused for all packets
+    std::vector<uint8_t> buff(o.PACKET_SIZE);
     //
 
     const std::chrono::steady_clock::time_point testBegin=std::chrono::steady_clock::now();
@@ -156,32 +442,58 @@ static void test_latency(const Options& o){
     std:size_t writtenBytes=0;
     std::size_t writtenPackets=0;
     for(int i=0;i<o.N_PACKETS;i++){
-        auto buff=createRandomDataBuffer2(o.PACKET_SIZE);
-        // If enabled,store sent data for later validation
-        if(COMPARE_RECEIVED_DATA){
-            sentDataSave.mMutex.lock();
-            sentDataSave.sentPackets.push_back(buff);
-            sentDataSave.mMutex.unlock();
-        }
+        // wait until as much time is elapsed such that we hit the target packets per seconds
+        const auto timePointSendPacket=firstPacketTimePoint+i*TIME_BETWEEN_PACKETS;
+        pacer.waitUntil(timePointSendPacket);
+        fillBufferWithPayload(buff,currentSequenceNumber);
 		//write sequence number and timestamp after random data was created
 		//(We are not interested in the latency of creating random data,even though it is really fast)
-        writeSequenceNumberAndTimestamp(*buff);
-        udpSender.mySendTo(buff->data(),buff->size());
-        writtenBytes+=buff->size();
+        // With TXTIME the packet leaves at the deadline, not txTimeLead earlier when it is handed to the kernel
+        const bool txTime=o.PACING==Pacer::Strategy::TXTIME && !fecEncoder;
+        PacketInfo::write(buff.data(),buff.size(),o.STREAM_ID,currentSequenceNumber,o.CLOCK_OFFSET,
+                          txTime ? timePointSendPacket : std::chrono::steady_clock::time_point{});
+        if(fecEncoder){
+            // The parity goes out right after the last packet of a block, TXTIME is not used
+            sendJitter.add(std::chrono::steady_clock::now());
+            fecEncoder->encodePacket(buff.data(),buff.size());
+        }else if(o.PACING==Pacer::Strategy::TXTIME){
+            udpSender.mySendToAt(buff.data(),buff.size(),timePointSendPacket);
+        }else{
+            sendJitter.add(std::chrono::steady_clock::now());
+            udpSender.mySendTo(buff.data(),buff.size());
+        }
+        writtenBytes+=buff.size();
         writtenPackets+=1;
         currentSequenceNumber++;
-        // wait until as much time is elapsed such that we hit the target packets per seconds
-        const auto timePointReadyToSendNextPacket=firstPacketTimePoint+i*TIME_BETWEEN_PACKETS;
-        while(std::chrono::steady_clock::now()<timePointReadyToSendNextPacket){
-            //uncomment for busy wait (no scheduler interruption)
-			std::this_thread::sleep_for(std::chrono::microseconds(10));
-        }
+        liveUDPProcessingTime.logIfDue();
     }
     const auto testEnd=std::chrono::steady_clock::now();
+    if(fecEncoder){
+        fecEncoder->finishBlock();
+    }
     // Wait for any packet that might be still in transit
     std::this_thread::sleep_for(std::chrono::seconds(1));
+    wakeupLatencyProbe.stop();
     udpReceiver.stopReceiving();
+    if(fecDecoder){
+        // The receiver thread is stopped, the remaining packets go through validateReceivedData on this thread
+        fecDecoder->flush();
+    }
     udpSender.logSendtoDelay();
+    sequenceTracker.finish();
+    if(packetTrace){
+        std::cout<<"Trace "<<o.TRACE_FILE<<" "<<packetTrace->getNRecords()<<" records, dropped "<<packetTrace->getNDroppedRecords()<<"\n";
+        packetTrace.reset();
+    }
+    if(clockSyncClient){
+        std::cout<<"Clock sync "<<clockSyncClient->getEstimateReadable()<<" (artificial offset "<<MyTimeHelper::R(o.CLOCK_OFFSET)<<")\n";
+        clockSyncClient->stop();
+        clockSyncClient.reset();
+        clockSyncServer.stop();
+    }
+    if(kernelTimestamps){
+        udpSender.pollTxTimestamps();
+    }
 
     const double testTimeSeconds=(testEnd-testBegin).count()/1000.0f/1000.0f/1000.0f;
     const double actualPacketsPerSecond=(double)o.N_PACKETS/testTimeSeconds;
@@ -195,17 +507,1275 @@ static void test_latency(const Options& o){
    std::cout<<"Testing took:"<<testTimeSeconds<<"s\n";
    std::cout<<"WANTED_PACKETS_PER_SECOND "<<o.WANTED_PACKETS_PER_SECOND<<" Got "<<actualPacketsPerSecond<<
    "\nBITRATE: "<<actualMBytesPerSecond<<"MB/s"<<" ("<<(actualMBytesPerSecond*8)<<"MBit/s)"<<"\n";
+   if(o.RECEIVE_BATCH_SIZE>0){
+       std::cout<<"Avg datagrams per recvmmsg "<<udpReceiver.getAvgBatchSize()<<" (max "<<o.RECEIVE_BATCH_SIZE<<")\n";
+   }
    std::cout<<"N of packets sent | rec | diff ["<<writtenPackets<<" | "<<receivedPackets<<" | "<<nLostPackets<<"]\n";
+   if(COMPARE_RECEIVED_DATA){
+       std::cout<<"N of corrupted packets "<<nCorruptedPackets<<"\n";
+   }
+   std::cout<<"N of invalid packets (size | version | crc) ["<<nInvalidPackets[(int)PacketInfo::Validation::INVALID_SIZE]<<" | "
+   <<nInvalidPackets[(int)PacketInfo::Validation::INVALID_VERSION]<<" | "<<nInvalidPackets[(int)PacketInfo::Validation::INVALID_CRC]<<"]"
+   <<" other streams "<<nForeignStreamPackets<<"\n";
    //std::cout<<"N of bytes sent | rec | diff | perc lost ["<<writtenBytes<<" | "<<receivedBytes
    //<<" | "<<nLostBytes<<" | "<<lostBytesPercentage<<"]\n";
-    std::cout<<"LostPacketsSeqNrDiffs "<<StringHelper::vectorAsString(lostPacketsSeqNrDiffs)<<"\n";
+    std::cout<<"Sequence "<<sequenceTracker.getReadable()<<"\n";
+    std::cout<<sequenceTracker.getBurstHistogramReadable()<<"\n";
+    std::cout<<"------- Threads ------- \n";
+    std::cout<<"receiver "<<udpReceiver.getThreadConfigReadable()<<"\n";
+    std::cout<<"sender   "<<senderThreadConfig<<"\n";
+    if(o.DECOUPLED_CAPACITY>0){
+        std::cout<<"consumer "<<udpReceiver.getConsumerThreadConfigReadable()<<"\n";
+        std::cout<<"ring     "<<udpReceiver.getDecoupledStatsReadable()<<"\n";
+    }
     std::cout<<"------- Latency between (I<=>O) ------- \n";
     std::cout<<avgUDPProcessingTime.getAvgReadable()<<"\n";
-   //std::cout<<"All samples "<<avgUDPProcessingTime.getAllSamplesSortedAsString()<<"\n";
-   //std::cout<<"Low&high\n"<<avgUDPProcessingTime.getOnePercentLowHigh();
-    std::cout<<"Low&high\n"<<avgUDPProcessingTime.getNValuesLowHigh(20);
+    std::cout<<avgUDPProcessingTime.getPercentilesReadable()<<"\n";
+    std::cout<<"Histogram\n"<<avgUDPProcessingTime.getHistogramReadable();
+    if(o.WAKEUP_PROBE_INTERVAL.count()>0){
+        // A tail here, too, means the scheduler (not the network stack) caused the UDP latency tail
+        const auto wakeupLatency=wakeupLatencyProbe.getWakeupLatency();
+        std::cout<<"------- Scheduler wakeup latency (every "<<MyTimeHelper::R(o.WAKEUP_PROBE_INTERVAL)<<", "
+        <<wakeupLatencyProbe.getSchedulingReadable()<<") ------- \n";
+        std::cout<<wakeupLatency.getAvgReadable()<<"\n";
+        std::cout<<wakeupLatency.getPercentilesReadable()<<"\n";
+        std::cout<<"Histogram\n"<<wakeupLatency.getHistogramReadable();
+    }
+    if(o.ROUND_TRIP){
+        if(UDPReflector::requestStats(o.DESTINATION_IP,o.REFLECTOR_PORT,reflectorStats)){
+            // Already subtracted per packet from the latency above
+            std::cout<<"------- Reflector processing time ------- \n"<<UDPReflector::statsReadable(reflectorStats)<<"\n";
+        }else{
+            MLOGE<<"Cannot get reflector stats";
+        }
+    }
+    if(fec){
+        const auto fecStats=fecDecoder->getStats();
+        std::cout<<"------- FEC k="<<o.FEC_K<<" n="<<o.FEC_N<<" timeout="<<MyTimeHelper::R(o.FEC_TIMEOUT)<<" (simd "<<GF256::simdName()<<") ------- \n";
+        std::cout<<"blocks "<<fecEncoder->getNBlocks()<<" closed by timeout "<<fecEncoder->getNTimeouts()<<" encode per block "<<fecEncoder->getEncodeTime().getAvgReadable()<<"\n";
+        std::cout<<"fragments "<<fecStats.nFragments<<" invalid "<<fecStats.nInvalidFragments<<" recovered "<<fecStats.nRecovered<<" lost "<<fecStats.nLost<<" padding "<<fecStats.nPadding
+        <<" recovery rate "<<(fecStats.nRecovered+fecStats.nLost==0 ? 100.0 : 100.0*fecStats.nRecovered/(fecStats.nRecovered+fecStats.nLost))<<"%\n";
+        if(fecDecoder->getDecodeTime().getNSamples()>0){
+            std::cout<<"decode per block "<<fecDecoder->getDecodeTime().getAvgReadable()<<"\n";
+        }
+        std::cout<<"added latency (decoder hold time) "<<fecDecoder->getHoldTime().getPercentilesReadable()<<"\n";
+    }
+    std::cout<<"------- Pacing ("<<Pacer::strategyName(o.PACING)<<") ------- \n";
+    if(o.PACING!=Pacer::Strategy::TXTIME){
+        std::cout<<"user send "<<sendJitter.getReadable()<<"\n";
+    }
+    if(kernelTimestamps){
+        // The kernel tx timestamps show the spacing that actually went out (the only way to measure TXTIME)
+        PacingJitter kernelTxJitter{TIME_BETWEEN_PACKETS};
+        for(const auto& timePoint:latencyStages.kernelTx){
+            if(timePoint!=std::chrono::steady_clock::time_point{}){
+                kernelTxJitter.add(timePoint);
+            }
+        }
+        std::cout<<"kernel tx "<<kernelTxJitter.getReadable()<<"\n";
+        printLatencyStages();
+    }
 }
 
+// One frame of test_video. All frames are planned before the test starts, the receiver thread only reads them
+struct VideoFrameState{
+    std::chrono::steady_clock::time_point submitTime;
+    uint32_t firstSeqNr;
+    uint32_t nPackets;
+    uint32_t size;
+    bool keyFrame;
+};
+
+// Like test_latency, but the traffic is a video stream: each frame is split into packets of PACKET_SIZE that are
+// sent as one burst (sendmmsg) at the frame rate. The receiver counts the distinct packets of each frame and reports
+// the frame complete latency (last packet of a frame received - frame submitted), which is what the decoder sees.
+// With FRAGMENTATION each frame is one payload (sequence number = frame index) that goes through the
+// FragmentingSender and is put back together by the ReassemblingReceiver.
+static void test_video(const Options& o,VideoTrafficGenerator& generator,const int timeSeconds){
+    const int nFrames=generator.getFps()*timeSeconds;
+    const auto frameInterval=generator.getFrameInterval();
+    const bool fragmentation=o.FRAGMENTATION;
+    const uint32_t bytesPerPacket=fragmentation ? o.PACKET_SIZE-sizeof(FragmentHeader) : o.PACKET_SIZE;
+    // Leave some time to start the receiver
+    const auto firstFrameTime=std::chrono::steady_clock::now()+std::chrono::milliseconds(100);
+    std::vector<VideoFrameState> frames;
+    std::vector<uint32_t> frameOfSeqNr;
+    std::size_t totalBytes=0,totalPackets=0;
+    uint32_t maxPacketsPerFrame=1,maxFrameSize=sizeof(PacketInfoData);
+    for(int i=0;i<nFrames;i++){
+        const auto frame=generator.nextFrame();
+        const uint32_t size=std::max(frame.size,(uint32_t)sizeof(PacketInfoData));
+        const uint32_t nPackets=std::max((uint32_t)1,(size+bytesPerPacket-1)/bytesPerPacket);
+        frames.push_back({firstFrameTime+i*frameInterval,fragmentation ? i : (uint32_t)frameOfSeqNr.size(),nPackets,size,frame.keyFrame});
+        if(!fragmentation){
+            frameOfSeqNr.insert(frameOfSeqNr.end(),nPackets,i);
+        }
+        maxPacketsPerFrame=std::max(maxPacketsPerFrame,nPackets);
+        maxFrameSize=std::max(maxFrameSize,size);
+        totalBytes+=size;
+        totalPackets+=nPackets;
+    }
+    std::cout<<"Sending "<<nFrames<<" frames at "<<generator.getFps()<<" fps, "<<totalPackets<<" packets, "
+    <<(totalBytes*8.0/timeSeconds/1024/1024)<<" MBit/s, up to "<<maxPacketsPerFrame<<" packets per frame"
+    <<(fragmentation ? " (fragmentation)" : "")<<"\n";
+    // Only used by the receiver thread until it is stopped
+    std::vector<uint32_t> nReceivedPerFrame(nFrames,0);
+    // A duplicate must not count as another packet of its frame
+    std::vector<bool> receivedSeqNrs(frameOfSeqNr.size(),false);
+    LatencyHistogram frameLatency,keyFrameLatency;
+    expectedStreamId=o.STREAM_ID;
+    avgUDPProcessingTime.reset();
+    liveUDPProcessingTime.reset();
+    sequenceTracker.reset();
+    const auto onFrameComplete=[&](const uint32_t frameIdx){
+        const auto& frame=frames[frameIdx];
+        const auto latency=std::max(std::chrono::steady_clock::now()-frame.submitTime,std::chrono::steady_clock::duration(0));
+        frameLatency.add(latency);
+        if(frame.keyFrame){
+            keyFrameLatency.add(latency);
+        }
+    };
+    // Only the packet infos of complete frames reach validateReceivedData with fragmentation
+    ReassemblingReceiver reassembler{maxFrameSize,[&](const uint8_t* data,size_t size){
+        validateReceivedData(data,size);
+        if(size<sizeof(PacketInfoData))return;
+        const auto info=PacketInfo::read(data);
+        if(info.streamId!=o.STREAM_ID || info.seqNr>=frames.size())return;
+        if(nReceivedPerFrame[info.seqNr]==frames[info.seqNr].nPackets)return;
+        nReceivedPerFrame[info.seqNr]=frames[info.seqNr].nPackets;
+        onFrameComplete(info.seqNr);
+    }};
+    const auto onPacket=[&](const uint8_t* data,size_t size){
+        if(fragmentation){
+            reassembler.processDatagram(data,size);
+            return;
+        }
+        validateReceivedData(data,size);
+        if(size<sizeof(PacketInfoData))return;
+        const auto info=PacketInfo::read(data);
+        if(info.streamId!=o.STREAM_ID || info.seqNr>=frameOfSeqNr.size() || receivedSeqNrs[info.seqNr])return;
+        receivedSeqNrs[info.seqNr]=true;
+        const uint32_t frameIdx=frameOfSeqNr[info.seqNr];
+        if(++nReceivedPerFrame[frameIdx]==frames[frameIdx].nPackets){
+            onFrameComplete(frameIdx);
+        }
+    };
+    UDPReceiver udpReceiver{nullptr,o.INPUT_PORT,"VideoUdpRec",0,onPacket,o.PACKET_SIZE*maxPacketsPerFrame*4,false};
+    if(o.RECEIVE_BATCH_SIZE>0){
+        udpReceiver.enableBatchedReceive(o.RECEIVE_BATCH_SIZE,[&onPacket](const UDPReceiver::Datagram datagrams[],size_t count){
+            for(size_t i=0;i<count;i++){
+                onPacket(datagrams[i].data,datagrams[i].size);
+            }
+        },o.PACKET_SIZE);
+    }
+    udpReceiver.startReceiving();
+
+    UDPSender udpSender{o.DESTINATION_IP,o.OUTPUT_PORT,UDPSender::EXAMPLE_MEDIUM_SNDBUFF_SIZE};
+    FragmentingSender fragmentingSender{udpSender,(size_t)o.PACKET_SIZE};
+    Pacer pacer{o.PACING==Pacer::Strategy::TXTIME ? Pacer::Strategy::HYBRID : o.PACING};
+    // Reused for all frames
+    std::vector<uint8_t> frameBuffer(std::max(maxPacketsPerFrame*o.PACKET_SIZE,maxFrameSize));
+    std::vector<UDPSender::Packet> packets(maxPacketsPerFrame);
+    for(const auto& frame:frames){
+        pacer.waitUntil(frame.submitTime);
+        if(fragmentation){
+            // The whole frame is one payload, verified as a whole by the receiver
+            fillBufferWithPayload(frameBuffer.data(),frame.size,frame.firstSeqNr);
+            PacketInfo::write(frameBuffer.data(),frame.size,o.STREAM_ID,frame.firstSeqNr);
+            fragmentingSender.send(frameBuffer.data(),frame.size);
+            continue;
+        }
+        uint32_t remaining=frame.size;
+        for(uint32_t i=0;i<frame.nPackets;i++){
+            // The last packet of a frame is smaller, but always has room for the PacketInfoData
+            const size_t size=std::max(sizeof(PacketInfoData),(size_t)std::min(remaining,(uint32_t)o.PACKET_SIZE));
+            remaining-=std::min(remaining,(uint32_t)o.PACKET_SIZE);
+            uint8_t* data=&frameBuffer[i*o.PACKET_SIZE];
+            fillBufferWithPayload(data,size,frame.firstSeqNr+i);
+            PacketInfo::write(data,size,o.STREAM_ID,frame.firstSeqNr+i);
+            packets[i]={data,size};
+        }
+        udpSender.mySendToBatch(packets.data(),frame.nPackets);
+        liveUDPProcessingTime.logIfDue();
+    }
+    // Wait for any packet that might be still in transit
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    udpReceiver.stopReceiving();
+    reassembler.flush();
+    sequenceTracker.finish();
+
+    std::size_t nCompleteFrames=0,nCompleteKeyFrames=0,nKeyFrames=0;
+    for(int i=0;i<nFrames;i++){
+        nCompleteFrames+=nReceivedPerFrame[i]>=frames[i].nPackets ? 1 : 0;
+        nKeyFrames+=frames[i].keyFrame ? 1 : 0;
+        nCompleteKeyFrames+=frames[i].keyFrame && nReceivedPerFrame[i]>=frames[i].nPackets ? 1 : 0;
+    }
+    std::cout<<"N of "<<(fragmentation ? "frames" : "packets")<<" sent | rec ["<<(fragmentation ? frames.size() : frameOfSeqNr.size())<<" | "
+    <<receivedPackets<<"] corrupted "<<nCorruptedPackets<<"\n";
+    std::cout<<"Sequence "<<sequenceTracker.getReadable()<<"\n";
+    std::cout<<"Complete frames "<<nCompleteFrames<<"/"<<nFrames<<" key frames "<<nCompleteKeyFrames<<"/"<<nKeyFrames<<"\n";
+    if(fragmentation){
+        const auto stats=reassembler.getStats();
+        std::cout<<"------- Reassembly ------- \n";
+        std::cout<<"complete "<<stats.nCompleteFrames<<" incomplete "<<stats.nIncompleteFrames<<" ("
+        <<(stats.nCompleteFrames+stats.nIncompleteFrames==0 ? 0.0 : 100.0*stats.nIncompleteFrames/(stats.nCompleteFrames+stats.nIncompleteFrames))
+        <<"%) invalid fragments "<<stats.nInvalidFragments<<" duplicates "<<stats.nDuplicateFragments<<" late "<<stats.nLateFragments<<"\n";
+        std::cout<<"first -> last fragment "<<reassembler.getReassemblyLatency().getPercentilesReadable()<<"\n";
+    }else{
+        std::cout<<"------- Packet latency ------- \n"<<avgUDPProcessingTime.getPercentilesReadable()<<"\n";
+    }
+    std::cout<<"------- Frame complete latency ------- \n";
+    std::cout<<"all frames "<<frameLatency.getAvgReadable()<<"\n"<<frameLatency.getPercentilesReadable()<<"\n";
+    if(keyFrameLatency.getNSamples()>0){
+        std::cout<<"key frames "<<keyFrameLatency.getPercentilesReadable()<<"\n";
+    }
+    std::cout<<"Histogram\n"<<frameLatency.getHistogramReadable();
+}
+
+// Compare the throughput of the different UDPSender send methods. Packets are sent in bursts of
+// PACKETS_PER_FRAME (roughly one h264 frame at 8MBit/s and 30fps) as fast as possible, no pacing
+enum class SendMethod{PER_PACKET,SENDMMSG,GSO};
+static std::string sendMethodName(const SendMethod method){
+    switch(method){
+        case SendMethod::PER_PACKET:return "sendto  ";
+        case SendMethod::SENDMMSG:return "sendmmsg";
+        case SendMethod::GSO:return "GSO     ";
+    }
+    return "";
+}
+
+static void test_send_methods(const Options& o){
+    static constexpr std::size_t PACKETS_PER_FRAME=24;
+    std::vector<std::vector<uint8_t>> frame;
+    std::vector<UDPSender::Packet> packets;
+    for(std::size_t i=0;i<PACKETS_PER_FRAME;i++){
+        frame.push_back(createRandomDataBuffer(o.PACKET_SIZE));
+    }
+    for(const auto& buff:frame){
+        packets.push_back({buff.data(),buff.size()});
+    }
+    const std::size_t nFrames=std::max(1,o.N_PACKETS/(int)PACKETS_PER_FRAME);
+    std::cout<<"Sending "<<nFrames<<" frames of "<<PACKETS_PER_FRAME<<"x"<<o.PACKET_SIZE<<" bytes per method\n";
+    for(const auto method:{SendMethod::PER_PACKET,SendMethod::SENDMMSG,SendMethod::GSO}){
+        std::atomic<std::size_t> nReceivedPackets=0;
+        UDPReceiver udpReceiver{nullptr,o.INPUT_PORT,"TSUdpRec",0,[&nReceivedPackets](const uint8_t[],size_t){
+            nReceivedPackets++;
+        },8*1024*1024,false};
+        udpReceiver.enableBatchedReceive(64,nullptr,o.PACKET_SIZE);
+        udpReceiver.startReceiving();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        UDPSender udpSender{o.DESTINATION_IP,o.OUTPUT_PORT,UDPSender::EXAMPLE_MEDIUM_SNDBUFF_SIZE};
+        const auto begin=std::chrono::steady_clock::now();
+        for(std::size_t i=0;i<nFrames;i++){
+            switch(method){
+                case SendMethod::PER_PACKET:
+                    for(const auto& packet:packets){
+                        udpSender.mySendTo(packet.data,packet.size);
+                    }
+                    break;
+                case SendMethod::SENDMMSG:
+                    udpSender.mySendToBatch(packets.data(),packets.size());
+                    break;
+                case SendMethod::GSO:
+                    udpSender.mySendToGSO(packets.data(),packets.size());
+                    break;
+            }
+        }
+        const auto elapsed=std::chrono::steady_clock::now()-begin;
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        udpReceiver.stopReceiving();
+        const double elapsedSeconds=std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()/1000.0/1000.0;
+        const std::size_t nSentPackets=nFrames*PACKETS_PER_FRAME;
+        std::cout<<sendMethodName(method)<<" pps "<<(std::size_t)(nSentPackets/elapsedSeconds)
+        <<" MBit/s "<<(udpSender.nSentBytes*8/elapsedSeconds/1024/1024)
+        <<" send delay per packet "<<MyTimeHelper::R(udpSender.getAvgSendDelayPerPacket())
+        <<" received "<<nReceivedPackets<<"/"<<nSentPackets<<"\n";
+    }
+}
+
+// Ground station like setup: N_STREAMS ports (video, telemetry, RC, OSD ...), each with a paced sender (EventLoop timer)
+// and a UDPReceiver. Once with one thread per receiver, once with all receivers and senders hosted on one EventLoop.
+// Compares the n of threads, context switches per packet and the latency
+static void test_event_loop(const Options& o,const int timeSeconds){
+    static constexpr int N_STREAMS=6;
+    const int ppsPerStream=std::max(1,o.WANTED_PACKETS_PER_SECOND/N_STREAMS);
+    const std::chrono::nanoseconds interval=std::chrono::nanoseconds(std::chrono::seconds(1))/ppsPerStream;
+    std::cout<<N_STREAMS<<" streams with "<<ppsPerStream<<" pps each for "<<timeSeconds<<"s\n";
+    for(const bool sharedLoop:{false,true}){
+        struct Stream{
+            LatencyHistogram latency;
+            uint32_t nReceived=0;
+            uint32_t nSent=0;
+            std::vector<uint8_t> buff;
+            std::unique_ptr<UDPSender> sender;
+            std::unique_ptr<UDPReceiver> receiver;
+        };
+        std::vector<Stream> streams(N_STREAMS);
+        EventLoop eventLoop{"StreamLoop",o.RECEIVER_THREAD_CONFIG};
+        for(int i=0;i<N_STREAMS;i++){
+            Stream& stream=streams[i];
+            stream.receiver=std::make_unique<UDPReceiver>(nullptr,o.INPUT_PORT+i,"StreamUdpRec",0,[&stream](const uint8_t* data,size_t size){
+                const auto now=std::chrono::steady_clock::now();
+                if(PacketInfo::validate(data,size)!=PacketInfo::Validation::VALID)return;
+                const auto info=PacketInfo::read(data);
+                stream.latency.add(std::max(now-info.getTimestamp(),std::chrono::steady_clock::duration(0)));
+                stream.nReceived++;
+            },0,false);
+            if(sharedLoop){
+                stream.receiver->setEventLoop(&eventLoop);
+            }else{
+                stream.receiver->setThreadConfig(o.RECEIVER_THREAD_CONFIG);
+            }
+            stream.receiver->startReceiving();
+            stream.sender=std::make_unique<UDPSender>(o.DESTINATION_IP,o.INPUT_PORT+i);
+            stream.buff.resize(o.PACKET_SIZE);
+        }
+        eventLoop.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        rusage usageBegin{};
+        getrusage(RUSAGE_SELF,&usageBegin);
+        const auto begin=std::chrono::steady_clock::now();
+        std::vector<int> timers;
+        for(int i=0;i<N_STREAMS;i++){
+            Stream& stream=streams[i];
+            // Spread the streams over the interval, such that not all timers fire at once
+            timers.push_back(eventLoop.addTimer(interval,[&stream,i](uint64_t nExpirations){
+                for(uint64_t n=0;n<nExpirations;n++){
+                    fillBufferWithPayload(stream.buff,stream.nSent);
+                    PacketInfo::write(stream.buff.data(),stream.buff.size(),i,stream.nSent);
+                    stream.sender->mySendTo(stream.buff.data(),stream.buff.size());
+                    stream.nSent++;
+                }
+            },begin+interval*i/N_STREAMS));
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(timeSeconds));
+        for(const auto timer:timers){
+            eventLoop.remove(timer);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        rusage usageEnd{};
+        getrusage(RUSAGE_SELF,&usageEnd);
+        for(auto& stream:streams){
+            stream.receiver->stopReceiving();
+        }
+        eventLoop.stop();
+        LatencyHistogram latency;
+        uint64_t nSent=0,nReceived=0;
+        for(const auto& stream:streams){
+            latency.merge(stream.latency);
+            nSent+=stream.nSent;
+            nReceived+=stream.nReceived;
+        }
+        const long nContextSwitches=(usageEnd.ru_nvcsw-usageBegin.ru_nvcsw)+(usageEnd.ru_nivcsw-usageBegin.ru_nivcsw);
+        const double cpuUs=(usageEnd.ru_utime.tv_sec-usageBegin.ru_utime.tv_sec+usageEnd.ru_stime.tv_sec-usageBegin.ru_stime.tv_sec)*1e6+
+                           (usageEnd.ru_utime.tv_usec-usageBegin.ru_utime.tv_usec+usageEnd.ru_stime.tv_usec-usageBegin.ru_stime.tv_usec);
+        std::cout<<"------- "<<(sharedLoop ? "1 event loop thread for all senders and receivers" : std::to_string(N_STREAMS)+" receiver threads + 1 sender loop thread")<<" ------- \n";
+        std::cout<<"sent "<<nSent<<" received "<<nReceived<<" context switches per packet "<<(nReceived==0 ? 0.0 : (double)nContextSwitches/nReceived)
+        <<" cpu per packet "<<MyTimeHelper::R(std::chrono::nanoseconds((long)(nReceived==0 ? 0 : cpuUs*1000/nReceived)))<<"\n";
+        std::cout<<latency.getPercentilesReadable()<<"\n";
+        std::cout<<eventLoop.getStatsReadable()<<"\n";
+    }
+}
+
+// Receive throughput of a ReceiverGroup with 1,2 and 4 workers (pinned to cores 0..3) on loopback. N_SENDERS threads
+// send as fast as they can, each from its own socket (source port) such that the kernel hash can spread them
+static void test_receiver_group(const Options& o,const int timeSeconds,const ReceiverGroup::Steering steering){
+    static constexpr int N_SENDERS=4;
+    static constexpr int MAX_WORKERS=4;
+    static constexpr std::size_t SEND_BATCH_SIZE=32;
+    const int nCpus=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    // The workers run on cores 0..nWorkers-1. With spare cores the senders flood from the cores after MAX_WORKERS.
+    // Else they would compete with the workers for the cpu, then they offer a fixed load (-p) below saturation instead
+    const bool flood=nCpus>MAX_WORKERS;
+    std::cout<<"Receiver group steering "<<ReceiverGroup::steeringName(steering)<<", "<<N_SENDERS<<" sender threads, "<<nCpus<<" cores, ";
+    if(flood){
+        std::cout<<"senders flood from cores "<<MAX_WORKERS<<"-"<<(nCpus-1)<<"\n";
+    }else{
+        std::cout<<"not enough cores to keep the senders off the workers, offering "<<o.WANTED_PACKETS_PER_SECOND<<" pps\n";
+    }
+    const auto batchInterval=std::chrono::nanoseconds(1000*1000*1000LL*SEND_BATCH_SIZE*N_SENDERS/std::max(o.WANTED_PACKETS_PER_SECOND,1));
+    uint64_t baselinePps=0;
+    for(const int nWorkers:{1,2,MAX_WORKERS}){
+        // Each worker only touches its own histogram
+        std::vector<LatencyHistogram> latencies(nWorkers);
+        ReceiverGroup::Config config;
+        config.nWorkers=nWorkers;
+        config.steering=steering;
+        config.maxDatagramSize=o.PACKET_SIZE;
+        config.wantedRcvBufSize=8*1024*1024;
+        config.threadConfig=o.RECEIVER_THREAD_CONFIG;
+        config.firstCpu=0;
+        ReceiverGroup group{o.INPUT_PORT,[&latencies](int workerIndex,const uint8_t* data,size_t size){
+            const auto now=std::chrono::steady_clock::now();
+            if(PacketInfo::validate(data,size)!=PacketInfo::Validation::VALID)return;
+            const auto info=PacketInfo::read(data);
+            latencies[workerIndex].add(std::max(now-info.getTimestamp(),std::chrono::steady_clock::duration(0)));
+        },config};
+        if(!group.startReceiving()){
+            MLOGE<<"Cannot start receiver group";
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        std::atomic<bool> sending{true};
+        std::atomic<uint64_t> nSent{0};
+        std::vector<std::thread> senders;
+        for(int s=0;s<N_SENDERS;s++){
+            senders.emplace_back([&o,&sending,&nSent,s,flood,nCpus,batchInterval]{
+                if(flood){
+                    LinuxThreadHelper::Config threadConfig;
+                    threadConfig.cpu=MAX_WORKERS+s%(nCpus-MAX_WORKERS);
+                    LinuxThreadHelper::apply(threadConfig);
+                }
+                UDPSender udpSender{o.DESTINATION_IP,o.INPUT_PORT,UDPSender::EXAMPLE_MEDIUM_SNDBUFF_SIZE};
+                std::vector<std::vector<uint8_t>> buffs(SEND_BATCH_SIZE,std::vector<uint8_t>(o.PACKET_SIZE));
+                std::vector<UDPSender::Packet> packets;
+                for(const auto& buff:buffs){
+                    packets.push_back({buff.data(),buff.size()});
+                }
+                uint32_t seqNr=0;
+                auto nextBatch=std::chrono::steady_clock::now();
+                while(sending){
+                    for(auto& buff:buffs){
+                        PacketInfo::write(buff.data(),buff.size(),s,seqNr++);
+                    }
+                    udpSender.mySendToBatch(packets.data(),packets.size());
+                    nSent+=SEND_BATCH_SIZE;
+                    if(!flood){
+                        nextBatch+=batchInterval;
+                        std::this_thread::sleep_until(nextBatch);
+                    }
+                }
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(timeSeconds));
+        sending=false;
+        for(auto& sender:senders){
+            sender.join();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        group.stopReceiving();
+        LatencyHistogram latency;
+        uint64_t nReceived=0;
+        for(int i=0;i<nWorkers;i++){
+            latency.merge(latencies[i]);
+            nReceived+=group.getWorkerStats(i).nPackets;
+        }
+        const uint64_t receivedPps=nReceived/timeSeconds;
+        if(nWorkers==1){
+            baselinePps=receivedPps;
+        }
+        std::cout<<"------- "<<nWorkers<<" worker(s) ------- \n";
+        std::cout<<"sent pps "<<nSent/timeSeconds<<" received pps "<<receivedPps<<" ("<<(nSent==0 ? 0 : 100*nReceived/nSent)<<"%)"
+        <<" speedup vs 1 worker "<<(baselinePps==0 ? 0.0 : (double)receivedPps/baselinePps)<<"x\n";
+        std::cout<<group.getStatsReadable();
+        std::cout<<latency.getPercentilesReadable()<<"\n";
+    }
+}
+
+// Classic backend (sendmmsg / recvmmsg) against the io_uring backend of UDPSender and UDPReceiver, with and without SQPOLL.
+// First the sender sends bursts as fast as it can (pps and cpu per packet of the whole process), then paced bursts at
+// WANTED_PACKETS_PER_SECOND (latency without queueing)
+enum class Backend{CLASSIC,IO_URING,IO_URING_SQPOLL};
+static std::string backendName(const Backend backend){
+    switch(backend){
+        case Backend::CLASSIC:return "classic        ";
+        case Backend::IO_URING:return "io_uring       ";
+        case Backend::IO_URING_SQPOLL:return "io_uring sqpoll";
+    }
+    return "";
+}
+
+static void test_io_uring(const Options& o,const int timeSeconds){
+    static constexpr std::size_t BURST_SIZE=24;
+    const std::chrono::nanoseconds burstInterval=std::chrono::nanoseconds(std::chrono::seconds(1))*BURST_SIZE/o.WANTED_PACKETS_PER_SECOND;
+    std::cout<<"Bursts of "<<BURST_SIZE<<"x"<<o.PACKET_SIZE<<" bytes, "<<timeSeconds<<"s flood and "<<timeSeconds<<"s paced at "
+    <<o.WANTED_PACKETS_PER_SECOND<<" pps per backend\n";
+    if(!IoUring::isSupported()){
+        std::cout<<"No io_uring on this kernel, both backends fall back to the classic one\n";
+    }
+    for(const auto backend:{Backend::CLASSIC,Backend::IO_URING,Backend::IO_URING_SQPOLL}){
+        for(const bool flood:{true,false}){
+            LatencyHistogram latency;
+            std::atomic<uint64_t> nReceived{0};
+            UDPReceiver udpReceiver{nullptr,o.INPUT_PORT,"UringUdpRec",0,[&latency,&nReceived](const uint8_t* data,size_t size){
+                const auto now=std::chrono::steady_clock::now();
+                if(PacketInfo::validate(data,size)!=PacketInfo::Validation::VALID)return;
+                const auto info=PacketInfo::read(data);
+                latency.add(std::max(now-info.getTimestamp(),std::chrono::steady_clock::duration(0)));
+                nReceived++;
+            },8*1024*1024,false};
+            udpReceiver.enableBatchedReceive(32,nullptr,o.PACKET_SIZE);
+            udpReceiver.setThreadConfig(o.RECEIVER_THREAD_CONFIG);
+            UDPSender udpSender{o.DESTINATION_IP,o.OUTPUT_PORT,UDPSender::EXAMPLE_MEDIUM_SNDBUFF_SIZE};
+            if(backend!=Backend::CLASSIC){
+                const bool sqPoll=backend==Backend::IO_URING_SQPOLL;
+                udpReceiver.enableIoUring(sqPoll);
+                udpSender.enableIoUring(sqPoll,256,o.PACKET_SIZE);
+            }
+            udpReceiver.startReceiving();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            std::vector<std::vector<uint8_t>> burst(BURST_SIZE,std::vector<uint8_t>(o.PACKET_SIZE));
+            std::vector<UDPSender::Packet> packets;
+            for(const auto& buff:burst){
+                packets.push_back({buff.data(),buff.size()});
+            }
+            rusage usageBegin{};
+            getrusage(RUSAGE_SELF,&usageBegin);
+            const auto begin=std::chrono::steady_clock::now();
+            auto nextBurst=begin;
+            uint32_t seqNr=0;
+            while(std::chrono::steady_clock::now()-begin<std::chrono::seconds(timeSeconds)){
+                if(!flood){
+                    std::this_thread::sleep_until(nextBurst);
+                    nextBurst+=burstInterval;
+                }
+                for(auto& buff:burst){
+                    PacketInfo::write(buff.data(),buff.size(),0,seqNr++);
+                }
+                udpSender.mySendToBatch(packets.data(),packets.size());
+            }
+            udpSender.flush();
+            const auto elapsed=std::chrono::steady_clock::now()-begin;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            rusage usageEnd{};
+            getrusage(RUSAGE_SELF,&usageEnd);
+            udpReceiver.stopReceiving();
+            const double elapsedSeconds=std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()/1000.0/1000.0;
+            const double cpuUs=(usageEnd.ru_utime.tv_sec-usageBegin.ru_utime.tv_sec+usageEnd.ru_stime.tv_sec-usageBegin.ru_stime.tv_sec)*1e6+
+                               (usageEnd.ru_utime.tv_usec-usageBegin.ru_utime.tv_usec+usageEnd.ru_stime.tv_usec-usageBegin.ru_stime.tv_usec);
+            const uint64_t nSent=seqNr-std::min((uint64_t)seqNr,udpSender.getNFailedSends());
+            std::cout<<backendName(backend)<<(flood ? " flood" : " paced")<<" sent pps "<<(uint64_t)(nSent/elapsedSeconds)
+            <<" received pps "<<(uint64_t)(nReceived/elapsedSeconds)<<" cpu per packet "
+            <<MyTimeHelper::R(std::chrono::nanoseconds((long)(nReceived==0 ? 0 : cpuUs*1000/nReceived)))<<"\n";
+            std::cout<<"    "<<latency.getPercentilesReadable()<<"\n";
+            std::cout<<"    tx "<<udpSender.getBackendReadable()<<" | rx "<<udpReceiver.getBackendReadable()<<"\n";
+        }
+    }
+}
+
+// Blocking receive, spinning (the old ENABLE_NONBLOCKING, approximated by a fixed 1s spin budget) and adaptive
+// spin-then-block, each with steady traffic (one packet every interval) and with bursts of BURST_SIZE back to back
+// packets at the same average rate. Reports latency and how much of a core the receiver thread used
+enum class ReceiveMode{BLOCKING,SPIN,ADAPTIVE};
+static std::string receiveModeName(const ReceiveMode mode){
+    switch(mode){
+        case ReceiveMode::BLOCKING:return "blocking";
+        case ReceiveMode::SPIN:return "spin    ";
+        case ReceiveMode::ADAPTIVE:return "adaptive";
+    }
+    return "";
+}
+
+static void test_spin(const Options& o,const int timeSeconds){
+    static constexpr int BURST_SIZE=24;
+    const auto maxSpin=o.RECEIVER_MAX_SPIN.count()>0 ? o.RECEIVER_MAX_SPIN : std::chrono::microseconds(200);
+    std::cout<<o.WANTED_PACKETS_PER_SECOND<<" pps for "<<timeSeconds<<"s per run, adaptive max spin "<<MyTimeHelper::R(maxSpin)<<"\n";
+    for(const bool bursts:{false,true}){
+        std::cout<<"------- "<<(bursts ? "bursts of "+std::to_string(BURST_SIZE) : std::string("steady"))<<" ------- \n";
+        for(const auto mode:{ReceiveMode::BLOCKING,ReceiveMode::SPIN,ReceiveMode::ADAPTIVE}){
+            LatencyHistogram latency;
+            std::atomic<uint64_t> nReceived{0};
+            UDPReceiver udpReceiver{nullptr,o.INPUT_PORT,"SpinUdpRec",0,[&latency,&nReceived](const uint8_t* data,size_t size){
+                const auto now=std::chrono::steady_clock::now();
+                if(PacketInfo::validate(data,size)!=PacketInfo::Validation::VALID)return;
+                const auto info=PacketInfo::read(data);
+                latency.add(std::max(now-info.getTimestamp(),std::chrono::steady_clock::duration(0)));
+                nReceived++;
+            },0,false};
+            udpReceiver.setThreadConfig(o.RECEIVER_THREAD_CONFIG);
+            if(mode==ReceiveMode::SPIN){
+                udpReceiver.enableAdaptiveSpin(std::chrono::seconds(1),false);
+            }else if(mode==ReceiveMode::ADAPTIVE){
+                udpReceiver.enableAdaptiveSpin(maxSpin,true,o.RECEIVER_BUSY_POLL_US);
+            }
+            udpReceiver.startReceiving();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            clockid_t receiverClock;
+            pthread_getcpuclockid(udpReceiver.getThreadHandle(),&receiverClock);
+            timespec cpuBegin{},cpuEnd{};
+            clock_gettime(receiverClock,&cpuBegin);
+            UDPSender udpSender{o.DESTINATION_IP,o.OUTPUT_PORT};
+            // Sleeping, a spinning sender would compete with a spinning receiver for the same core
+            Pacer pacer{Pacer::Strategy::NANOSLEEP};
+            std::vector<uint8_t> buff(o.PACKET_SIZE);
+            const int packetsPerWakeup=bursts ? BURST_SIZE : 1;
+            const auto interval=std::chrono::nanoseconds(std::chrono::seconds(1))*packetsPerWakeup/o.WANTED_PACKETS_PER_SECOND;
+            const auto begin=std::chrono::steady_clock::now();
+            uint32_t seqNr=0;
+            for(auto next=begin;next<begin+std::chrono::seconds(timeSeconds);next+=interval){
+                pacer.waitUntil(next);
+                for(int i=0;i<packetsPerWakeup;i++){
+                    PacketInfo::write(buff.data(),buff.size(),0,seqNr++);
+                    udpSender.mySendTo(buff.data(),buff.size());
+                }
+            }
+            const auto elapsed=std::chrono::steady_clock::now()-begin;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            clock_gettime(receiverClock,&cpuEnd);
+            const auto spinStats=udpReceiver.getSpinStatsReadable();
+            udpReceiver.stopReceiving();
+            const double cpuSeconds=(cpuEnd.tv_sec-cpuBegin.tv_sec)+(cpuEnd.tv_nsec-cpuBegin.tv_nsec)/1e9;
+            const double elapsedSeconds=std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()/1000.0/1000.0+0.1;
+            std::cout<<receiveModeName(mode)<<" received "<<nReceived<<"/"<<seqNr<<" receiver cpu "<<(int)(100*cpuSeconds/elapsedSeconds)<<"% of a core "
+            <<latency.getPercentilesReadable()<<"\n";
+            if(!spinStats.empty()){
+                std::cout<<"         "<<spinStats<<"\n";
+            }
+        }
+    }
+}
+
+// Heap allocations per packet in steady state (after a warmup) for each receive path, with a callback that does what the
+// latency test does per packet (validate, verify payload, sequence tracking, histogram) minus the live log.
+// Returns false if any path allocates
+static bool test_allocations(const Options& o){
+    ignoreHeapAllocations=true;
+    enum class Path{RECVFROM,RECVMMSG,RING,INLINE};
+    const auto pathName=[](const Path path){
+        switch(path){
+            case Path::RECVFROM:return "UDPReceiver recvfrom        ";
+            case Path::RECVMMSG:return "UDPReceiver recvmmsg        ";
+            case Path::RING:return "UDPReceiver ring            ";
+            case Path::INLINE:return "InlineUDPReceiver (template)";
+        }
+        return "";
+    };
+    const int nPackets=std::max(o.N_PACKETS,2000);
+    const uint32_t nWarmupPackets=nPackets/10;
+    bool allocationFree=true;
+    for(const auto path:{Path::RECVFROM,Path::RECVMMSG,Path::RING,Path::INLINE}){
+        // The same callback (and global state) as test_latency
+        expectedStreamId=0;
+        receivedPackets=0;
+        receivedBytes=0;
+        nCorruptedPackets=0;
+        avgUDPProcessingTime.reset();
+        liveUDPProcessingTime.reset();
+        sequenceTracker.reset();
+        std::atomic<uint64_t> nAllocationsAtWarmup{0},nAllocationsAtLast{0};
+        std::atomic<uint32_t> nReceived{0},nAfterWarmup{0};
+        const auto onPacket=[&](const uint8_t* data,size_t size){
+            validateReceivedData(data,size);
+            const uint32_t n=++nReceived;
+            if(n==nWarmupPackets){
+                nAllocationsAtWarmup=nHeapAllocations.load();
+            }else if(n>nWarmupPackets){
+                nAllocationsAtLast=nHeapAllocations.load();
+                nAfterWarmup++;
+            }
+        };
+        std::unique_ptr<UDPReceiver> udpReceiver;
+        InlineUDPReceiver<decltype(onPacket)> inlineReceiver{o.INPUT_PORT,onPacket,32,(size_t)o.PACKET_SIZE};
+        if(path==Path::INLINE){
+            inlineReceiver.startReceiving();
+        }else{
+            udpReceiver=std::make_unique<UDPReceiver>(nullptr,o.INPUT_PORT,"AllocUdpRec",0,onPacket,0,false);
+            if(path==Path::RECVMMSG){
+                udpReceiver->enableBatchedReceive(32,nullptr,o.PACKET_SIZE);
+            }else if(path==Path::RING){
+                udpReceiver->enableDecoupledCallback(1024,DatagramRing::Policy::BLOCK,o.PACKET_SIZE);
+            }
+            udpReceiver->startReceiving();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        UDPSender udpSender{o.DESTINATION_IP,o.OUTPUT_PORT};
+        // Does not spin, such that the receiver is not starved on a single core
+        Pacer pacer{Pacer::Strategy::NANOSLEEP};
+        std::vector<uint8_t> buff(o.PACKET_SIZE);
+        const std::chrono::nanoseconds timeBetweenPackets=std::chrono::nanoseconds(std::chrono::seconds(1))/std::max(o.WANTED_PACKETS_PER_SECOND,1);
+        const auto begin=std::chrono::steady_clock::now();
+        for(int i=0;i<nPackets;i++){
+            pacer.waitUntil(begin+i*timeBetweenPackets);
+            fillBufferWithPayload(buff,i);
+            PacketInfo::write(buff.data(),buff.size(),0,i);
+            udpSender.mySendTo(buff.data(),buff.size());
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        if(path==Path::INLINE){
+            inlineReceiver.stopReceiving();
+        }else{
+            udpReceiver->stopReceiving();
+        }
+        const uint64_t nAllocations=nAllocationsAtLast>nAllocationsAtWarmup ? nAllocationsAtLast-nAllocationsAtWarmup : 0;
+        allocationFree=allocationFree && nAllocations==0;
+        std::cout<<pathName(path)<<" allocations "<<nAllocations<<" in "<<nAfterWarmup<<" packets ("
+        <<(nAfterWarmup==0 ? 0.0 : (double)nAllocations/nAfterWarmup)<<" per packet) valid "<<receivedPackets<<" corrupted "<<nCorruptedPackets
+        <<" latency "<<avgUDPProcessingTime.getPercentilesReadable()<<"\n";
+    }
+    std::cout<<(allocationFree ? "PASS receive path is allocation free" : "FAIL receive path allocates")<<"\n";
+    return allocationFree;
+}
+
+// Compare the cost of the different ways to verify a received packet of PACKET_SIZE bytes
+static void test_verify_methods(const Options& o){
+    static constexpr int N_ITERATIONS=100000;
+    std::vector<uint8_t> packet(o.PACKET_SIZE);
+    fillBufferWithPayload(packet,0);
+    PacketInfo::write(packet.data(),packet.size(),0,0);
+    // The old way, keep a copy of the sent packet and memcmp
+    const std::vector<uint8_t> sentCopy=packet;
+    const auto benchmark=[&o](const std::string& name,const std::function<bool()>& verify){
+        std::size_t nValid=0;
+        const auto begin=std::chrono::steady_clock::now();
+        for(int i=0;i<N_ITERATIONS;i++){
+            nValid+=verify() ? 1 : 0;
+        }
+        const auto perPacket=(std::chrono::steady_clock::now()-begin)/N_ITERATIONS;
+        const double mBytesPerSecond=o.PACKET_SIZE/(double)std::chrono::duration_cast<std::chrono::nanoseconds>(perPacket).count()*1000.0;
+        std::cout<<name<<" "<<MyTimeHelper::R(perPacket)<<" per packet "<<mBytesPerSecond<<"MB/s valid "<<nValid<<"/"<<N_ITERATIONS<<"\n";
+    };
+    std::cout<<"Verify "<<o.PACKET_SIZE<<" byte packets, hardware crc32c "<<(CRC32C::hasHardwareSupport() ? "yes" : "no")<<"\n";
+    benchmark("memcmp (stored copy) ",[&](){
+        return std::memcmp(&packet[sizeof(PacketInfoData)],&sentCopy[sizeof(PacketInfoData)],packet.size()-sizeof(PacketInfoData))==0;
+    });
+    benchmark("regenerate payload   ",[&](){
+        return verifyPayload(packet.data(),packet.size(),0);
+    });
+    benchmark("crc32c hardware      ",[&](){
+        return CRC32C::calculateHardware(&packet[sizeof(PacketInfoData)],packet.size()-sizeof(PacketInfoData))==PacketInfo::read(packet.data()).payloadCrc32c;
+    });
+    benchmark("crc32c software      ",[&](){
+        return CRC32C::calculateSoftware(&packet[sizeof(PacketInfoData)],packet.size()-sizeof(PacketInfoData))==PacketInfo::read(packet.data()).payloadCrc32c;
+    });
+    benchmark("PacketInfo::validate ",[&](){
+        return PacketInfo::validate(packet.data(),packet.size())==PacketInfo::Validation::VALID;
+    });
+    // The SIMD mulAdd has to match the table lookup for all 256x256 products, for unaligned buffers and all tail lengths
+    {
+        std::vector<uint8_t> src(256+64),expected(src.size()+4),actual(src.size()+4);
+        for(size_t i=0;i<src.size();i++){
+            src[i]=(uint8_t)i;
+        }
+        std::size_t nChecks=0,nMismatches=0;
+        for(int c=0;c<256;c++){
+            for(size_t srcOffset=0;srcOffset<4;srcOffset++){
+                const size_t dstOffset=(srcOffset+1)%4;
+                for(size_t length=0;length+srcOffset<=src.size();length+=(length<70 ? 1 : 50)){
+                    for(size_t i=0;i<expected.size();i++){
+                        expected[i]=actual[i]=(uint8_t)(i*7+c);
+                    }
+                    GF256::mulAddSoftware(&expected[dstOffset],&src[srcOffset],(uint8_t)c,length);
+                    GF256::mulAdd(&actual[dstOffset],&src[srcOffset],(uint8_t)c,length);
+                    nChecks++;
+                    if(expected!=actual){
+                        if(nMismatches==0){
+                            MLOGE<<"gf256 simd mismatch c="<<c<<" src offset "<<srcOffset<<" length "<<length;
+                        }
+                        nMismatches++;
+                    }
+                }
+            }
+        }
+        std::cout<<"gf256 mulAdd simd "<<GF256::simdName()<<" vs software: "<<nMismatches<<" mismatches in "<<nChecks<<" checks\n";
+    }
+    // One mulAdd per data packet and parity packet is the cost of the FEC
+    std::vector<uint8_t> parity(packet.size());
+    benchmark("gf256 mulAdd software",[&](){
+        GF256::mulAddSoftware(parity.data(),packet.data(),0x53,packet.size());
+        return true;
+    });
+    benchmark(std::string("gf256 mulAdd simd ")+GF256::simdName(),[&](){
+        GF256::mulAdd(parity.data(),packet.data(),0x53,packet.size());
+        return true;
+    });
+}
+
+// Run only one side of the clock sync, e.g. in two processes or on two hosts
+static void test_clock_sync(const Options& o,const bool server,const int timeSeconds){
+    if(server){
+        ClockSyncServer clockSyncServer{o.CLOCK_SYNC_PORT,o.CLOCK_OFFSET};
+        clockSyncServer.start();
+        std::cout<<"Clock sync server on port "<<o.CLOCK_SYNC_PORT<<" artificial offset "<<MyTimeHelper::R(o.CLOCK_OFFSET)<<"\n";
+        std::this_thread::sleep_for(std::chrono::seconds(timeSeconds));
+        clockSyncServer.stop();
+        return;
+    }
+    // -o is the artificial offset of the tx clock, i.e. of the server only
+    ClockSyncClient client{o.DESTINATION_IP,o.CLOCK_SYNC_PORT};
+    client.start();
+    for(int i=0;i<timeSeconds;i++){
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        std::cout<<"Clock sync "<<client.getEstimateReadable()<<"\n";
+    }
+    client.stop();
+}
+
+// Echo all packets on REFLECTOR_PORT back to the sender ip on INPUT_PORT, for round trip measurements with -m rtt
+static void run_reflector(const Options& o,const int timeSeconds){
+    UDPReflector reflector{o.REFLECTOR_PORT,o.INPUT_PORT};
+    reflector.start();
+    std::cout<<"Reflecting port "<<o.REFLECTOR_PORT<<" to <source ip>:"<<o.INPUT_PORT<<" for "<<timeSeconds<<"s\n";
+    for(int i=0;i<timeSeconds;i++){
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+    reflector.stop();
+    std::cout<<"Reflected "<<reflector.getNReflectedPackets()<<" packets, processing time "<<reflector.getProcessingTime().getPercentilesReadable()<<"\n";
+}
+
+// Only the tx side of test_latency, writes one TxRecord per sent packet into @param fileName.
+// With -y the tx clock is the reference for the rx process (ClockSyncServer on CLOCK_SYNC_PORT)
+static void run_tx(const Options& o,const std::string& fileName){
+    const std::chrono::nanoseconds TIME_BETWEEN_PACKETS=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::seconds(1))/o.WANTED_PACKETS_PER_SECOND;
+    ClockSyncServer clockSyncServer{o.CLOCK_SYNC_PORT,o.CLOCK_OFFSET};
+    if(o.CLOCK_SYNC){
+        clockSyncServer.start();
+    }
+    ResultFileWriter<TxRecord> resultFile{fileName};
+    UDPSender udpSender{o.DESTINATION_IP,o.OUTPUT_PORT};
+    Pacer pacer{o.PACING};
+    if(o.PACING==Pacer::Strategy::TXTIME){
+        udpSender.enableTxTime();
+    }
+    std::vector<uint8_t> buff(o.PACKET_SIZE);
+    std::cout<<"Sending "<<o.N_PACKETS<<" packets to "<<o.DESTINATION_IP<<":"<<o.OUTPUT_PORT<<", results in "<<fileName<<"\n";
+    const auto firstPacketTimePoint=std::chrono::steady_clock::now();
+    for(int i=0;i<o.N_PACKETS;i++){
+        const auto timePointSendPacket=firstPacketTimePoint+i*TIME_BETWEEN_PACKETS;
+        pacer.waitUntil(timePointSendPacket);
+        fillBufferWithPayload(buff,i);
+        const bool txTime=o.PACING==Pacer::Strategy::TXTIME;
+        const auto txTimestamp=PacketInfo::write(buff.data(),buff.size(),o.STREAM_ID,i,o.CLOCK_OFFSET,
+                                                 txTime ? timePointSendPacket : std::chrono::steady_clock::time_point{});
+        if(txTime){
+            udpSender.mySendToAt(buff.data(),buff.size(),timePointSendPacket);
+        }else{
+            udpSender.mySendTo(buff.data(),buff.size());
+        }
+        resultFile.add({(uint32_t)i,(uint32_t)buff.size(),std::chrono::duration_cast<std::chrono::nanoseconds>(txTimestamp.time_since_epoch()).count()});
+    }
+    udpSender.logSendtoDelay();
+    if(o.CLOCK_SYNC){
+        // Give the rx process time for a last couple of pings
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        clockSyncServer.stop();
+    }
+    std::cout<<"Wrote "<<resultFile.getNRecords()<<" tx records\n";
+}
+
+// Only the rx side of test_latency, writes one RxRecord per received packet of STREAM_ID into @param fileName
+// for @param timeSeconds. With -y the offset to the tx clock (ClockSyncServer at DESTINATION_IP) is stored per packet
+static void run_rx(const Options& o,const std::string& fileName,const int timeSeconds){
+    std::unique_ptr<ClockSyncClient> txClock;
+    if(o.CLOCK_SYNC){
+        txClock=std::make_unique<ClockSyncClient>(o.DESTINATION_IP,o.CLOCK_SYNC_PORT);
+        txClock->start();
+    }
+    ResultFileWriter<RxRecord> resultFile{fileName};
+    std::size_t nOtherPackets=0;
+    // Only called on the receiver thread
+    const auto onPacket=[&](const uint8_t* data,const size_t size){
+        const auto now=std::chrono::steady_clock::now();
+        const auto validation=PacketInfo::validate(data,size);
+        if(validation!=PacketInfo::Validation::VALID && validation!=PacketInfo::Validation::INVALID_CRC){
+            nOtherPackets++;
+            return;
+        }
+        const auto info=PacketInfo::read(data);
+        if(info.streamId!=o.STREAM_ID){
+            nOtherPackets++;
+            return;
+        }
+        const bool hasEstimate=txClock && txClock->hasEstimate();
+        const auto clockOffset=hasEstimate ? txClock->getOffset(now) : std::chrono::nanoseconds(0);
+        uint32_t flags=validation==PacketInfo::Validation::INVALID_CRC ? RxRecord::FLAG_INVALID_CRC : 0;
+        if(txClock && !hasEstimate){
+            flags|=RxRecord::FLAG_NO_CLOCK_ESTIMATE;
+        }
+        resultFile.add({info.seqNr,(uint32_t)size,info.timestampNs,std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count(),
+                        clockOffset.count(),flags});
+    };
+    UDPReceiver udpReceiver{nullptr,o.INPUT_PORT,"RxUdpRec",0,onPacket,0,false};
+    if(o.RECEIVE_BATCH_SIZE>0){
+        udpReceiver.enableBatchedReceive(o.RECEIVE_BATCH_SIZE,[&onPacket](const UDPReceiver::Datagram datagrams[],size_t count){
+            for(size_t i=0;i<count;i++){
+                onPacket(datagrams[i].data,datagrams[i].size);
+            }
+        },o.PACKET_SIZE);
+    }
+    udpReceiver.startReceiving();
+    std::cout<<"Receiving on "<<o.INPUT_PORT<<" for "<<timeSeconds<<"s, results in "<<fileName<<"\n";
+    std::this_thread::sleep_for(std::chrono::seconds(timeSeconds));
+    udpReceiver.stopReceiving();
+    if(txClock){
+        std::cout<<"Clock sync "<<txClock->getEstimateReadable()<<"\n";
+        txClock->stop();
+    }
+    std::cout<<"Wrote "<<resultFile.getNRecords()<<" rx records, ignored "<<nOtherPackets<<" other packets\n";
+}
+
+// Join the result files of run_tx and run_rx by sequence number
+static void merge_results(const std::string& txFileName,const std::string& rxFileName){
+    std::vector<TxRecord> txRecords;
+    std::vector<RxRecord> rxRecords;
+    if(!readResultFile(txFileName,txRecords) || !readResultFile(rxFileName,rxRecords)){
+        return;
+    }
+    if(txRecords.empty()){
+        MLOGE<<"No tx records";
+        return;
+    }
+    // Sorted by sequence number and looked up with a binary search. Not indexed by the sequence number itself, a
+    // corrupt record with a huge sequence number must not blow up the memory
+    std::vector<const TxRecord*> txBySeqNr;
+    txBySeqNr.reserve(txRecords.size());
+    for(const auto& tx:txRecords){
+        txBySeqNr.push_back(&tx);
+    }
+    std::sort(txBySeqNr.begin(),txBySeqNr.end(),[](const TxRecord* a,const TxRecord* b){
+        return a->seqNr<b->seqNr;
+    });
+    // Per entry of txBySeqNr
+    std::vector<uint8_t> received(txBySeqNr.size(),0);
+    LatencyHistogram latency;
+    std::size_t nUnique=0,nDuplicates=0,nUnknown=0,nTimestampMismatch=0,nInvalidCrc=0,nNoClockEstimate=0;
+    std::size_t txBytes=0,rxBytes=0;
+    for(const auto& tx:txRecords){
+        txBytes+=tx.size;
+    }
+    for(const auto& rx:rxRecords){
+        const auto it=std::lower_bound(txBySeqNr.begin(),txBySeqNr.end(),rx.seqNr,[](const TxRecord* tx,const uint32_t seqNr){
+            return tx->seqNr<seqNr;
+        });
+        if(it==txBySeqNr.end() || (*it)->seqNr!=rx.seqNr){
+            nUnknown++;
+            continue;
+        }
+        const TxRecord* tx=*it;
+        const std::size_t txIndex=it-txBySeqNr.begin();
+        if(received[txIndex]){
+            nDuplicates++;
+            continue;
+        }
+        received[txIndex]=1;
+        nUnique++;
+        rxBytes+=rx.size;
+        if(rx.flags & RxRecord::FLAG_INVALID_CRC){
+            nInvalidCrc++;
+        }
+        // Both files have to come from the same run
+        if(rx.txTimestampNs!=tx->txTimestampNs){
+            nTimestampMismatch++;
+        }
+        // Received (counts for the loss), but without a clock offset the latency would be off by the clock difference
+        if(rx.flags & RxRecord::FLAG_NO_CLOCK_ESTIMATE){
+            nNoClockEstimate++;
+            continue;
+        }
+        // rx time converted into the tx clock
+        const int64_t latencyNs=rx.rxTimestampNs+rx.clockOffsetNs-tx->txTimestampNs;
+        latency.add(std::chrono::nanoseconds(std::max(latencyNs,(int64_t)0)));
+    }
+    const auto throughput=[](const std::size_t nPackets,const std::size_t nBytes,const int64_t durationNs){
+        const double seconds=std::max(durationNs,(int64_t)1)/1000.0/1000.0/1000.0;
+        std::stringstream ss;
+        ss<<nPackets<<" packets in "<<seconds<<"s pps "<<(nPackets/seconds)<<" MBit/s "<<(nBytes*8/seconds/1024/1024);
+        return ss.str();
+    };
+    const auto rxTimestamps=std::minmax_element(rxRecords.begin(),rxRecords.end(),[](const RxRecord& a,const RxRecord& b){
+        return a.rxTimestampNs<b.rxTimestampNs;
+    });
+    const std::size_t nLost=txRecords.size()-nUnique;
+    std::cout<<"------- Merged "<<txFileName<<" | "<<rxFileName<<" ------- \n";
+    std::cout<<"tx "<<throughput(txRecords.size(),txBytes,txRecords.back().txTimestampNs-txRecords.front().txTimestampNs)<<"\n";
+    if(!rxRecords.empty()){
+        std::cout<<"rx "<<throughput(nUnique,rxBytes,rxTimestamps.second->rxTimestampNs-rxTimestamps.first->rxTimestampNs)<<"\n";
+    }
+    std::cout<<"N of packets sent | rec | lost | perc lost ["<<txRecords.size()<<" | "<<nUnique<<" | "<<nLost<<" | "
+    <<(100.0*nLost/txRecords.size())<<"]\n";
+    std::cout<<"duplicates "<<nDuplicates<<" unknown seqNr "<<nUnknown<<" invalid crc "<<nInvalidCrc<<"\n";
+    if(nTimestampMismatch>0){
+        MLOGE<<nTimestampMismatch<<" packets have a different tx timestamp than the tx file, files are not from the same run";
+    }
+    if(nNoClockEstimate>0){
+        std::cout<<nNoClockEstimate<<" packets arrived before the first clock offset estimate, excluded from the latency\n";
+    }
+    std::cout<<"------- Latency between (I<=>O) ------- \n";
+    std::cout<<latency.getAvgReadable()<<"\n";
+    std::cout<<latency.getPercentilesReadable()<<"\n";
+    std::cout<<"Histogram\n"<<latency.getHistogramReadable();
+}
+
+// Analyze a trace written with -r in a single pass over the records: latency time series in buckets of @param bucketDuration
+// (rx time), latency percentiles and the lengths of the loss bursts (gaps in the sequence numbers)
+static void analyze_trace(const std::string& fileName,const std::chrono::milliseconds bucketDuration){
+    PacketTraceReader trace{fileName};
+    if(!trace.isValid() || trace.size()==0){
+        MLOGE<<"Empty trace "<<fileName;
+        return;
+    }
+    const int64_t bucketNs=std::max(std::chrono::duration_cast<std::chrono::nanoseconds>(bucketDuration).count(),(int64_t)1000000);
+    const int64_t firstRxNs=trace.begin()->rxTimestampNs;
+    LatencyHistogram latency;
+    // the bucket that is currently filled
+    int64_t bucketIndex=0;
+    AvgCalculator bucketLatency;
+    std::size_t bucketLost=0;
+    SequenceTracker sequence;
+    std::size_t nInvalidCrc=0,nCorrupted=0;
+    std::cout<<"------- Trace "<<fileName<<" ("<<trace.size()<<" packets) ------- \n";
+    std::cout<<"time | packets | skipped | latency\n";
+    const auto printBucket=[&](){
+        std::cout<<MyTimeHelper::R(std::chrono::nanoseconds(bucketIndex*bucketNs))<<" | "<<bucketLatency.getNSamples()<<" | "<<bucketLost<<" | "
+        <<bucketLatency.getAvgReadable()<<"\n";
+        bucketLatency.reset();
+        bucketLost=0;
+    };
+    for(const auto& record:trace){
+        const int64_t index=(record.rxTimestampNs-firstRxNs)/bucketNs;
+        while(index>bucketIndex){
+            printBucket();
+            bucketIndex++;
+        }
+        const auto packetLatency=std::chrono::nanoseconds(std::max(record.rxTimestampNs-record.txTimestampNs,(int64_t)0));
+        latency.add(packetLatency);
+        bucketLatency.add(packetLatency);
+        if(record.flags & PacketTraceRecord::FLAG_INVALID_CRC)nInvalidCrc++;
+        if(record.flags & PacketTraceRecord::FLAG_CORRUPTED)nCorrupted++;
+        // The time series shows the gaps when they happen, final losses are only known once the tracker window moved on
+        const auto nSkippedBefore=sequence.getNSkipped();
+        sequence.add(record.seqNr);
+        bucketLost+=sequence.getNSkipped()-nSkippedBefore;
+    }
+    printBucket();
+    sequence.finish();
+    std::cout<<"Sequence "<<sequence.getReadable()<<"\n";
+    std::cout<<sequence.getBurstHistogramReadable()<<"\n";
+    std::cout<<"invalid crc "<<nInvalidCrc<<" corrupted "<<nCorrupted<<"\n";
+    std::cout<<"------- Latency between (I<=>O) ------- \n";
+    std::cout<<latency.getAvgReadable()<<"\n";
+    std::cout<<latency.getPercentilesReadable()<<"\n";
+    std::cout<<"Histogram\n"<<latency.getHistogramReadable();
+}
+
+// Replay the latency / loss of a trace written with -r, one profile entry per @param bucketDuration of rx time
+static std::vector<LinkProfileEntry> loadLinkProfile(const std::string& traceFileName,const std::chrono::milliseconds bucketDuration){
+    std::vector<LinkProfileEntry> profile;
+    PacketTraceReader trace{traceFileName};
+    if(!trace.isValid() || trace.size()==0){
+        MLOGE<<"Cannot load profile "<<traceFileName;
+        return profile;
+    }
+    const int64_t bucketNs=std::max(std::chrono::duration_cast<std::chrono::nanoseconds>(bucketDuration).count(),(int64_t)1000000);
+    const int64_t firstRxNs=trace.begin()->rxTimestampNs;
+    SequenceTracker sequence;
+    AvgCalculator bucketLatency;
+    uint64_t bucketSkipped=0;
+    const auto addEntry=[&](){
+        const auto nPackets=bucketLatency.getNSamples();
+        const float loss=nPackets+bucketSkipped==0 ? 1.0f : (float)bucketSkipped/(nPackets+bucketSkipped);
+        profile.push_back({std::chrono::nanoseconds(profile.size()*bucketNs),bucketLatency.getAvg(),loss});
+        bucketLatency.reset();
+        bucketSkipped=0;
+    };
+    for(const auto& record:trace){
+        while((record.rxTimestampNs-firstRxNs)/bucketNs>(int64_t)profile.size()){
+            addEntry();
+        }
+        bucketLatency.add(std::chrono::nanoseconds(std::max(record.rxTimestampNs-record.txTimestampNs,(int64_t)0)));
+        const auto nSkippedBefore=sequence.getNSkipped();
+        sequence.add(record.seqNr);
+        bucketSkipped+=sequence.getNSkipped()-nSkippedBefore;
+    }
+    addEntry();
+    // Marks the end of the last bucket, the profile loops from there
+    profile.push_back({std::chrono::nanoseconds(profile.size()*bucketNs),profile.back().latency,profile.back().lossProbability});
+    std::cout<<"Loaded "<<profile.size()<<" profile entries from "<<traceFileName<<"\n";
+    return profile;
+}
+
+static void printUsage(){
+    std::cout<<"Usage: [-s=packet size in bytes] [-p=packets per second] [-t=time to run in seconds]"
+			//<<"[-i=input udp port] [-o=output udp port]"
+			<<" [-m= mode 0 for sendto localhost, 1 airpi (ethernet+wfb), 2 wfb tx and rx on this pc,"
+			<<" syncserver / syncclient for clock sync only, reflect to echo packets, rtt to measure the round trip via a reflector at -a,"
+			<<" tx / rx to run only one side and write a result file, merge <tx file> <rx file> to join them,"
+			<<" analyze <trace file> [bucket ms] to analyze a trace, alloc to count heap allocations per received packet, loop to compare a thread per receiver with one epoll event loop,"
+			<<" uring to compare the classic and the io_uring backend, spin to compare blocking / spinning / adaptive spin-then-block receive, reuseport [hash|cpu|bpf] for the receive throughput of 1,2,4 SO_REUSEPORT workers, emulate to relay 6002 -> 6001 like a wfb link]"
+			<<" [-f=result file for tx / rx] [-r=write a per packet trace of the receiver to this file]"
+			<<" [-e=link impairments for emulate, e.g. delay=2000,jitter=500,ge=0.01:0.3:0:0.8,reorder=0.01,dup=0.001,rate=8000,queue=65536,profile=trace.bin:10]"
+			<<" [-x=fec k:n[:block timeout ms], e.g. 4:8:20 like wfb -k 4 -n 8]"
+			<<" [-g=send video frames, fps:kbit/s:gop length[:key frame ratio] or a file with one frame size per line[:fps]]"
+			<<" [-F send each video frame as one payload through the fragmentation / reassembly layer]"
+			<<" [-l=interval in us of a cyclictest like scheduler wakeup latency probe next to the receiver]"
+			<<" [-d=deliver packets on a consumer thread behind a lock-free ring, capacity[:oldest|newest|block] (what to drop when full)]"
+			<<" [-S=spin-then-block receive, max spin us[:SO_BUSY_POLL us]]"
+			<<" [-R=receiver / sender / consumer threads, e.g. fifo:80,irq:eth0:1,txcpu:3,mlock,stack:65536 or rr:50,cpu:2,consumercpu:3]"
+			<<" [-a=destination ip]"
+			<<" [-y estimate the tx/rx clock offset for one way latency] [-o=artificial tx clock offset in us]"
+			<<" [-b=receive batch size (recvmmsg), 0 to disable]"
+			<<" [-c compare sendto,sendmmsg and GSO throughput instead of measuring latency]"
+			<<" [-k use kernel timestamps to split latency into send/network/receive stages]"
+			<<" [-w=pacing 0=sleep_for 1=nanosleep(default) 2=timerfd 3=hybrid 4=txtime]"
+			<<" [-v benchmark the packet verification methods]\n";
+}
+
+// Checked number parsing for the option specs, false unless all of @param text is a number that fits into T
+template<class T>
+static bool parseNumber(const std::string& text,T& value){
+    if(text.empty() || isspace((unsigned char)text[0])){
+        return false;
+    }
+    char* end=nullptr;
+    errno=0;
+    if constexpr(std::is_floating_point_v<T>){
+        const double parsed=strtod(text.c_str(),&end);
+        if(errno!=0 || *end!='\0'){
+            return false;
+        }
+        value=(T)parsed;
+    }else if constexpr(std::is_signed_v<T>){
+        const long long parsed=strtoll(text.c_str(),&end,10);
+        if(errno!=0 || *end!='\0' || parsed<std::numeric_limits<T>::min() || parsed>std::numeric_limits<T>::max()){
+            return false;
+        }
+        value=(T)parsed;
+    }else{
+        const unsigned long long parsed=strtoull(text.c_str(),&end,10);
+        if(text[0]=='-' || errno!=0 || *end!='\0' || parsed>std::numeric_limits<T>::max()){
+            return false;
+        }
+        value=(T)parsed;
+    }
+    return true;
+}
+
+// Split @param text at each @param separator, empty parts are kept (such that "4:" is two parts)
+static std::vector<std::string> splitSpec(const std::string& text,const char separator){
+    std::vector<std::string> parts;
+    std::size_t begin=0;
+    while(true){
+        const auto end=text.find(separator,begin);
+        parts.push_back(text.substr(begin,end==std::string::npos ? std::string::npos : end-begin));
+        if(end==std::string::npos){
+            return parts;
+        }
+        begin=end+1;
+    }
+}
+
+// Parse the -e impairment spec, comma separated key=value:
+// delay=us jitter=us ge=pGoodToBad:pBadToGood:lossGood:lossBad reorder=probability[:delay us] dup=probability
+// rate=kbit/s queue=bytes profile=trace file[:bucket ms] seed=n
+static bool parseLinkEmulatorConfig(const std::string& spec,LinkEmulatorConfig& config){
+    std::stringstream entries(spec);
+    std::string entry;
+    while(std::getline(entries,entry,',')){
+        const auto separator=entry.find('=');
+        if(separator==std::string::npos){
+            MLOGE<<"Invalid impairment "<<entry;
+            return false;
+        }
+        const std::string key=entry.substr(0,separator);
+        std::vector<std::string> values;
+        std::stringstream valueStream(entry.substr(separator+1));
+        std::string value;
+        while(std::getline(valueStream,value,':')){
+            values.push_back(value);
+        }
+        // The value at @param index (or @param defaultValue if not given) into @param value, false if it is not a number
+        const auto number=[&values](const std::size_t index,const char* defaultValue,auto& value){
+            return parseNumber(index<values.size() ? values[index] : defaultValue,value);
+        };
+        const auto probability=[&number](const std::size_t index,const char* defaultValue,float& value){
+            return number(index,defaultValue,value) && value>=0 && value<=1;
+        };
+        bool valid=true;
+        if(key=="delay" || key=="jitter"){
+            int64_t us=0;
+            valid=number(0,"0",us) && us>=0;
+            (key=="delay" ? config.latency : config.jitter)=std::chrono::microseconds(us);
+        }else if(key=="ge"){
+            valid=probability(0,"0",config.pGoodToBad) && probability(1,"1",config.pBadToGood) &&
+                  probability(2,"0",config.lossGood) && probability(3,"1",config.lossBad);
+        }else if(key=="reorder"){
+            int64_t delayUs=0;
+            valid=probability(0,"0",config.reorderProbability) && number(1,"1000",delayUs) && delayUs>=0;
+            config.reorderDelay=std::chrono::microseconds(delayUs);
+        }else if(key=="dup"){
+            valid=probability(0,"0",config.duplicateProbability);
+        }else if(key=="rate"){
+            valid=number(0,"0",config.rateBitsPerSecond);
+            config.rateBitsPerSecond*=1000;
+        }else if(key=="queue"){
+            valid=number(0,"65536",config.queueLimitBytes);
+        }else if(key=="profile"){
+            int intervalMs=0;
+            valid=number(1,"10",intervalMs) && intervalMs>0;
+            if(valid){
+                config.profile=loadLinkProfile(values.empty() ? "trace.bin" : values[0],std::chrono::milliseconds(intervalMs));
+            }
+        }else if(key=="seed"){
+            valid=number(0,"0",config.seed);
+        }else{
+            MLOGE<<"Unknown impairment "<<key;
+            return false;
+        }
+        if(!valid){
+            MLOGE<<"Invalid impairment "<<entry;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Parse the -R thread spec, comma separated: fifo:priority or rr:priority (all threads), cpu:n (receiver),
+// txcpu:n (sender), consumercpu:n (consumer of -d), irq:interface[:offset] (receiver next to the NIC interrupt),
+// mlock, stack:bytes (all threads)
+static bool parseThreadConfig(const std::string& spec,LinuxThreadHelper::Config& receiver,LinuxThreadHelper::Config& sender,
+                              LinuxThreadHelper::Config& consumer){
+    std::stringstream entries(spec);
+    std::string entry;
+    while(std::getline(entries,entry,',')){
+        const auto separator=entry.find(':');
+        const std::string key=entry.substr(0,separator);
+        const std::string value=separator==std::string::npos ? "" : entry.substr(separator+1);
+        bool valid=true;
+        if(key=="fifo" || key=="rr"){
+            int priority=50;
+            valid=(value.empty() || parseNumber(value,priority)) && priority>=1 && priority<=99;
+            receiver.policy=sender.policy=consumer.policy=key=="fifo" ? SCHED_FIFO : SCHED_RR;
+            receiver.priority=sender.priority=consumer.priority=priority;
+        }else if(key=="cpu"){
+            valid=parseNumber(value,receiver.cpu) && receiver.cpu>=0;
+        }else if(key=="txcpu"){
+            valid=parseNumber(value,sender.cpu) && sender.cpu>=0;
+        }else if(key=="consumercpu"){
+            valid=parseNumber(value,consumer.cpu) && consumer.cpu>=0;
+        }else if(key=="irq"){
+            const auto offsetSeparator=value.find(':');
+            receiver.irqInterface=value.substr(0,offsetSeparator);
+            valid=!receiver.irqInterface.empty() &&
+                  (offsetSeparator==std::string::npos || parseNumber(value.substr(offsetSeparator+1),receiver.irqCpuOffset));
+        }else if(key=="mlock"){
+            receiver.lockMemory=sender.lockMemory=consumer.lockMemory=true;
+        }else if(key=="stack"){
+            valid=parseNumber(value,receiver.prefaultStackSize);
+            sender.prefaultStackSize=consumer.prefaultStackSize=receiver.prefaultStackSize;
+        }else{
+            MLOGE<<"Unknown thread option "<<key;
+            return false;
+        }
+        if(!valid){
+            MLOGE<<"Invalid thread option "<<entry;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Relay EMULATOR_PORT -> DESTINATION_IP:INPUT_PORT with the impairments of -e, run the latency test with -m 1 -a 127.0.0.1
+static void run_link_emulator(const Options& o,const int timeSeconds){
+    LinkEmulator emulator{o.EMULATOR_PORT,o.DESTINATION_IP,o.INPUT_PORT,o.EMULATOR_CONFIG};
+    emulator.start();
+    std::cout<<"Emulating link "<<o.EMULATOR_PORT<<" -> "<<o.DESTINATION_IP<<":"<<o.INPUT_PORT<<" for "<<timeSeconds<<"s\n";
+    for(int i=0;i<timeSeconds;i++){
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        std::cout<<"Link "<<emulator.getStatsReadable()<<"\n";
+    }
+    emulator.stop();
+    std::cout<<"Link "<<emulator.getStatsReadable()<<"\n";
+    std::cout<<"Scheduling error of delayed packets "<<emulator.getSchedulingError().getPercentilesReadable()<<"\n";
+}
 
 int main(int argc, char *argv[])
 {
@@ -219,7 +1789,26 @@ int main(int argc, char *argv[])
 	int output_port=6001;
 	// default localhost
 	int mode=0;
-    while ((opt = getopt(argc, argv, "s:p:t:m:")) != -1) {
+	std::string modeName="0";
+	std::string destinationIp;
+	bool clockSync=false;
+	int clockOffsetUs=0;
+	int batchSize=0;
+	bool compareSendMethods=false;
+	bool kernelTimestamps=false;
+	int pacing=(int)Pacer::Strategy::NANOSLEEP;
+	bool compareVerifyMethods=false;
+	std::string resultFileName;
+	std::string traceFileName;
+	std::string impairments;
+	std::string fecSpec;
+	std::string videoSpec;
+	bool fragmentation=false;
+	int wakeupProbeIntervalUs=0;
+	std::string threadSpec;
+	std::string decoupledSpec;
+	std::string spinSpec;
+    while ((opt = getopt(argc, argv, "s:p:t:m:b:ckw:va:yo:f:r:e:x:g:Fl:R:d:S:")) != -1) {
         switch (opt) {
         case 's':
             ps = atoi(optarg);
@@ -237,31 +1826,230 @@ int main(int argc, char *argv[])
 		//	output_port=atoi(optarg);
 		//	break;
 		case 'm':
+			modeName=optarg;
 			mode=atoi(optarg);
 			break;
+		case 'a':
+			destinationIp=optarg;
+			break;
+		case 'y':
+			clockSync=true;
+			break;
+		case 'o':
+			clockOffsetUs=atoi(optarg);
+			break;
+		case 'f':
+			resultFileName=optarg;
+			break;
+		case 'r':
+			traceFileName=optarg;
+			break;
+		case 'e':
+			impairments=optarg;
+			break;
+		case 'x':
+			fecSpec=optarg;
+			break;
+		case 'g':
+			videoSpec=optarg;
+			break;
+		case 'F':
+			fragmentation=true;
+			break;
+		case 'l':
+			wakeupProbeIntervalUs=atoi(optarg);
+			break;
+		case 'R':
+			threadSpec=optarg;
+			break;
+		case 'd':
+			decoupledSpec=optarg;
+			break;
+		case 'S':
+			spinSpec=optarg;
+			break;
+		case 'b':
+			batchSize=atoi(optarg);
+			break;
+		case 'c':
+			compareSendMethods=true;
+			break;
+		case 'k':
+			kernelTimestamps=true;
+			break;
+		case 'v':
+			compareVerifyMethods=true;
+			break;
+		case 'w':
+			pacing=atoi(optarg);
+			if(pacing<0 || pacing>=Pacer::N_STRATEGIES){
+				goto show_usage;
+			}
+			break;
         default: /* '?' */
         show_usage:
-            std::cout<<"Usage: [-s=packet size in bytes] [-p=packets per second] [-t=time to run in seconds]"
-			//<<"[-i=input udp port] [-o=output udp port]"
-			<<" [-m= mode 0 for sendto localhost else airpi (ethernet+wfb)]\n";
+            printUsage();
             return 1;
         }
     }
-	// Mode test localhost
-	const Options options0{ps,pps,pps*wantedTime,6001,6001,"127.0.0.1"};
-	// Mode test wfb latency, data goes via ethernet to port 6002 on air pi where it is received and transmitted via wb
-	// On the ground data is received via wb and forwarded to port 6001
-	const Options options1{ps,pps,pps*wantedTime,6001,6002,"192.168.0.14"};
-	// for when the tx and rx is on the same pc
-	const Options options2{ps,pps,pps*wantedTime,6100,6000,"127.0.0.1"};
-	const Options options = (mode==0) ? options0 : options2;
+	Options options{};
+	options.PACKET_SIZE=ps;
+	options.WANTED_PACKETS_PER_SECOND=pps;
+	options.N_PACKETS=pps*wantedTime;
+	// reflect / rtt parse as mode 0 (localhost ports)
+	if(mode==1){
+		// Mode test wfb latency, data goes via ethernet to port 6002 on air pi where it is received and transmitted via wb
+		// On the ground data is received via wb and forwarded to port 6001
+		options.OUTPUT_PORT=6002;
+		options.DESTINATION_IP="192.168.0.14";
+	}else if(mode!=0){
+		// for when the tx and rx is on the same pc
+		options.INPUT_PORT=6100;
+		options.OUTPUT_PORT=6000;
+	}
+	options.ROUND_TRIP=modeName=="rtt";
+	options.RECEIVE_BATCH_SIZE=batchSize;
+	options.KERNEL_TIMESTAMPS=kernelTimestamps;
+	options.PACING=(Pacer::Strategy)pacing;
+	if(!destinationIp.empty()){
+		options.DESTINATION_IP=destinationIp;
+	}
+	options.CLOCK_SYNC=clockSync;
+	options.TRACE_FILE=traceFileName;
+	if(!impairments.empty() && !parseLinkEmulatorConfig(impairments,options.EMULATOR_CONFIG)){
+		printUsage();
+		return 1;
+	}
+	if(!fecSpec.empty()){
+		const auto parts=splitSpec(fecSpec,':');
+		int64_t fecTimeoutMs=0;
+		if(parts.size()<2 || parts.size()>3 || !parseNumber(parts[0],options.FEC_K) || !parseNumber(parts[1],options.FEC_N) ||
+		   (parts.size()==3 && !parseNumber(parts[2],fecTimeoutMs)) || options.FEC_K<1 ||
+		   options.FEC_N<options.FEC_K || options.FEC_N>FEC::MAX_FRAGMENTS || fecTimeoutMs<0){
+			std::cout<<"Invalid fec "<<fecSpec<<"\n";
+			printUsage();
+			return 1;
+		}
+		options.FEC_TIMEOUT=std::chrono::milliseconds(fecTimeoutMs);
+	}
+	options.FRAGMENTATION=fragmentation;
+	options.WAKEUP_PROBE_INTERVAL=std::chrono::microseconds(wakeupProbeIntervalUs);
+	if(!decoupledSpec.empty()){
+		const auto separator=decoupledSpec.find(':');
+		const std::string policy=separator==std::string::npos ? "oldest" : decoupledSpec.substr(separator+1);
+		if(!parseNumber(decoupledSpec.substr(0,separator),options.DECOUPLED_CAPACITY) || options.DECOUPLED_CAPACITY==0){
+			std::cout<<"Invalid ring capacity "<<decoupledSpec<<"\n";
+			printUsage();
+			return 1;
+		}
+		if(policy=="oldest"){
+			options.DECOUPLED_POLICY=DatagramRing::Policy::DROP_OLDEST;
+		}else if(policy=="newest"){
+			options.DECOUPLED_POLICY=DatagramRing::Policy::DROP_NEWEST;
+		}else if(policy=="block"){
+			options.DECOUPLED_POLICY=DatagramRing::Policy::BLOCK;
+		}else{
+			std::cout<<"Invalid ring policy "<<policy<<"\n";
+			printUsage();
+			return 1;
+		}
+	}
+	if(!spinSpec.empty()){
+		const auto separator=spinSpec.find(':');
+		int maxSpinUs=0;
+		if(!parseNumber(spinSpec.substr(0,separator),maxSpinUs) || maxSpinUs<0 ||
+		   (separator!=std::string::npos && (!parseNumber(spinSpec.substr(separator+1),options.RECEIVER_BUSY_POLL_US) || options.RECEIVER_BUSY_POLL_US<0))){
+			std::cout<<"Invalid spin "<<spinSpec<<"\n";
+			printUsage();
+			return 1;
+		}
+		options.RECEIVER_MAX_SPIN=std::chrono::microseconds(maxSpinUs);
+	}
+	if(!threadSpec.empty() && !parseThreadConfig(threadSpec,options.RECEIVER_THREAD_CONFIG,options.SENDER_THREAD_CONFIG,options.CONSUMER_THREAD_CONFIG)){
+		printUsage();
+		return 1;
+	}
+	if(!videoSpec.empty()){
+		options.VIDEO=true;
+		auto& model=options.VIDEO_MODEL;
+		// A file (that has to exist) with an optional :fps suffix, else the GOP model numbers
+		const auto isFile=[](const std::string& fileName){return std::ifstream(fileName).good();};
+		const auto separator=videoSpec.rfind(':');
+		bool valid=true;
+		if(isFile(videoSpec)){
+			options.VIDEO_FRAME_SIZES_FILE=videoSpec;
+		}else if(separator!=std::string::npos && isFile(videoSpec.substr(0,separator))){
+			options.VIDEO_FRAME_SIZES_FILE=videoSpec.substr(0,separator);
+			valid=parseNumber(videoSpec.substr(separator+1),model.fps);
+		}else{
+			const auto parts=splitSpec(videoSpec,':');
+			valid=(parts.size()==3 || parts.size()==4) && parseNumber(parts[0],model.fps) && parseNumber(parts[1],model.bitrateKbit) &&
+				  parseNumber(parts[2],model.gopLength) && (parts.size()==3 || parseNumber(parts[3],model.keyFrameRatio)) &&
+				  model.bitrateKbit>0 && model.keyFrameRatio>0;
+		}
+		if(!valid){
+			std::cout<<"Invalid video "<<videoSpec<<"\n";
+			printUsage();
+			return 1;
+		}
+		if(model.fps<=0 || model.gopLength<=0){
+			std::cout<<"Invalid video "<<videoSpec<<"\n";
+			printUsage();
+			return 1;
+		}
+	}
+	options.CLOCK_OFFSET=std::chrono::microseconds(clockOffsetUs);
 
     // For a packet size of 1024 bytes, 1024 packets per second equals 1 MB/s or 8 MBit/s
     // 8 MBit/s is a just enough for encoded 720p video
     std::cout<<"Selected packet size"<<options.PACKET_SIZE<<"\n";
     std::cout<<"Selected input: "<<options.INPUT_PORT<<"\n";
     std::cout<<"Selected output: "<<options.DESTINATION_IP<<" OUTPUT_PORT"<<options.OUTPUT_PORT<<"\n";
-	test_latency(options);
+	if(modeName=="tx"){
+		run_tx(options,resultFileName.empty() ? "tx.bin" : resultFileName);
+	}else if(modeName=="rx"){
+		run_rx(options,resultFileName.empty() ? "rx.bin" : resultFileName,wantedTime);
+	}else if(modeName=="merge"){
+		merge_results(optind<argc ? argv[optind] : "tx.bin",optind+1<argc ? argv[optind+1] : "rx.bin");
+	}else if(modeName=="analyze"){
+		analyze_trace(optind<argc ? argv[optind] : "trace.bin",std::chrono::milliseconds(optind+1<argc ? atoi(argv[optind+1]) : 50));
+	}else if(modeName=="emulate"){
+		run_link_emulator(options,wantedTime);
+	}else if(modeName=="reflect"){
+		run_reflector(options,wantedTime);
+	}else if(modeName=="spin"){
+		test_spin(options,wantedTime);
+	}else if(modeName=="uring"){
+		test_io_uring(options,wantedTime);
+	}else if(modeName=="reuseport"){
+		const std::string steering=optind<argc ? argv[optind] : "hash";
+		test_receiver_group(options,wantedTime,steering=="cpu" ? ReceiverGroup::Steering::INCOMING_CPU :
+		steering=="bpf" ? ReceiverGroup::Steering::CPU_BPF : ReceiverGroup::Steering::HASH);
+	}else if(modeName=="loop"){
+		test_event_loop(options,wantedTime);
+	}else if(modeName=="alloc"){
+		return test_allocations(options) ? 0 : 1;
+	}else if(modeName=="syncserver" || modeName=="syncclient"){
+		test_clock_sync(options,modeName=="syncserver",wantedTime);
+	}else if(compareSendMethods){
+		test_send_methods(options);
+	}else if(compareVerifyMethods){
+		test_verify_methods(options);
+	}else if(options.VIDEO){
+		std::vector<uint32_t> frameSizes;
+		if(!options.VIDEO_FRAME_SIZES_FILE.empty()){
+			if(!VideoTrafficGenerator::loadFrameSizes(options.VIDEO_FRAME_SIZES_FILE,frameSizes)){
+				return 1;
+			}
+			VideoTrafficGenerator generator{frameSizes,options.VIDEO_MODEL.fps};
+			test_video(options,generator,wantedTime);
+		}else{
+			VideoTrafficGenerator generator{options.VIDEO_MODEL};
+			test_video(options,generator,wantedTime);
+		}
+	}else{
+		test_latency(options);
+	}
 
 
     return 0;